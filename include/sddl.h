@@ -84,19 +84,191 @@ typedef struct SDDLVarDecl_t * SDDLVarDecl;
 
 typedef struct SDDLParseResult_t * SDDLParseResult;
 
+typedef struct SDDLParser_t * SDDLParser;
+
+// Called by an incremental parser as soon as a top-level var's definition
+// has been fully parsed.  <var> belongs to the document being built.
+typedef void (*SDDLVarCallback)(SDDLVarDecl var, void *userdata);
+
+// Memory statistics for the arena backing a parsed document.
+typedef struct
+{
+    size_t num_blocks;      // heap blocks obtained by the arena
+    size_t bytes_reserved;  // total capacity of those blocks
+    size_t bytes_used;      // bytes handed out, including alignment padding
+    size_t num_allocations; // allocations served from the blocks
+} SDDLArenaStats;
+
+// Memory allocation hooks.  <malloc_fn> and <realloc_fn> return NULL on
+// failure, like their C library counterparts; <free_fn> is never passed
+// NULL.  All three receive <userdata>.
+typedef struct
+{
+    void * (*malloc_fn)(size_t size, void *userdata);
+    void * (*realloc_fn)(void *ptr, size_t size, void *userdata);
+    void (*free_fn)(void *ptr, void *userdata);
+    void *userdata;
+} SDDLAllocator;
+
+// Sets the allocator for everything libsddl allocates from now on, except
+// documents parsed with their own (see SDDLParseOptions).  NULL restores
+// the C library's.  Not thread-safe: set it before using libsddl.  Objects
+// other than documents are freed through whatever allocator is global at
+// the time, so don't change it while any are alive.  (Memory allocated
+// by libred, such as RedJson objects, does not go through it.)
+void sddl_set_allocator(const SDDLAllocator *allocator);
+
+typedef enum
+{
+    SDDL_DIAGNOSTIC_OUT_OF_MEMORY,
+    SDDL_DIAGNOSTIC_SYNTAX,             // malformed JSON
+    SDDL_DIAGNOSTIC_BAD_LITERAL,        // bad number, literal or escape
+    SDDL_DIAGNOSTIC_UNTERMINATED,       // string, comment or document
+    SDDL_DIAGNOSTIC_BAD_DECLARATION,    // unparsable variable declaration
+    SDDL_DIAGNOSTIC_TOO_DEEP,           // variables nested too deeply
+    SDDL_DIAGNOSTIC_WRONG_TYPE,         // field value of the wrong JSON type
+    SDDL_DIAGNOSTIC_BAD_FIELD_VALUE,    // e.g. unknown numeric-display-hint
+    SDDL_DIAGNOSTIC_UNEXPECTED_FIELD,
+} SDDLDiagnosticCodeEnum;
+
+// A parse error or warning.  Strings belong to the parse result.
+typedef struct
+{
+    SDDLDiagnosticCodeEnum code;
+    bool is_error;
+    size_t offset;          // bytes into the input
+    unsigned line;
+    unsigned col;
+    const char *path;       // dotted path of the var being parsed, or ""
+    const char *message;    // fixed text describing <code> in context
+    const char *detail;     // the offending key or value, or ""
+} SDDLDiagnostic;
+
+// Options for the *_with_options parse functions.  Zero-initialize, then
+// set the fields of interest; passing NULL options is the same as passing
+// all zeros.
+typedef struct
+{
+    // Fill in SDDLParseStats for the result (see sddl_parse_result_stats).
+    // Ignored unless libsddl was built with SDDL_PARSE_STATS defined.
+    bool collect_stats;
+
+    // Allocator for the document, the parse result and the parser, or NULL
+    // for the global one.  The document keeps a copy, but <userdata> must
+    // stay valid for as long as the document lives.
+    const SDDLAllocator *allocator;
+
+    // Warnings past this many are counted but not kept; 0 means no limit.
+    // The error that fails a parse is always kept.
+    unsigned max_diagnostics;
+
+    // Fail the parse at the first diagnostic, warnings included, rather
+    // than only at the first error.
+    bool fail_fast;
+} SDDLParseOptions;
+
+// Where a parse spent its time and memory.  The timed phases don't overlap
+// and add up to <total_ns>, which covers only time spent inside libsddl
+// (so not waiting for an incremental parser's next chunk).
+typedef struct
+{
+    uint64_t total_ns;
+    uint64_t lex_ns;            // scanning, unescaping strings, numbers
+    uint64_t grammar_ns;        // handling tokens, other than the below
+    uint64_t decl_ns;           // parsing declaration keys
+    uint64_t var_table_ns;      // growing the document's var array
+    uint64_t finish_ns;         // name indexes and the path table
+    size_t heap_allocations;    // by the parser, arena blocks included
+    size_t heap_bytes;
+    size_t arena_allocations;
+    size_t arena_bytes;
+    size_t input_bytes;
+    unsigned num_tokens;
+    unsigned num_vars;          // vars and struct members
+    unsigned num_structs;
+    unsigned max_depth;         // 1 when no var is nested in a struct
+} SDDLParseStats;
+
 SDDLParseResult sddl_load_and_parse(const char *filename);
 SDDLParseResult sddl_load_and_parse_file(FILE *file);
 SDDLParseResult sddl_parse(const char *sddl);
 
+SDDLParseResult sddl_load_and_parse_with_options(const char *filename, const SDDLParseOptions *options);
+SDDLParseResult sddl_parse_with_options(const char *sddl, const SDDLParseOptions *options);
+
+// Incremental parsing, for input arriving over a pipe or socket.  Text may
+// be fed in chunks of any size; the parser never buffers more than the
+// string it is currently lexing.  <callback> may be NULL.
+SDDLParser sddl_parser_new(SDDLVarCallback callback, void *userdata);
+SDDLParser sddl_parser_new_with_options(SDDLVarCallback callback, void *userdata, const SDDLParseOptions *options);
+
+// Returns false once the input is known to be invalid; further input is
+// ignored and the errors are reported by sddl_parser_finish.
+bool sddl_parser_feed(SDDLParser parser, const char *buf, size_t len);
+
+// Signals end of input and frees <parser>.
+SDDLParseResult sddl_parser_finish(SDDLParser parser);
+
 bool sddl_parse_result_ok(SDDLParseResult result);
+
+// Errors and warnings, in input order.
+unsigned sddl_parse_result_num_diagnostics(SDDLParseResult result);
+const SDDLDiagnostic * sddl_parse_result_diagnostic(SDDLParseResult result, unsigned index);
+// Warnings left out because of SDDLParseOptions.max_diagnostics.
+unsigned sddl_parse_result_num_dropped_diagnostics(SDDLParseResult result);
+
 SDDLDocument sddl_parse_result_document(SDDLParseResult result);
 SDDLDocument sddl_parse_result_ref_document(SDDLParseResult result);
+
+// The diagnostics as "line L, col C: message" strings, formatted on first
+// use.
 unsigned sddl_parse_result_num_errors(SDDLParseResult result);
 const char * sddl_parse_result_error(SDDLParseResult result, unsigned index);
 unsigned sddl_parse_result_num_warnings(SDDLParseResult result);
 const char * sddl_parse_result_warning(SDDLParseResult result, unsigned index);
 void sddl_free_parse_result(SDDLParseResult result);
 
+// Returns the statistics collected while parsing, or NULL if they weren't
+// asked for or libsddl was built without SDDL_PARSE_STATS.  Owned by
+// <result>.
+const SDDLParseStats * sddl_parse_result_stats(SDDLParseResult result);
+
+// Documents are reference counted, atomically, so references may be taken
+// and dropped from any thread.  The last unref frees the document.
+SDDLDocument sddl_ref_document(SDDLDocument doc);
+void sddl_unref_document(SDDLDocument doc);
+
+// Makes <doc> immutable.  Once frozen, every sddl_document_* and sddl_var_*
+// accessor may be called on the document and its vars from any number of
+// threads without locking.  sddl_var_set_extra becomes a no-op for its vars,
+// so set extras before freezing.  Freeze before sharing the document;
+// freezing is not itself thread-safe.
+void sddl_document_freeze(SDDLDocument doc);
+bool sddl_document_is_frozen(SDDLDocument doc);
+
+void sddl_document_arena_stats(SDDLDocument doc, SDDLArenaStats *outStats);
+
+// Receives successive chunks of serialized text.  Returns false to abort.
+typedef bool (*SDDLWriteCallback)(const char *chars, size_t len, void *userdata);
+
+// Writes <doc> as canonical SDDL text into <buf>, snprintf-style: returns
+// the full length of the text, and if that is >= <cap> the output was
+// truncated.  <buf> is always NUL-terminated when <cap> > 0.
+size_t sddl_document_serialize(SDDLDocument doc, char *buf, size_t cap);
+// Same text, streamed to <callback> in chunks of up to 4 KiB.  Returns
+// false if the callback aborted.
+bool sddl_document_serialize_to(SDDLDocument doc, SDDLWriteCallback callback, void *userdata);
+
+// Writes <doc> to <filename> as a compiled, position-independent binary
+// image.  The file is replaced atomically, so processes that have the old
+// image loaded are unaffected.  Returns false on OOM or I/O error.
+bool sddl_document_compile(SDDLDocument doc, const char *filename);
+
+// Maps an image written by sddl_document_compile and returns it as a
+// read-only document, without parsing.  Returns NULL if the file is
+// missing, corrupt, or was written by an incompatible version of libsddl.
+SDDLDocument sddl_document_load_image(const char *filename);
+
 const char * sddl_document_description(SDDLDocument doc);
 unsigned sddl_document_num_authors(SDDLDocument doc);
 const char * sddl_document_author(SDDLDocument doc, unsigned index);
@@ -105,6 +277,46 @@ unsigned sddl_document_num_vars(SDDLDocument doc);
 SDDLVarDecl sddl_document_var_by_idx(SDDLDocument doc, unsigned index);
 SDDLVarDecl sddl_document_var_by_name(SDDLDocument doc, const char *name);
 
+// Looks up a var or struct member by dotted path, e.g. "motor.temp.max".
+SDDLVarDecl sddl_document_var_by_path(SDDLDocument doc, const char *path);
+SDDLVarDecl sddl_document_var_by_path_hashed(
+        SDDLDocument doc, 
+        const char *path, 
+        size_t len, 
+        uint32_t hash);
+
+// One entry of a document's flattened var table.
+typedef struct
+{
+    SDDLVarDecl var;
+    const char *path;           // e.g. "motor.temp"
+    int parent;                 // flat index of the enclosing struct, or -1
+    unsigned depth;             // 0 for top-level vars
+    SDDLDatatypeEnum datatype;  // same as sddl_var_datatype(var)
+    SDDLDirectionEnum direction;    // same as sddl_var_concrete_direction(var)
+} SDDLFlatVar;
+
+// Every var and struct member of <doc> in preorder, each struct directly
+// followed by its members, in one contiguous array owned by <doc>.
+unsigned sddl_document_num_flat_vars(SDDLDocument doc);
+const SDDLFlatVar * sddl_document_flat_vars(SDDLDocument doc);
+// Just the vars that aren't structs, in the same order.  <parent> still
+// indexes the full flat table.
+unsigned sddl_document_num_leaf_vars(SDDLDocument doc);
+const SDDLFlatVar * sddl_document_leaf_vars(SDDLDocument doc);
+
+// Hash used by the name indexes.  Callers that look up the same key
+// repeatedly may compute it once and use the *_hashed lookup variants.
+uint32_t sddl_name_hash(const char *name, size_t len);
+
+// Same as sddl_document_var_by_name, but <name> need not be NUL-terminated.
+// <hash> must equal sddl_name_hash(name, len).
+SDDLVarDecl sddl_document_var_by_name_hashed(
+        SDDLDocument doc, 
+        const char *name, 
+        size_t len, 
+        uint32_t hash);
+
 
 const char * sddl_var_name(SDDLVarDecl var);
 SDDLDatatypeEnum sddl_var_datatype(SDDLVarDecl var);
@@ -118,18 +330,30 @@ const char * sddl_var_units(SDDLVarDecl var);
 SDDLDirectionEnum sddl_var_direction(SDDLVarDecl var);
 SDDLDirectionEnum sddl_var_concrete_direction(SDDLVarDecl var);
 
+// The struct <var> is a member of, or NULL for a top-level var.
+SDDLVarDecl sddl_var_parent(SDDLVarDecl var);
 unsigned sddl_var_struct_num_members(SDDLVarDecl var);
 SDDLVarDecl sddl_var_struct_member_by_idx(SDDLVarDecl var, unsigned index);
 SDDLVarDecl sddl_var_struct_member_by_name(SDDLVarDecl var, const char *name);
+SDDLVarDecl sddl_var_struct_member_by_name_hashed(
+        SDDLVarDecl var, 
+        const char *name, 
+        size_t len, 
+        uint32_t hash);
 
 unsigned sddl_var_array_num_elements(SDDLVarDecl var);
 
+// Ignored for vars of frozen documents.
 void sddl_var_set_extra(SDDLVarDecl var, void *extra);
 void * sddl_var_extra(SDDLVarDecl var);
 
+// JSON definition of <var>.  For programmatically constructed vars it is
+// built on first call and owned by the var, and stays valid until the var,
+// or a struct containing it, is modified.
 RedJsonObject sddl_var_json(SDDLVarDecl var);
 
-// Sets *outName to point to a newly allocated string
+// Sets *outName to point to a newly allocated string, to be released with
+// free() (not through the SDDLAllocator).
 SDDLResultEnum sddl_parse_decl(
         const char *decl, 
         SDDLDirectionEnum *outDirection, 
@@ -138,6 +362,24 @@ SDDLResultEnum sddl_parse_decl(
         SDDLDatatypeEnum *outArrayElementDatatype,
         size_t *outArraySize);
 
+// One parsed declaration, as filled in by sddl_parse_decls.
+typedef struct
+{
+    SDDLResultEnum result;
+    SDDLDirectionEnum direction;
+    SDDLDatatypeEnum datatype;
+    SDDLDatatypeEnum array_datatype;
+    size_t array_num_elements;
+    // Points into the declaration string; not NUL-terminated.
+    const char *name;
+    size_t name_len;
+} SDDLDeclInfo;
+
+// Parses <count> declarations into the caller-provided array <out>, without
+// allocating.  Returns the number that parsed successfully; each entry's
+// <result> says whether it did.
+unsigned sddl_parse_decls(const char * const *decls, unsigned count, SDDLDeclInfo *out);
+
 // Create new Cloud Variable Declaration for a basic variable with default
 // properties.
 SDDLVarDecl sddl_var_new_basic(
@@ -149,6 +391,8 @@ SDDLVarDecl sddl_var_new_basic(SDDLDatatypeEnum datatype, SDDLDirectionEnum dire
 SDDLVarDecl sddl_var_new_array(SDDLDatatypeEnum childDatatype, size_t numItems, SDDLDirectionEnum direction, const char *name);
 SDDLVarDecl sddl_var_new_struct(SDDLDirectionEnum direction, const char *name);
 bool sddl_var_struct_add_member(SDDLVarDecl strct, SDDLVarDecl member);
+// Appends <count> members at once; cheaper than adding them one by one.
+bool sddl_var_struct_add_members(SDDLVarDecl strct, const SDDLVarDecl *members, unsigned count);
 
 bool sddl_var_is_basic(SDDLVarDecl var);
 bool sddl_datatype_is_basic(SDDLDatatypeEnum datatype);
@@ -158,6 +402,363 @@ const char *sddl_var_decl_string(SDDLVarDecl var);
 const char * sddl_direction_string(SDDLDirectionEnum direction);
 const char * sddl_datatype_string(SDDLDatatypeEnum datatype);
 
+/*
+ * Packed binary values
+ *
+ * A codec lays out the values of a var, or of every var in a document, as a
+ * packed little-endian record.  Structs contribute each member's values and
+ * arrays one value per element, in declaration order; void vars are
+ * skipped.  Values are passed as an array of SDDLValue with one entry per
+ * value, using the member that matches sddl_codec_value_datatype.
+ */
+typedef struct SDDLCodec_t * SDDLCodec;
+
+typedef union
+{
+    bool b;
+    int8_t i8;
+    uint8_t u8;
+    int16_t i16;
+    uint16_t u16;
+    int32_t i32;
+    uint32_t u32;
+    float f32;
+    double f64;
+    int64_t datetime;   // encoded as-is; Unix time in milliseconds by convention
+    struct
+    {
+        const char *chars;  // need not be NUL-terminated
+        size_t len;         // at most 65535
+    } string;
+} SDDLValue;
+
+// Return NULL on OOM, or if a var's layout can't be derived (e.g. arrays of
+// structs).
+SDDLCodec sddl_codec_new_for_document(SDDLDocument doc);
+SDDLCodec sddl_codec_new_for_var(SDDLVarDecl var);
+void sddl_codec_free(SDDLCodec codec);
+
+unsigned sddl_codec_num_values(SDDLCodec codec);
+// The var each value belongs to; array elements all map to the array var.
+SDDLVarDecl sddl_codec_value_var(SDDLCodec codec, unsigned index);
+SDDLDatatypeEnum sddl_codec_value_datatype(SDDLCodec codec, unsigned index);
+
+// True unless the record contains strings.
+bool sddl_codec_is_fixed_size(SDDLCodec codec);
+size_t sddl_codec_encoded_size(SDDLCodec codec, const SDDLValue *values);
+
+// Returns the number of bytes written, or 0 if <buf> is too small.
+size_t sddl_codec_encode(SDDLCodec codec, const SDDLValue *values, void *buf, size_t bufSize);
+// Encodes <numRecords> records back to back; <values> holds
+// numRecords*sddl_codec_num_values entries.
+size_t sddl_codec_encode_records(SDDLCodec codec, const SDDLValue *values, unsigned numRecords, void *buf, size_t bufSize);
+
+// Return the number of bytes consumed, or 0 if <buf> is truncated.  Decoded
+// strings point into <buf>.
+size_t sddl_codec_decode(SDDLCodec codec, const void *buf, size_t len, SDDLValue *outValues);
+size_t sddl_codec_decode_records(SDDLCodec codec, const void *buf, size_t len, unsigned numRecords, SDDLValue *outValues);
+
+/*
+ * Memory layout
+ *
+ * A layout computes where the values of a var, or of every var in a
+ * document, live in a flat buffer: the size, alignment and offset of each
+ * var and struct member.  Values use the natural C type for their datatype
+ * (int64_t for datetime, const char * for string), arrays are C arrays, and
+ * structs follow C struct rules.  A document is laid out as a struct of its
+ * top-level vars.
+ */
+typedef enum
+{
+    // Same offsets a C compiler would give the equivalent struct.
+    SDDL_LAYOUT_NATURAL,
+    // No padding; every alignment is 1.
+    SDDL_LAYOUT_PACKED,
+    // Natural, but each top-level value starts on (and is padded to) a
+    // 64-byte cache line, so values written by different threads never
+    // share a line.
+    SDDL_LAYOUT_CACHE_LINE,
+} SDDLLayoutModeEnum;
+
+typedef struct SDDLLayout_t * SDDLLayout;
+
+typedef struct
+{
+    SDDLVarDecl var;
+    size_t offset;          // from the start of the buffer
+    size_t size;
+    size_t alignment;
+    size_t element_size;    // arrays: stride between elements; otherwise <size>
+} SDDLLayoutEntry;
+
+// Return NULL on OOM, or for vars with no layout (e.g. arrays of structs).
+SDDLLayout sddl_layout_new_for_document(SDDLDocument doc, SDDLLayoutModeEnum mode);
+SDDLLayout sddl_layout_new_for_var(SDDLVarDecl var, SDDLLayoutModeEnum mode);
+void sddl_layout_free(SDDLLayout layout);
+
+size_t sddl_layout_size(SDDLLayout layout);
+size_t sddl_layout_alignment(SDDLLayout layout);
+
+// Entries cover every var and struct member, in declaration order with
+// each struct followed by its members.
+unsigned sddl_layout_num_entries(SDDLLayout layout);
+const SDDLLayoutEntry * sddl_layout_entry(SDDLLayout layout, unsigned index);
+// Returns NULL if <var> is not part of the layout.
+const SDDLLayoutEntry * sddl_layout_entry_for_var(SDDLLayout layout, SDDLVarDecl var);
+
+/*
+ * Columnar time-series store
+ *
+ * Keeps the most recent <capacity> rows of samples for a document.  Each
+ * bool, numeric or datetime var (struct members included) is a column
+ * stored as one contiguous ring buffer of its C type (bool, int8_t ...
+ * double, int64_t for datetime).  Every row has a timestamp, and rows must
+ * be appended in timestamp order.
+ */
+typedef struct SDDLColumnStore_t * SDDLColumnStore;
+
+SDDLColumnStore sddl_column_store_new(SDDLDocument doc, size_t capacity);
+void sddl_column_store_free(SDDLColumnStore store);
+
+unsigned sddl_column_store_num_columns(SDDLColumnStore store);
+SDDLVarDecl sddl_column_store_column_var(SDDLColumnStore store, unsigned column);
+// Returns -1 if <var> has no column.
+int sddl_column_store_column_index(SDDLColumnStore store, SDDLVarDecl var);
+
+size_t sddl_column_store_capacity(SDDLColumnStore store);
+size_t sddl_column_store_num_rows(SDDLColumnStore store);
+
+// <values> has one entry per column, in column order.  Once the store is
+// full, each new row evicts the oldest.  Fails if <timestamp> is older than
+// the last row's.
+bool sddl_column_store_append_row(SDDLColumnStore store, int64_t timestamp, const SDDLValue *values);
+// Appends <numRows> rows; <values> holds numRows*num_columns entries, row
+// by row.  Returns the number of rows appended.
+size_t sddl_column_store_append_rows(SDDLColumnStore store, const int64_t *timestamps, const SDDLValue *values, size_t numRows);
+
+// Finds the retained rows with timestamps in [from, to].  Row 0 is the
+// oldest retained row.  Returns the number of rows in range.
+size_t sddl_column_store_find_range(SDDLColumnStore store, int64_t from, int64_t to, size_t *outFirstRow);
+
+// Zero-copy access to up to *inOutCount rows starting at <row>.  The run
+// stops early where the ring wraps, so *inOutCount is updated to the number
+// of rows returned; call again from row + *inOutCount for the rest.
+const void * sddl_column_store_column_span(SDDLColumnStore store, unsigned column, size_t row, size_t *inOutCount);
+const int64_t * sddl_column_store_timestamp_span(SDDLColumnStore store, size_t row, size_t *inOutCount);
+
+/*
+ * Constraint validation
+ *
+ * A validator compiles the min-value, max-value and regex constraints of
+ * every var and struct member in a document once.  Checking values against
+ * it does not allocate, and is safe from multiple threads.
+ */
+typedef struct SDDLValidator_t * SDDLValidator;
+
+// Returns NULL on OOM, or if a regex fails to compile (in which case
+// *outBadVar, if given, is set to the var declaring it).
+SDDLValidator sddl_validator_new(SDDLDocument doc, SDDLVarDecl *outBadVar);
+void sddl_validator_free(SDDLValidator validator);
+
+// Return true if <value> satisfies <var>'s range (numbers) or regex
+// (strings).  Vars without constraints accept everything.
+bool sddl_validator_check_number(SDDLValidator validator, SDDLVarDecl var, double value);
+bool sddl_validator_check_string(SDDLValidator validator, SDDLVarDecl var, const char *value);
+
+// Batch variants, e.g. for array elements or a run of samples.  Return the
+// index of the first failing value, or <count> if all pass.
+size_t sddl_validator_check_numbers(SDDLValidator validator, SDDLVarDecl var, const double *values, size_t count);
+size_t sddl_validator_check_strings(SDDLValidator validator, SDDLVarDecl var, const char * const *values, size_t count);
+
+/*
+ * Batch loading
+ *
+ * Loads many files at once, parsing them in parallel on a pool of threads.
+ * Results come back in input order, each exactly what sddl_load_and_parse
+ * returns for that file (NULL if it could not be opened).
+ */
+typedef struct SDDLLoadBatch_t * SDDLLoadBatch;
+
+// A <numThreads> of 0 uses one thread per online CPU.  Return NULL on OOM.
+SDDLLoadBatch sddl_load_batch_files(const char * const *filenames, unsigned count, unsigned numThreads);
+// Loads every file named *.sddl in <dirname>, sorted by filename.  Also
+// returns NULL if the directory can't be read.
+SDDLLoadBatch sddl_load_batch_dir(const char *dirname, unsigned numThreads);
+// Frees the batch and every result in it.  Use sddl_parse_result_ref_document
+// to keep a document.
+void sddl_load_batch_free(SDDLLoadBatch batch);
+
+unsigned sddl_load_batch_num_files(SDDLLoadBatch batch);
+const char * sddl_load_batch_filename(SDDLLoadBatch batch, unsigned index);
+SDDLParseResult sddl_load_batch_result(SDDLLoadBatch batch, unsigned index);
+
+/*
+ * Schema diff
+ *
+ * Compares two documents var by var, matching vars and struct members by
+ * dotted path, in time linear in the number of vars.  Only the outermost
+ * var of an added or removed struct is reported.
+ */
+typedef struct SDDLDiff_t * SDDLDiff;
+
+typedef enum
+{
+    SDDL_DIFF_ADDED,
+    SDDL_DIFF_REMOVED,
+    SDDL_DIFF_CHANGED,
+} SDDLDiffKindEnum;
+
+// What changed about a var; combined in SDDLDiffEntry.changes.
+typedef enum
+{
+    SDDL_CHANGE_DATATYPE        = 0x001,
+    SDDL_CHANGE_ARRAY           = 0x002,    // element datatype or count
+    SDDL_CHANGE_DIRECTION       = 0x004,
+    SDDL_CHANGE_RANGE           = 0x008,    // min-value or max-value
+    SDDL_CHANGE_UNITS           = 0x010,
+    SDDL_CHANGE_REGEX           = 0x020,
+    SDDL_CHANGE_DISPLAY_HINT    = 0x040,
+    SDDL_CHANGE_DESCRIPTION     = 0x080,
+    SDDL_CHANGE_POSITION        = 0x100,    // index among its siblings
+} SDDLChangeEnum;
+
+typedef struct
+{
+    SDDLDiffKindEnum kind;
+    unsigned changes;       // SDDL_CHANGE_* bits; 0 unless kind is CHANGED
+    const char *path;       // e.g. "motor.temp"
+    SDDLVarDecl old_var;    // NULL for ADDED
+    SDDLVarDecl new_var;    // NULL for REMOVED
+} SDDLDiffEntry;
+
+// Entries list removed and changed vars in <oldDoc> order, then added vars
+// in <newDoc> order.  The diff holds references to both documents.  Returns
+// NULL on OOM.
+SDDLDiff sddl_document_diff(SDDLDocument oldDoc, SDDLDocument newDoc);
+void sddl_diff_free(SDDLDiff diff);
+
+unsigned sddl_diff_num_entries(SDDLDiff diff);
+const SDDLDiffEntry * sddl_diff_entry(SDDLDiff diff, unsigned index);
+
+/*
+ * Var queries
+ *
+ * Selects the vars of a document by concrete direction and datatype.  A
+ * document keeps a bitset over its flat var table (see
+ * sddl_document_flat_vars) for every direction and datatype, built when it
+ * is finalized, so a query is a few word-wise ORs and ANDs.  The resulting
+ * set lists the flat indexes it contains; build it once and walk that list
+ * as often as needed.
+ */
+typedef struct SDDLVarSet_t * SDDLVarSet;
+
+// Bit of a direction or datatype in SDDLVarQuery.
+#define SDDL_QUERY_BIT(value) (1u << (value))
+
+typedef struct
+{
+    // SDDL_QUERY_BIT()s of the concrete directions to match; 0 matches any
+    unsigned directions;
+    // SDDL_QUERY_BIT()s of the datatypes to match; 0 matches any
+    unsigned datatypes;
+    // true to leave out structs
+    bool leaves_only;
+} SDDLVarQuery;
+
+// E.g. every float32 var that is concretely OUT:
+//     SDDLVarQuery query = {
+//         .directions = SDDL_QUERY_BIT(SDDL_DIRECTION_OUT),
+//         .datatypes = SDDL_QUERY_BIT(SDDL_DATATYPE_FLOAT32) };
+// The set holds a reference to <doc>.  Returns NULL on OOM.
+SDDLVarSet sddl_document_query_vars(SDDLDocument doc, const SDDLVarQuery *query);
+void sddl_var_set_free(SDDLVarSet set);
+
+unsigned sddl_var_set_count(SDDLVarSet set);
+// Flat indexes of the vars in <set>, ascending.
+const unsigned * sddl_var_set_indexes(SDDLVarSet set);
+bool sddl_var_set_contains(SDDLVarSet set, unsigned flatIndex);
+
+/*
+ * Live schemas
+ *
+ * A live schema holds a document that can be replaced at any time while
+ * other threads keep reading it.  Readers never block: each
+ * sddl_live_schema_acquire is a handful of atomic operations, and returns
+ * its own reference, so a reader keeps using the document it got even
+ * after a replacement.  Old documents are freed once the last reader drops
+ * them.  Documents are frozen (see sddl_document_freeze) when installed.
+ */
+typedef struct SDDLLiveSchema_t * SDDLLiveSchema;
+
+// Called from the watcher thread after each reload triggered by a change
+// to the file; <reloaded> is false if the new contents failed to parse, in
+// which case the previous document stays current.
+typedef void (*SDDLLiveReloadCallback)(SDDLLiveSchema live, bool reloaded, void *userdata);
+
+// Takes a reference to <doc>.  Returns NULL on OOM.
+SDDLLiveSchema sddl_live_schema_new(SDDLDocument doc);
+// Returns NULL if <filename> can't be loaded; parse failures are handed to
+// *outFailure, if given.
+SDDLLiveSchema sddl_live_schema_load(const char *filename, SDDLParseResult *outFailure);
+// Stops any watcher.  All readers must be done acquiring; documents they
+// acquired stay valid.
+void sddl_live_schema_free(SDDLLiveSchema live);
+
+// Returns a new reference to the current document; release it with
+// sddl_unref_document.  Wait-free.
+SDDLDocument sddl_live_schema_acquire(SDDLLiveSchema live);
+
+// Makes <doc> current (taking a reference).  Blocks only until readers in
+// the middle of an acquire have finished it.
+void sddl_live_schema_replace(SDDLLiveSchema live, SDDLDocument doc);
+// Reparses the file the live schema was loaded from and makes the result
+// current.  Returns false, keeping the current document, if the file
+// can't be loaded or parsed (the failed result goes to *outFailure).
+bool sddl_live_schema_reload(SDDLLiveSchema live, SDDLParseResult *outFailure);
+
+// Watches the file the live schema was loaded from and reloads it in a
+// background thread whenever it is written or replaced.  <callback> may be
+// NULL.  Returns false if the schema wasn't loaded from a file, is already
+// watched, or the watch can't be set up.
+bool sddl_live_schema_watch(SDDLLiveSchema live, SDDLLiveReloadCallback callback, void *userdata);
+
+/*
+ * Document cache
+ *
+ * Deduplicates documents by content, so that memory scales with distinct
+ * schemas rather than with the number of times they are seen.  Documents
+ * are keyed both by a hash of their text, which skips parsing entirely for
+ * byte-identical input, and by a hash of their parsed form, which shares one
+ * document between texts differing only in formatting, comments or field
+ * order.  Cached documents are frozen (see sddl_document_freeze) because
+ * they are shared.  All functions are thread-safe.
+ */
+typedef struct SDDLCache_t * SDDLCache;
+
+typedef struct
+{
+    size_t text_hits;       // text seen before; nothing parsed
+    size_t canonical_hits;  // parsed, then matched a cached document
+    size_t misses;          // parsed and added
+    size_t evictions;
+    size_t num_documents;
+    size_t bytes;           // footprint of the cached documents
+} SDDLCacheStats;
+
+// Least recently used documents are dropped once the cached documents take
+// more than <maxBytes>; the most recent one is always kept.
+SDDLCache sddl_cache_new(size_t maxBytes);
+// Drops the cache's references.  Documents handed out stay valid.
+void sddl_cache_free(SDDLCache cache);
+
+// Returns a new reference to the document for the <len> bytes at <sddl>,
+// parsing only if no matching document is cached.  Returns NULL on OOM or
+// if the text fails to parse; in the latter case the failed result is
+// handed to *outFailure, if given, for its diagnostics.
+SDDLDocument sddl_cache_parse(SDDLCache cache, const char *sddl, size_t len, SDDLParseResult *outFailure);
+
+void sddl_cache_stats(SDDLCache cache, SDDLCacheStats *outStats);
+
 #ifdef __cplusplus
 }
 #endif
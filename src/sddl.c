@@ -11,314 +11,274 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
-#include "sddl.h"
+#include "sddl_internal.h"
 #include "red_string.h"
 #include "red_json.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
+#include <sys/mman.h>
 
-struct SDDLParseResult_t
+uint32_t sddl_name_hash(const char *name, size_t len)
 {
-    bool ok;
-    SDDLDocument doc;
-    RedStringList errors;
-    RedStringList warnings;
-};
-
-struct SDDLDocument_t
-{
-    unsigned refcnt;
-    unsigned num_authors;
-    char **authors;
-    char *description;
-    unsigned num_vars;
-    SDDLVarDecl *vars;
-};
-
-struct SDDLVarDecl_t
-{
-    char *name;
-    char *decl_string;
-    char *description;
-    void *extra;
-    SDDLDatatypeEnum datatype;
-    SDDLDirectionEnum direction;
-    double *maxValue;
-    double *minValue;
-    SDDLNumericDisplayHintEnum numeric_display_hint;
-    char *regex;
-    char *units;
-    unsigned struct_num_members;
-    SDDLVarDecl *struct_members;
-    unsigned array_num_elements;
-    SDDLDatatypeEnum array_datatype;
-    RedJsonObject json;
-    SDDLVarDecl parent;
-};
-
-static SDDLNumericDisplayHintEnum _display_hint_from_string(const char *sz)
-{
-    if (!strcmp(sz, "normal"))
-    {
-        return SDDL_NUMERIC_DISPLAY_HINT_NORMAL;
-    }
-    else if (!strcmp(sz, "percentage"))
+    // 32-bit FNV-1a
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < len; i++)
     {
-        return SDDL_NUMERIC_DISPLAY_HINT_PERCENTAGE;
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
     }
-    else if (!strcmp(sz, "hex"))
+    return hash;
+}
+
+void _sddl_var_set_name(SDDLVarDecl var, char *name)
+{
+    var->name = name;
+    var->name_len = name ? strlen(name) : 0;
+    var->name_hash = sddl_name_hash(var->name ? var->name : "", var->name_len);
+}
+
+static uint32_t _sddl_var_array_key(const void *items, unsigned pos, const char **outName, size_t *outLen)
+{
+    SDDLVarDecl var = ((const SDDLVarDecl *)items)[pos];
+    *outName = var->name;
+    *outLen = var->name_len;
+    return var->name_hash;
+}
+
+static uint32_t _sddl_path_entry_key(const void *items, unsigned pos, const char **outName, size_t *outLen)
+{
+    const _SDDLPathEntry *entry = &((const _SDDLPathEntry *)items)[pos];
+    *outName = entry->path;
+    *outLen = entry->path_len;
+    return entry->path_hash;
+}
+
+static bool _sddl_name_key_matches(
+        _SDDLNameKeyFunc keyFunc, 
+        const void *items, 
+        unsigned pos, 
+        const char *name, 
+        size_t len, 
+        uint32_t hash)
+{
+    const char *itemName;
+    size_t itemLen;
+    uint32_t itemHash = keyFunc(items, pos, &itemName, &itemLen);
+    return itemHash == hash && itemLen == len && !memcmp(itemName, name, len);
+}
+
+int _sddl_name_index_lookup(
+        const _SDDLNameIndex *index,
+        _SDDLNameKeyFunc keyFunc,
+        const void *items,
+        unsigned count,
+        const char *name,
+        size_t len,
+        uint32_t hash)
+{
+    unsigned i;
+    if (index->capacity == 0)
     {
-        return SDDL_NUMERIC_DISPLAY_HINT_HEX;
+        for (i = 0; i < count; i++)
+        {
+            if (_sddl_name_key_matches(keyFunc, items, i, name, len, hash))
+            {
+                return i;
+            }
+        }
+        return -1;
     }
-    else if (!strcmp(sz, "scientific"))
+
+    unsigned mask = index->capacity - 1;
+    unsigned slot = hash & mask;
+    while (index->slots[slot].pos)
     {
-        return SDDL_NUMERIC_DISPLAY_HINT_SCIENTIFIC;
+        if (index->slots[slot].hash == hash
+            && _sddl_name_key_matches(keyFunc, items, index->slots[slot].pos - 1, name, len, hash))
+        {
+            return index->slots[slot].pos - 1;
+        }
+        slot = (slot + 1) & mask;
     }
-    return SDDL_NUMERIC_DISPLAY_HINT_INVALID;
+    return -1;
 }
 
-static const char * _display_hint_to_string(SDDLNumericDisplayHintEnum v)
+void _sddl_name_index_free(_SDDLNameIndex *index)
 {
-    switch (v)
-    {
-        case SDDL_NUMERIC_DISPLAY_HINT_NORMAL:
-            return "normal";
-        case SDDL_NUMERIC_DISPLAY_HINT_PERCENTAGE:
-            return "percentage";
-        case SDDL_NUMERIC_DISPLAY_HINT_HEX:
-            return "hex";
-        case SDDL_NUMERIC_DISPLAY_HINT_SCIENTIFIC:
-            return "scientific";
-        default:
-            return "invalid";
-    }
+    _sddl_free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
 }
 
-static SDDLDatatypeEnum _datatype_from_string(const char *sz)
+bool _sddl_name_index_build(
+        _SDDLNameIndex *index, 
+        _SDDLArena *arena,
+        _SDDLNameKeyFunc keyFunc, 
+        const void *items, 
+        unsigned count)
 {
-    if (!strcmp(sz, "void"))
+    unsigned capacity = 8;
+    unsigned mask;
+    unsigned i;
+
+    if (!arena)
     {
-        return SDDL_DATATYPE_VOID;
+        _sddl_name_index_free(index);
     }
-    else if (!strcmp(sz, "string"))
+    index->slots = NULL;
+    index->capacity = 0;
+
+    // Keep the load factor at or below 1/2 so probe sequences stay short.
+    while (capacity < 2*count)
     {
-        return SDDL_DATATYPE_STRING;
+        capacity *= 2;
     }
-    else if (!strcmp(sz, "bool"))
+    index->slots = arena ?
+            _sddl_arena_alloc(arena, capacity*sizeof(_SDDLNameSlot)) :
+            _sddl_calloc(capacity, sizeof(_SDDLNameSlot));
+    if (!index->slots)
     {
-        return SDDL_DATATYPE_BOOL;
+        return false;
     }
-    else if (!strcmp(sz, "int8"))
+    index->capacity = capacity;
+
+    mask = capacity - 1;
+    for (i = 0; i < count; i++)
     {
-        return SDDL_DATATYPE_INT8;
+        const char *name;
+        size_t len;
+        uint32_t hash = keyFunc(items, i, &name, &len);
+        unsigned slot = hash & mask;
+        bool duplicate = false;
+        while (index->slots[slot].pos)
+        {
+            if (index->slots[slot].hash == hash
+                && _sddl_name_key_matches(keyFunc, items, index->slots[slot].pos - 1, name, len, hash))
+            {
+                // Duplicate name: the first declaration wins, matching the
+                // behavior of a front-to-back scan.
+                duplicate = true;
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        if (!duplicate)
+        {
+            index->slots[slot].hash = hash;
+            index->slots[slot].pos = i + 1;
+        }
     }
-    else if (!strcmp(sz, "uint8"))
+    return true;
+}
+
+static unsigned _sddl_ptr_slot(const void *key, unsigned mask)
+{
+    uintptr_t h = (uintptr_t)key;
+    h ^= h >> 17;
+    return (unsigned)((h * 0x9E3779B1u) >> 4) & mask;
+}
+
+bool _sddl_ptr_index_init(_SDDLPtrIndex *index, unsigned count)
+{
+    unsigned capacity = 8;
+    // load factor at or below 1/2, as for name indexes
+    while (capacity < 2*count)
     {
-        return SDDL_DATATYPE_UINT8;
+        capacity *= 2;
     }
-    else if (!strcmp(sz, "int16"))
+    index->slots = _sddl_calloc(capacity, sizeof(_SDDLPtrSlot));
+    index->capacity = index->slots ? capacity : 0;
+    return index->slots != NULL;
+}
+
+void _sddl_ptr_index_insert(_SDDLPtrIndex *index, const void *key, unsigned value)
+{
+    unsigned mask = index->capacity - 1;
+    unsigned slot = _sddl_ptr_slot(key, mask);
+    while (index->slots[slot].key)
     {
-        return SDDL_DATATYPE_INT16;
+        if (index->slots[slot].key == key)
+        {
+            return;
+        }
+        slot = (slot + 1) & mask;
     }
-    else if (!strcmp(sz, "uint16"))
+    index->slots[slot].key = key;
+    index->slots[slot].value = value;
+}
+
+int _sddl_ptr_index_lookup(const _SDDLPtrIndex *index, const void *key)
+{
+    unsigned mask = index->capacity - 1;
+    unsigned slot;
+    if (!index->capacity)
     {
-        return SDDL_DATATYPE_UINT16;
+        return -1;
     }
-    else if (!strcmp(sz, "int32"))
+    slot = _sddl_ptr_slot(key, mask);
+    while (index->slots[slot].key)
     {
-        return SDDL_DATATYPE_INT32;
+        if (index->slots[slot].key == key)
+        {
+            return (int)index->slots[slot].value;
+        }
+        slot = (slot + 1) & mask;
     }
-    else if (!strcmp(sz, "uint32"))
+    return -1;
+}
+
+void _sddl_ptr_index_free(_SDDLPtrIndex *index)
+{
+    _sddl_free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
+}
+
+static bool _chars_equal(const char *s, size_t len, const char *literal)
+{
+    return strlen(literal) == len && !memcmp(s, literal, len);
+}
+
+SDDLNumericDisplayHintEnum _sddl_display_hint_from_chars(const char *s, size_t len)
+{
+    if (_chars_equal(s, len, "normal"))
     {
-        return SDDL_DATATYPE_UINT32;
+        return SDDL_NUMERIC_DISPLAY_HINT_NORMAL;
     }
-    else if (!strcmp(sz, "float32"))
+    else if (_chars_equal(s, len, "percentage"))
     {
-        return SDDL_DATATYPE_FLOAT32;
+        return SDDL_NUMERIC_DISPLAY_HINT_PERCENTAGE;
     }
-    else if (!strcmp(sz, "float64"))
+    else if (_chars_equal(s, len, "hex"))
     {
-        return SDDL_DATATYPE_FLOAT64;
+        return SDDL_NUMERIC_DISPLAY_HINT_HEX;
     }
-    else if (!strcmp(sz, "datetime"))
+    else if (_chars_equal(s, len, "scientific"))
     {
-        return SDDL_DATATYPE_DATETIME;
+        return SDDL_NUMERIC_DISPLAY_HINT_SCIENTIFIC;
     }
-    return SDDL_DATATYPE_INVALID;
+    return SDDL_NUMERIC_DISPLAY_HINT_INVALID;
 }
 
-static SDDLVarDecl _sddl_parse_var(RedString decl, RedJsonObject def)
+const char * _sddl_display_hint_to_string(SDDLNumericDisplayHintEnum v)
 {
-    SDDLVarDecl out;
-    unsigned numKeys;
-    unsigned i;
-    char **keysArray;
-
-    out = calloc(1, sizeof(struct SDDLVarDecl_t));
-    if (!out)
-    {
-        return NULL;
-    }
-
-    RedStringList split = RedString_Split(decl, ' ');
-    RedString name = RedStringList_GetString(split, 1);
-    out->name = RedString_strdup(RedString_GetChars(name));
-    RedStringList_Free(split);
-
-    out->extra = NULL;
-    out->description = RedString_strdup("");
-    out->datatype = SDDL_DATATYPE_FLOAT32;
-    out->numeric_display_hint = SDDL_NUMERIC_DISPLAY_HINT_NORMAL;
-    out->units = RedString_strdup("");
-
-    numKeys = RedJsonObject_NumItems(def);
-    keysArray = RedJsonObject_NewKeysArray(def);
-
-    for (i = 0; i < numKeys; i++)
+    switch (v)
     {
-        RedJsonValue val = RedJsonObject_Get(def, keysArray[i]);
-        RedString key = RedString_New(keysArray[i]);
-
-        if (RedString_Equals(key, "datatype"))
-        {
-            char *datatypeString;
-            if (!RedJsonValue_IsString(val))
-            {
-                printf("datatype must be string\n");
-                return NULL;
-            }
-            datatypeString = RedJsonValue_GetString(val);
-            out->datatype = _datatype_from_string(datatypeString);
-            if (out->datatype == SDDL_DATATYPE_INVALID)
-            {
-                printf("invalid datatype %s\n", datatypeString);
-                return NULL;
-            }
-        }
-        else if (RedString_Equals(key, "description"))
-        {
-            char *description;
-            if (!RedJsonValue_IsString(val))
-            {
-                printf("description must be string\n");
-                return NULL;
-            }
-            description = RedJsonValue_GetString(val);
-            free(out->description);
-            out->description = RedString_strdup(description);
-            if (!out->description)
-            {
-                printf("OOM duplicating description string\n");
-                return NULL;
-            }
-        }
-        else if (RedString_Equals(key, "max-value"))
-        {
-            if (RedJsonValue_IsNull(val))
-            {
-                out->maxValue = NULL;
-            }
-            else
-            {
-                double * pMaxValue;
-                if (!RedJsonValue_IsNumber(val))
-                {
-                    printf("max-value must be number or null\n");
-                    return NULL;
-                }
-                pMaxValue = malloc(sizeof(double));
-                if (!pMaxValue)
-                {
-                    printf("OOM allocating max-value\n");
-                    return NULL;
-                }
-                *pMaxValue = RedJsonValue_GetNumber(val);
-                out->maxValue = pMaxValue;
-            }
-        }
-        else if (RedString_Equals(key, "min-value"))
-        {
-            if (RedJsonValue_IsNull(val))
-            {
-                out->minValue = NULL;
-            }
-            else
-            {
-                double * pMinValue;
-                if (!RedJsonValue_IsNumber(val))
-                {
-                    printf("min-value must be number or null\n");
-                    return NULL;
-                }
-                pMinValue = malloc(sizeof(double));
-                if (!pMinValue)
-                {
-                    printf("OOM allocating min-value\n");
-                    return NULL;
-                }
-                *pMinValue = RedJsonValue_GetNumber(val);
-                out->minValue = pMinValue;
-            }
-        }
-        else if (RedString_Equals(key, "numeric-display-hint"))
-        {
-            char *displayHintString;
-            if (!RedJsonValue_IsString(val))
-            {
-                printf("datatype must be string\n");
-                return NULL;
-            }
-            displayHintString = RedJsonValue_GetString(val);
-            out->numeric_display_hint = _display_hint_from_string(displayHintString);
-            if (out->numeric_display_hint == SDDL_NUMERIC_DISPLAY_HINT_INVALID)
-            {
-                printf("invalid numeric-display-hint %s", displayHintString);
-                return NULL;
-            }
-        }
-        else if (RedString_Equals(key, "regex"))
-        {
-            char *regex;
-            if (!RedJsonValue_IsString(val))
-            {
-                printf("regex must be string\n");
-                return NULL;
-            }
-            regex = RedJsonValue_GetString(val);
-            out->regex = RedString_strdup(regex);
-            if (!out->regex)
-            {
-                printf("OOM duplicating regex string\n");
-                return NULL;
-            }
-        }
-        else if (RedString_Equals(key, "units"))
-        {
-            char *units;
-            if (!RedJsonValue_IsString(val))
-            {
-                printf("units must be string\n");
-                return NULL;
-            }
-            units = RedJsonValue_GetString(val);
-            free(out->units);
-            out->units = RedString_strdup(units);
-            if (!out->units)
-            {
-                printf("OOM duplicating units string\n");
-                return NULL;
-            }
-        }
-        else
-        {
-            printf("Unexpected field: %s\n", RedString_GetChars(key));
-        }
-        RedString_Free(key);
+        case SDDL_NUMERIC_DISPLAY_HINT_NORMAL:
+            return "normal";
+        case SDDL_NUMERIC_DISPLAY_HINT_PERCENTAGE:
+            return "percentage";
+        case SDDL_NUMERIC_DISPLAY_HINT_HEX:
+            return "hex";
+        case SDDL_NUMERIC_DISPLAY_HINT_SCIENTIFIC:
+            return "scientific";
+        default:
+            return "invalid";
     }
-
-    return out;
 }
 
 #if 0
@@ -413,101 +373,155 @@ static SDDLVarDecl _sddl_parse_class(RedString decl, RedJsonObject def)
 
 SDDLDocument sddl_ref_document(SDDLDocument doc)
 {
-    doc->refcnt++;
+    __atomic_fetch_add(&doc->refcnt, 1, __ATOMIC_RELAXED);
     return doc;
 }
 
 void sddl_unref_document(SDDLDocument doc)
 {
-    if (doc->refcnt >= 1)
+    // The release/acquire pair makes every other thread's last use of the
+    // document happen before it is freed.
+    if (__atomic_sub_fetch(&doc->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        // The document itself is allocated with the allocator it holds.
+        SDDLAllocator allocator = doc->allocator;
+        // Everything but the top-level var list lives in the arena.
+        _sddl_arena_free(&doc->arena);
+        _sddl_free_with(&allocator, doc->vars);
+        _sddl_free_with(&allocator, doc->source);
+        if (doc->mapping)
+        {
+            munmap(doc->mapping, doc->mapping_len);
+        }
+        _sddl_free_with(&allocator, doc);
+    }
+}
+
+static void _sddl_freeze_vars(SDDLVarDecl *vars, unsigned count)
+{
+    unsigned i;
+    for (i = 0; i < count; i++)
     {
-        doc->refcnt--;
+        vars[i]->frozen = true;
+        _sddl_freeze_vars(vars[i]->struct_members, vars[i]->struct_num_members);
     }
-    if (doc->refcnt == 0)
+}
+
+void sddl_document_freeze(SDDLDocument doc)
+{
+    // Every index a lookup needs was built by _sddl_document_finalize, so
+    // all that is left is to stop callers from writing.
+    if (!doc->frozen)
     {
-        /* TODO: free document correctly */
-        free(doc);
+        _sddl_freeze_vars(doc->vars, doc->num_vars);
+        doc->frozen = true;
     }
 }
 
-static SDDLParseResult _new_parse_result()
+bool sddl_document_is_frozen(SDDLDocument doc)
+{
+    return doc->frozen;
+}
+
+void sddl_document_arena_stats(SDDLDocument doc, SDDLArenaStats *outStats)
+{
+    *outStats = doc->arena.stats;
+}
+
+SDDLDocument _sddl_document_new(size_t arenaBlockSize, const SDDLAllocator *allocator)
+{
+    SDDLDocument doc;
+    if (!allocator)
+    {
+        allocator = _sddl_global_allocator();
+    }
+    doc = _sddl_calloc_with(allocator, 1, sizeof(struct SDDLDocument_t));
+    if (!doc)
+    {
+        return NULL;
+    }
+    doc->refcnt = 1;
+    doc->allocator = *allocator;
+    _sddl_arena_init(&doc->arena, arenaBlockSize, &doc->allocator);
+    return doc;
+}
+
+SDDLParseResult _sddl_new_parse_result(size_t arenaBlockSize, const SDDLAllocator *allocator)
 {
     SDDLParseResult pr;
-    pr = calloc(1, sizeof(struct SDDLParseResult_t));
+    if (!allocator)
+    {
+        allocator = _sddl_global_allocator();
+    }
+    pr = _sddl_calloc_with(allocator, 1, sizeof(struct SDDLParseResult_t));
     if (!pr) 
-        goto fail;
+        return NULL;
     pr->ok = false;
+    pr->diagnostics = pr->inline_diagnostics;
+    pr->diagnostics_capacity = _SDDL_INLINE_DIAGNOSTICS;
 
-    pr->errors = RedStringList_New();
-    if (!pr->errors)
-        goto fail;
-
-    pr->warnings = RedStringList_New();
-    if (!pr->warnings)
-        goto fail;
-
-    pr->doc = calloc(1, sizeof(struct SDDLDocument_t));
+    pr->doc = _sddl_document_new(arenaBlockSize, allocator);
     if (!pr->doc)
-        goto fail;
-    pr->doc->refcnt = 1;
-
-    return pr;
-fail:
-    if (pr) 
     {
-        RedStringList_Free(pr->errors);
-        RedStringList_Free(pr->warnings);
-        free(pr->doc);
-        free(pr);
+        _sddl_free_with(allocator, pr);
+        return NULL;
     }
-    return NULL;
+    return pr;
 }
 
-
-SDDLParseResult sddl_load_and_parse(const char *filename)
+static bool _sddl_parse_result_grow_diagnostics(SDDLParseResult result)
 {
-    FILE *fp;
-    SDDLParseResult out;
-    fp = fopen(filename, "r");
-    if (!fp)
+    const SDDLAllocator *allocator = &result->doc->allocator;
+    unsigned capacity = 2*result->diagnostics_capacity;
+    SDDLDiagnostic *diagnostics;
+    if (result->diagnostics == result->inline_diagnostics)
     {
-        return NULL;
+        diagnostics = _sddl_malloc_with(allocator, capacity*sizeof(SDDLDiagnostic));
+        if (diagnostics)
+        {
+            memcpy(diagnostics, result->inline_diagnostics, sizeof(result->inline_diagnostics));
+        }
     }
-    out = sddl_load_and_parse_file(fp);
-    fclose(fp);
-    return out;
+    else
+    {
+        diagnostics = _sddl_realloc_with(allocator, result->diagnostics, capacity*sizeof(SDDLDiagnostic));
+    }
+    if (!diagnostics)
+    {
+        return false;
+    }
+    result->diagnostics = diagnostics;
+    result->diagnostics_capacity = capacity;
+    return true;
 }
 
-SDDLParseResult sddl_load_and_parse_file(FILE *file)
+bool _sddl_parse_result_add_diagnostic(SDDLParseResult result, const SDDLDiagnostic *diag)
 {
-    /* Read entire file into memory */
-    long filesize;
-    size_t readsize;
-    char *buffer;
-    SDDLParseResult out;
-    fseek(file, 0, SEEK_END);
-    filesize = ftell(file); 
-    fseek(file, 0, SEEK_SET);
-    buffer = calloc(1, filesize+1);
-    readsize = fread(buffer, 1, filesize, file);
-    if (readsize != filesize)
+    // Warnings leave the last slot free, so that the error ending the parse
+    // is kept past the limit and even when out of memory.
+    if (!diag->is_error)
     {
-        return NULL;
+        if (result->max_diagnostics && result->num_diagnostics - result->num_errors >= result->max_diagnostics)
+        {
+            result->num_dropped_diagnostics++;
+            return true;
+        }
+        if (result->num_diagnostics + 1 == result->diagnostics_capacity
+                && !_sddl_parse_result_grow_diagnostics(result))
+        {
+            return false;
+        }
     }
-    out = sddl_parse(buffer);
-    free(buffer);
-    return out;
+    else if (result->num_diagnostics == result->diagnostics_capacity
+            && !_sddl_parse_result_grow_diagnostics(result))
+    {
+        return false;
+    }
+    result->diagnostics[result->num_diagnostics++] = *diag;
+    result->num_errors += diag->is_error;
+    return true;
 }
 
-typedef struct
-{
-    SDDLDatatypeEnum datatype;
-    SDDLOptionalityEnum optionality;
-    SDDLDirectionEnum direction;
-    SDDLDatatypeEnum array_datatype;
-    size_t array_num_elements;
-    char *name;
-} VarKeyInfo;
 
 typedef enum
 {
@@ -526,153 +540,188 @@ typedef struct
         SDDLDatatypeEnum datatype;
         SDDLOptionalityEnum optionality;
         SDDLDirectionEnum direction;
-        
-        char *name;
     };
     // only for arrays:
     SDDLDatatypeEnum array_datatype;
     size_t array_num_elements;
 } _KeyToken;
 
-static bool _KeyTokenMaybeParseDatatype(_KeyToken *out, const char *s, SDDLDatatypeEnum datatype)
-{
-    const char *datatypeString = sddl_datatype_string(datatype);
-    size_t datatypeStringLen = strlen(datatypeString);
+#define _KEYWORD(literal, tokenType, field, value) \
+    if (len == sizeof(literal) - 1 && !memcmp(s, literal, len)) \
+    { \
+        out->type = tokenType; \
+        out->field = value; \
+        return true; \
+    }
+#define _DATATYPE_KEYWORD(literal, value) _KEYWORD(literal, _KEY_TOKEN_TYPE_DATATYPE, datatype, value)
+#define _DIRECTION_KEYWORD(literal, value) _KEYWORD(literal, _KEY_TOKEN_TYPE_DIRECTION, direction, value)
+#define _OPTIONALITY_KEYWORD(literal, value) _KEYWORD(literal, _KEY_TOKEN_TYPE_OPTIONALITY, optionality, value)
 
-    if (!strncmp(s, datatypeString, datatypeStringLen))
+// Looks up a keyword by dispatching on its first character, so each word
+// costs at most three memcmps.
+static bool _sddl_keyword_lookup(const char *s, size_t len, _KeyToken *out)
+{
+    if (len == 0)
     {
-        // beginning matches
-        
-        // is it an exact match?
-        if (s[datatypeStringLen] == 0)
-        {
-            // exact match.  Basic datatype.
-            out->type = _KEY_TOKEN_TYPE_DATATYPE;
-            out->datatype = datatype;
-            return true;
-        }
-
-        // is it an array?  Is the following character "["
-        if (s[datatypeStringLen] == '[')
-        {
-            char *end;
-            long int arraySize;
-            arraySize = strtol(&(s[datatypeStringLen+1]), &end, 10);
-            if (end == &(s[datatypeStringLen+1]))
-            {
-                // ERROR: no number found:
-                return false;
-            }
-            else if (*end != ']')
-            {
-                // ERROR: doesn't end with closing brace
-                return false;
-            }
-
-            out->type = _KEY_TOKEN_TYPE_DATATYPE;
-            out->datatype = SDDL_DATATYPE_ARRAY;
-            out->array_datatype = datatype;
-            out->array_num_elements = arraySize;
-
-            return true;
-        }
+        return false;
+    }
+    switch (s[0])
+    {
+        case 'b':
+            _DATATYPE_KEYWORD("bool", SDDL_DATATYPE_BOOL);
+            break;
+        case 'd':
+            _DATATYPE_KEYWORD("datetime", SDDL_DATATYPE_DATETIME);
+            break;
+        case 'f':
+            _DATATYPE_KEYWORD("float32", SDDL_DATATYPE_FLOAT32);
+            _DATATYPE_KEYWORD("float64", SDDL_DATATYPE_FLOAT64);
+            break;
+        case 'i':
+            _DIRECTION_KEYWORD("in", SDDL_DIRECTION_IN);
+            _DIRECTION_KEYWORD("inout", SDDL_DIRECTION_INOUT);
+            _DATATYPE_KEYWORD("int8", SDDL_DATATYPE_INT8);
+            _DATATYPE_KEYWORD("int16", SDDL_DATATYPE_INT16);
+            _DATATYPE_KEYWORD("int32", SDDL_DATATYPE_INT32);
+            break;
+        case 'o':
+            _DIRECTION_KEYWORD("out", SDDL_DIRECTION_OUT);
+            _OPTIONALITY_KEYWORD("optional", SDDL_OPTIONALITY_OPTIONAL);
+            break;
+        case 'r':
+            _OPTIONALITY_KEYWORD("required", SDDL_OPTIONALITY_REQUIRED);
+            break;
+        case 's':
+            _DATATYPE_KEYWORD("string", SDDL_DATATYPE_STRING);
+            _DATATYPE_KEYWORD("struct", SDDL_DATATYPE_STRUCT);
+            break;
+        case 'u':
+            _DATATYPE_KEYWORD("uint8", SDDL_DATATYPE_UINT8);
+            _DATATYPE_KEYWORD("uint16", SDDL_DATATYPE_UINT16);
+            _DATATYPE_KEYWORD("uint32", SDDL_DATATYPE_UINT32);
+            break;
+        case 'v':
+            _DATATYPE_KEYWORD("void", SDDL_DATATYPE_VOID);
+            break;
+        default:
+            break;
     }
     return false;
 }
 
-_KeyToken _KeyTokenFromString(const char *s)
-{
-    _KeyToken out;
-    out.type = _KEY_TOKEN_TYPE_INVALID;
-
-    if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_VOID))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_STRING))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_BOOL))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_INT8))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_UINT8))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_INT16))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_UINT16))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_INT32))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_UINT32))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_FLOAT32))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_FLOAT64))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_DATETIME))
-        return out;
-    else if (_KeyTokenMaybeParseDatatype(&out, s, SDDL_DATATYPE_STRUCT))
-        return out;
+#undef _OPTIONALITY_KEYWORD
+#undef _DIRECTION_KEYWORD
+#undef _DATATYPE_KEYWORD
+#undef _KEYWORD
 
-    else if (!strcmp(s, "inout"))
+SDDLDatatypeEnum _sddl_datatype_from_chars(const char *s, size_t len)
+{
+    _KeyToken token;
+    if (!_sddl_keyword_lookup(s, len, &token) 
+            || token.type != _KEY_TOKEN_TYPE_DATATYPE
+            || token.datatype == SDDL_DATATYPE_STRUCT)
     {
-        out.type = _KEY_TOKEN_TYPE_DIRECTION;
-        out.direction = SDDL_DIRECTION_INOUT;
+        return SDDL_DATATYPE_INVALID;
     }
-    else if (!strcmp(s, "in"))
+    return token.datatype;
+}
+
+// Classifies one space-delimited word of a declaration key.  Words that are
+// not keywords (or arrays of one) are taken to be the var name.  Returns
+// false for malformed array suffixes.
+static bool _sddl_key_token_from_chars(const char *s, size_t len, _KeyToken *out)
+{
+    const char *bracket = memchr(s, '[', len);
+    size_t arraySize = 0;
+    const char *p;
+
+    out->type = _KEY_TOKEN_TYPE_INVALID;
+    if (!bracket)
     {
-        out.type = _KEY_TOKEN_TYPE_DIRECTION;
-        out.direction = SDDL_DIRECTION_IN;
+        if (!_sddl_keyword_lookup(s, len, out))
+        {
+            out->type = _KEY_TOKEN_TYPE_VAR_NAME;
+        }
+        return true;
     }
-    else if (!strcmp(s, "out"))
+
+    // "<datatype>[<size>]"
+    if (!_sddl_keyword_lookup(s, bracket - s, out) || out->type != _KEY_TOKEN_TYPE_DATATYPE)
     {
-        out.type = _KEY_TOKEN_TYPE_DIRECTION;
-        out.direction = SDDL_DIRECTION_OUT;
+        out->type = _KEY_TOKEN_TYPE_VAR_NAME;
+        return true;
     }
-
-    else if (!strcmp(s, "optional"))
+    p = bracket + 1;
+    if (p == s + len || *p < '0' || *p > '9')
     {
-        out.type = _KEY_TOKEN_TYPE_OPTIONALITY;
-        out.optionality = SDDL_OPTIONALITY_OPTIONAL;
+        // no number found
+        return false;
     }
-    else if (!strcmp(s, "required"))
+    while (p < s + len && *p >= '0' && *p <= '9')
     {
-        out.type = _KEY_TOKEN_TYPE_OPTIONALITY;
-        out.optionality = SDDL_OPTIONALITY_REQUIRED;
+        // Vars store the size as unsigned.
+        if (arraySize > (UINT_MAX - (*p - '0'))/10)
+        {
+            return false;
+        }
+        arraySize = arraySize*10 + (*p - '0');
+        p++;
     }
-
-    return out;
-}
-
-// True if the key declares a Cloud Variable, false otherwise
-bool _parse_var_key(SDDLParseResult result, const char *key, VarKeyInfo *out)
-{
-    RedStringList parts;
-    unsigned i;
-
-    parts = RedString_SplitChars(key, ' ');
-    if (RedStringList_NumStrings(parts) < 2)
+    if (p + 1 != s + len || *p != ']')
     {
+        // doesn't end with closing brace
         return false;
     }
+    out->array_datatype = out->datatype;
+    out->datatype = SDDL_DATATYPE_ARRAY;
+    out->array_num_elements = arraySize;
+    return true;
+}
+
+bool _parse_var_key(const char *key, size_t len, VarKeyInfo *out, const char **outError)
+{
+    const char *end = key + len;
+    const char *word = key;
+    unsigned numWords = 0;
 
     out->datatype = SDDL_DATATYPE_INVALID;
     out->optionality = SDDL_OPTIONALITY_INVALID;
     out->direction = SDDL_DIRECTION_INHERIT;
+    out->array_datatype = SDDL_DATATYPE_INVALID;
+    out->array_num_elements = 0;
     out->name = NULL;
+    out->name_len = 0;
+    *outError = NULL;
 
-    for (i = 0; i < RedStringList_NumStrings(parts); i++)
+    while (word < end)
     {
-        const char *part;
+        const char *wordEnd;
         _KeyToken token;
-        part = RedStringList_GetStringChars(parts, i);
 
-        token = _KeyTokenFromString(part);
+        if (*word == ' ')
+        {
+            word++;
+            continue;
+        }
+        wordEnd = memchr(word, ' ', end - word);
+        if (!wordEnd)
+        {
+            wordEnd = end;
+        }
+        numWords++;
+
+        if (!_sddl_key_token_from_chars(word, wordEnd - word, &token))
+        {
+            *outError = "Invalid array declaration";
+            return false;
+        }
         switch (token.type)
         {
             case _KEY_TOKEN_TYPE_DATATYPE:
             {
                 if (out->datatype != SDDL_DATATYPE_INVALID)
                 {
-                    RedStringList_AppendChars(result->errors, "Datatype already specified");
+                    *outError = "Datatype already specified";
                     return false;
                 }
 
@@ -689,7 +738,7 @@ bool _parse_var_key(SDDLParseResult result, const char *key, VarKeyInfo *out)
             {
                 if (out->direction != SDDL_DIRECTION_INHERIT)
                 {
-                    RedStringList_AppendChars(result->errors, "Direction already specified");
+                    *outError = "Direction already specified";
                     return false;
                 }
 
@@ -700,7 +749,7 @@ bool _parse_var_key(SDDLParseResult result, const char *key, VarKeyInfo *out)
             {
                 if (out->optionality != SDDL_OPTIONALITY_INVALID)
                 {
-                    RedStringList_AppendChars(result->errors, "Optionality already specified");
+                    *outError = "Optionality already specified";
                     return false;
                 }
 
@@ -711,95 +760,207 @@ bool _parse_var_key(SDDLParseResult result, const char *key, VarKeyInfo *out)
             {
                 if (out->datatype == SDDL_DATATYPE_INVALID)
                 {
-                    RedStringList_AppendChars(result->errors, "Datatype or qualifier expected.");
+                    *outError = "Datatype or qualifier expected.";
                     return false;
                 }
                 if (out->name != NULL)
                 {
-                    RedStringList_AppendChars(result->errors, "Variable name already specified.");
+                    *outError = "Variable name already specified.";
                     return false;
                 }
 
-                out->name = RedString_strdup(part);
+                out->name = word;
+                out->name_len = wordEnd - word;
             }
         }
+        word = wordEnd;
+    }
+
+    if (numWords < 2 || !out->name)
+    {
+        *outError = "Expected variable declaration";
+        return false;
     }
     return true;
 }
 
-SDDLParseResult sddl_parse(const char *sddl)
+static unsigned _sddl_count_paths(SDDLVarDecl *vars, unsigned count)
 {
-    RedJsonObject jsonObj;
-    SDDLDocument doc;
-    SDDLParseResult result;
-    unsigned numKeys;
     unsigned i;
-    char **keysArray;
-
-    result = _new_parse_result();
-    if (!result)
+    unsigned total = count;
+    for (i = 0; i < count; i++)
     {
-        return NULL;
+        total += _sddl_count_paths(vars[i]->struct_members, vars[i]->struct_num_members);
     }
+    return total;
+}
 
-    doc = result->doc;
+// Appends <vars> and, recursively, their struct members to doc->paths in
+// preorder.  <prefix> is the dotted path of the enclosing struct, or NULL
+// at the top level.
+static bool _sddl_add_paths(SDDLDocument doc, const char *prefix, size_t prefixLen, SDDLVarDecl *vars, unsigned count)
+{
+    unsigned i;
+    for (i = 0; i < count; i++)
+    {
+        SDDLVarDecl var = vars[i];
+        _SDDLPathEntry *entry = &doc->paths[doc->num_paths];
+        size_t len = prefix ? prefixLen + 1 + var->name_len : var->name_len;
+
+        entry->path = _sddl_arena_alloc(&doc->arena, len + 1);
+        if (!entry->path)
+        {
+            return false;
+        }
+        if (prefix)
+        {
+            memcpy(entry->path, prefix, prefixLen);
+            entry->path[prefixLen] = '.';
+        }
+        memcpy(&entry->path[len - var->name_len], var->name, var->name_len + 1);
+        entry->path_len = len;
+        entry->path_hash = sddl_name_hash(entry->path, len);
+        entry->var = var;
+        doc->num_paths++;
 
-    doc->description = RedString_strdup("");
+        if (!_sddl_add_paths(doc, entry->path, len, var->struct_members, var->struct_num_members))
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
-    jsonObj = RedJson_Parse(sddl);
-    if (!jsonObj)
+void _sddl_resolve_directions(SDDLVarDecl *vars, unsigned count, SDDLDirectionEnum inherited)
+{
+    unsigned i;
+    for (i = 0; i < count; i++)
     {
-        RedStringList_AppendChars(result->errors, "JSON parsing failed!");
-        return result;
+        SDDLVarDecl var = vars[i];
+        var->concrete_direction = (var->direction == SDDL_DIRECTION_INHERIT) ? inherited : var->direction;
+        _sddl_resolve_directions(var->struct_members, var->struct_num_members, var->concrete_direction);
     }
+}
 
-    numKeys = RedJsonObject_NumItems(jsonObj);
-    keysArray = RedJsonObject_NewKeysArray(jsonObj);
-
-    for (i = 0; i < numKeys; i++)
-    {
-        RedJsonValue val = RedJsonObject_Get(jsonObj, keysArray[i]);
-        RedString key = RedString_New(keysArray[i]);
-        bool ok;
-        VarKeyInfo varKeyInfo;
+static void _sddl_flat_bit_set(SDDLDocument doc, unsigned row, unsigned index)
+{
+    doc->flat_bits[row*doc->flat_words + index/64] |= (uint64_t)1 << (index % 64);
+}
 
-        ok =  _parse_var_key(result, RedString_GetChars(key), &varKeyInfo);
-        if (!ok)
+// Appends <vars> and their members to the flat tables, in the order
+// _sddl_add_paths used.
+static void _sddl_add_flat_vars(SDDLDocument doc, SDDLVarDecl *vars, unsigned count, int parent, unsigned depth)
+{
+    unsigned i;
+    for (i = 0; i < count; i++)
+    {
+        SDDLVarDecl var = vars[i];
+        int index = (int)doc->num_flat_vars++;
+        SDDLFlatVar *flat = &doc->flat_vars[index];
+
+        flat->var = var;
+        flat->path = doc->paths[index].path;
+        flat->parent = parent;
+        flat->depth = depth;
+        flat->datatype = var->datatype;
+        flat->direction = var->concrete_direction;
+        if ((unsigned)var->concrete_direction < _SDDL_NUM_DIRECTIONS)
         {
-            return NULL;
+            _sddl_flat_bit_set(doc, _SDDL_DIRECTION_ROW(var->concrete_direction), index);
         }
-
-        if (!RedJsonValue_IsObject(val))
+        if ((unsigned)var->datatype < _SDDL_NUM_DATATYPES)
         {
-            RedStringList_AppendChars(result->errors, "Expected object for variable metadata");
-            return NULL;
+            _sddl_flat_bit_set(doc, _SDDL_DATATYPE_ROW(var->datatype), index);
         }
-
-        SDDLVarDecl var = _sddl_parse_var(key, RedJsonValue_GetObject(val));
-        if (!var)
+        if (var->datatype != SDDL_DATATYPE_STRUCT)
         {
-            return NULL;
+            _sddl_flat_bit_set(doc, _SDDL_LEAF_ROW, index);
+            doc->leaf_vars[doc->num_leaf_vars++] = *flat;
         }
+        _sddl_add_flat_vars(doc, var->struct_members, var->struct_num_members, index, depth + 1);
+    }
+}
+
+bool _sddl_document_build_flat_vars(SDDLDocument doc)
+{
+    unsigned numLeaves = 0;
+    unsigned i;
+
+    for (i = 0; i < doc->num_paths; i++)
+    {
+        numLeaves += doc->paths[i].var->datatype != SDDL_DATATYPE_STRUCT;
+    }
+    doc->flat_vars = _sddl_arena_alloc(&doc->arena, doc->num_paths*sizeof(SDDLFlatVar));
+    doc->leaf_vars = _sddl_arena_alloc(&doc->arena, numLeaves*sizeof(SDDLFlatVar));
+    doc->flat_words = (doc->num_paths + 63)/64;
+    doc->flat_bits = _sddl_arena_alloc(&doc->arena, _SDDL_NUM_FLAT_ROWS*doc->flat_words*sizeof(uint64_t));
+    if ((doc->num_paths && !doc->flat_vars) || (numLeaves && !doc->leaf_vars) || !doc->flat_bits)
+    {
+        doc->flat_bits = NULL;
+        return false;
+    }
+    memset(doc->flat_bits, 0, _SDDL_NUM_FLAT_ROWS*doc->flat_words*sizeof(uint64_t));
+    doc->num_flat_vars = 0;
+    doc->num_leaf_vars = 0;
+    _sddl_add_flat_vars(doc, doc->vars, doc->num_vars, -1, 0);
+    return true;
+}
 
-        doc->num_vars++;
-        doc->vars = realloc(
-                doc->vars, 
-                doc->num_vars*
-                sizeof(SDDLVarDecl));
-        if (!doc->vars)
+static bool _sddl_build_member_indexes(SDDLDocument doc, SDDLVarDecl *vars, unsigned count)
+{
+    unsigned i;
+    for (i = 0; i < count; i++)
+    {
+        SDDLVarDecl var = vars[i];
+        if (var->struct_num_members == 0)
+        {
+            continue;
+        }
+        if (!_sddl_name_index_build(&var->member_index, &doc->arena, _sddl_var_array_key, var->struct_members, var->struct_num_members))
+        {
+            return false;
+        }
+        if (!_sddl_build_member_indexes(doc, var->struct_members, var->struct_num_members))
         {
-            printf("OOM expanding doc->vars\n");
-            return NULL;
+            return false;
         }
-        doc->vars[doc->num_vars - 1] = var;
+    }
+    return true;
+}
 
+// Builds the lookup structures of a fully parsed document: the top-level
+// name index, a member index for every struct, the flattened path table
+// and the flat var tables.  Concrete directions are resolved first, so
+// those are set even if this fails.  Returns false on OOM; lookups still work (by
+// linear scan) in that case.
+bool _sddl_document_finalize(SDDLDocument doc)
+{
+    unsigned numPaths;
 
-        RedString_Free(key);
+    _sddl_resolve_directions(doc->vars, doc->num_vars, SDDL_DIRECTION_INOUT);
+    if (!_sddl_name_index_build(&doc->var_index, &doc->arena, _sddl_var_array_key, doc->vars, doc->num_vars))
+    {
+        return false;
+    }
+
+    if (!_sddl_build_member_indexes(doc, doc->vars, doc->num_vars))
+    {
+        return false;
     }
 
-    result->doc = doc;
-    result->ok = true;
-    return result;
+    numPaths = _sddl_count_paths(doc->vars, doc->num_vars);
+    doc->paths = _sddl_arena_alloc(&doc->arena, numPaths*sizeof(_SDDLPathEntry));
+    if (!doc->paths)
+    {
+        return false;
+    }
+    doc->num_paths = 0;
+    if (!_sddl_add_paths(doc, NULL, 0, doc->vars, doc->num_vars))
+    {
+        return false;
+    }
+    return _sddl_name_index_build(&doc->path_index, &doc->arena, _sddl_path_entry_key, doc->paths, doc->num_paths)
+        && _sddl_document_build_flat_vars(doc);
 }
 
 bool sddl_parse_result_ok(SDDLParseResult result)
@@ -819,33 +980,104 @@ SDDLDocument sddl_parse_result_ref_document(SDDLParseResult result)
     return sddl_ref_document(result->doc);
 }
 
+unsigned sddl_parse_result_num_diagnostics(SDDLParseResult result)
+{
+    return result->num_diagnostics;
+}
+
+const SDDLDiagnostic * sddl_parse_result_diagnostic(SDDLParseResult result, unsigned index)
+{
+    return &result->diagnostics[index];
+}
+
+unsigned sddl_parse_result_num_dropped_diagnostics(SDDLParseResult result)
+{
+    return result->num_dropped_diagnostics;
+}
+
+// Formats every diagnostic into the error and warning lists, once.
+static bool _sddl_parse_result_format(SDDLParseResult result)
+{
+    unsigned i;
+    if (result->errors)
+    {
+        return true;
+    }
+    result->errors = RedStringList_New();
+    result->warnings = RedStringList_New();
+    if (!result->errors || !result->warnings)
+    {
+        if (result->errors)
+            RedStringList_Free(result->errors);
+        if (result->warnings)
+            RedStringList_Free(result->warnings);
+        result->errors = result->warnings = NULL;
+        return false;
+    }
+    for (i = 0; i < result->num_diagnostics; i++)
+    {
+        const SDDLDiagnostic *diag = &result->diagnostics[i];
+        RedStringList_AppendPrintf(diag->is_error ? result->errors : result->warnings,
+                "line %u, col %u: %s%s%s", diag->line, diag->col, diag->message,
+                diag->detail[0] ? ": " : "", diag->detail);
+    }
+    return true;
+}
+
 unsigned sddl_parse_result_num_errors(SDDLParseResult result)
 {
-    return RedStringList_NumStrings(result->errors);
+    return result->num_errors;
 }
 
 const char * sddl_parse_result_error(SDDLParseResult result, unsigned index)
 {
+    if (!_sddl_parse_result_format(result))
+    {
+        return NULL;
+    }
     return RedStringList_GetStringChars(result->errors, index);
 }
 
 unsigned sddl_parse_result_num_warnings(SDDLParseResult result)
 {
-    return RedStringList_NumStrings(result->warnings);
+    return result->num_diagnostics - result->num_errors;
 }
 
 const char * sddl_parse_result_warning(SDDLParseResult result, unsigned index)
 {
+    if (!_sddl_parse_result_format(result))
+    {
+        return NULL;
+    }
     return RedStringList_GetStringChars(result->warnings, index);
 }
 
+const SDDLParseStats * sddl_parse_result_stats(SDDLParseResult result)
+{
+#ifdef SDDL_PARSE_STATS
+    return result->has_stats ? &result->stats : NULL;
+#else
+    (void)result;
+    return NULL;
+#endif
+}
+
 void sddl_free_parse_result(SDDLParseResult result)
 {
     if (result) {
-        RedStringList_Free(result->errors);
-        RedStringList_Free(result->warnings);
+        // The result came from its document's allocator.
+        SDDLAllocator allocator = result->doc->allocator;
+        if (result->errors)
+        {
+            RedStringList_Free(result->errors);
+            RedStringList_Free(result->warnings);
+        }
+        if (result->diagnostics != result->inline_diagnostics)
+        {
+            _sddl_free_with(&allocator, result->diagnostics);
+        }
         sddl_unref_document(result->doc);
-        free(result);
+        _sddl_free_with(&allocator, result);
     }
 }
 
@@ -874,17 +1106,73 @@ SDDLVarDecl sddl_document_var_by_idx(SDDLDocument doc, unsigned index)
     return doc->vars[index];
 }
 
+unsigned sddl_document_num_flat_vars(SDDLDocument doc)
+{
+    return doc->num_flat_vars;
+}
+
+const SDDLFlatVar * sddl_document_flat_vars(SDDLDocument doc)
+{
+    return doc->flat_vars;
+}
+
+unsigned sddl_document_num_leaf_vars(SDDLDocument doc)
+{
+    return doc->num_leaf_vars;
+}
+
+const SDDLFlatVar * sddl_document_leaf_vars(SDDLDocument doc)
+{
+    return doc->leaf_vars;
+}
+
 SDDLVarDecl sddl_document_var_by_name(SDDLDocument doc, const char* name) 
 {
-    unsigned i;
-    for (i = 0; i < sddl_document_num_vars(doc); i++)
-    {
-        if (!strcmp(doc->vars[i]->name,  name))
+    size_t len = strlen(name);
+    return sddl_document_var_by_name_hashed(doc, name, len, sddl_name_hash(name, len));
+}
+
+SDDLVarDecl sddl_document_var_by_name_hashed(
+        SDDLDocument doc, 
+        const char *name, 
+        size_t len, 
+        uint32_t hash)
+{
+    int pos = _sddl_name_index_lookup(&doc->var_index, _sddl_var_array_key, doc->vars, doc->num_vars, name, len, hash);
+    return (pos < 0) ? NULL : doc->vars[pos];
+}
+
+SDDLVarDecl sddl_document_var_by_path(SDDLDocument doc, const char *path)
+{
+    size_t len = strlen(path);
+    return sddl_document_var_by_path_hashed(doc, path, len, sddl_name_hash(path, len));
+}
+
+SDDLVarDecl sddl_document_var_by_path_hashed(
+        SDDLDocument doc, 
+        const char *path, 
+        size_t len, 
+        uint32_t hash)
+{
+    int pos;
+    if (doc->path_index.capacity == 0)
+    {
+        // Path table not built (OOM during finalize); resolve one component
+        // at a time.
+        const char *dot = memchr(path, '.', len);
+        size_t headLen = dot ? (size_t)(dot - path) : len;
+        SDDLVarDecl var = sddl_document_var_by_name_hashed(doc, path, headLen, sddl_name_hash(path, headLen));
+        while (var && dot)
         {
-            return doc->vars[i];
+            const char *part = dot + 1;
+            dot = memchr(part, '.', len - (part - path));
+            headLen = dot ? (size_t)(dot - part) : len - (part - path);
+            var = sddl_var_struct_member_by_name_hashed(var, part, headLen, sddl_name_hash(part, headLen));
         }
+        return var;
     }
-    return NULL;
+    pos = _sddl_name_index_lookup(&doc->path_index, _sddl_path_entry_key, doc->paths, doc->num_paths, path, len, hash);
+    return (pos < 0) ? NULL : doc->paths[pos].var;
 }
 
 const char * sddl_var_name(SDDLVarDecl var)
@@ -904,12 +1192,12 @@ const char * sddl_var_description(SDDLVarDecl cls)
 
 const double * sddl_var_max_value(SDDLVarDecl var)
 {
-    return var->maxValue;
+    return var->has_max_value ? &var->max_value : NULL;
 }
 
 const double * sddl_var_min_value(SDDLVarDecl var)
 {
-    return var->minValue;
+    return var->has_min_value ? &var->min_value : NULL;
 }
 
 SDDLNumericDisplayHintEnum sddl_var_numeric_display_hint(SDDLVarDecl var)
@@ -927,27 +1215,43 @@ const char * sddl_var_units(SDDLVarDecl var)
     return var->units;
 }
 
+SDDLVarDecl sddl_var_parent(SDDLVarDecl var)
+{
+    return var->parent;
+}
+
 unsigned sddl_var_struct_num_members(SDDLVarDecl var)
 {
     return var->struct_num_members;
 }
 
-SDDLVarDecl var_struct_member_by_idx(SDDLVarDecl var, unsigned index) 
+SDDLVarDecl sddl_var_struct_member_by_idx(SDDLVarDecl var, unsigned index) 
 {
     return var->struct_members[index];
 }
 
 SDDLVarDecl sddl_var_struct_member_by_name(SDDLVarDecl var, const char* name) 
 {
-    unsigned i;
-    for (i = 0; i < sddl_var_struct_num_members(var); i++)
+    size_t len = strlen(name);
+    return sddl_var_struct_member_by_name_hashed(var, name, len, sddl_name_hash(name, len));
+}
+
+SDDLVarDecl sddl_var_struct_member_by_name_hashed(
+        SDDLVarDecl var, 
+        const char *name, 
+        size_t len, 
+        uint32_t hash)
+{
+    int pos;
+    if (var->member_index.capacity == 0 && var->struct_num_members > 0 && !var->in_document)
     {
-        if (!strcmp(var->struct_members[i]->name, name))
-        {
-            return var->struct_members[i];
-        }
+        // Programmatically constructed structs get their index on first
+        // lookup.  If that fails we simply scan.  Document vars already
+        // have theirs, and are never written here.
+        _sddl_name_index_build(&var->member_index, NULL, _sddl_var_array_key, var->struct_members, var->struct_num_members);
     }
-    return NULL;
+    pos = _sddl_name_index_lookup(&var->member_index, _sddl_var_array_key, var->struct_members, var->struct_num_members, name, len, hash);
+    return (pos < 0) ? NULL : var->struct_members[pos];
 }
 
 unsigned sddl_var_array_num_elements(SDDLVarDecl var)
@@ -958,6 +1262,10 @@ unsigned sddl_var_array_num_elements(SDDLVarDecl var)
 
 void sddl_var_set_extra(SDDLVarDecl var, void *extra)
 {
+    if (var->frozen)
+    {
+        return;
+    }
     var->extra = extra;
 }
 
@@ -968,6 +1276,12 @@ void * sddl_var_extra(SDDLVarDecl var)
 
 RedJsonObject sddl_var_json(SDDLVarDecl var)
 {
+    // Programmatic vars build their JSON on first use and drop it whenever
+    // they change.  Document vars never change, so are never rebuilt here.
+    if (!var->json && !var->in_document)
+    {
+        var->json = _construct_definition_object(var);
+    }
     return var->json;
 }
 
@@ -980,25 +1294,54 @@ SDDLResultEnum sddl_parse_decl(
         size_t *outArraySize)
 {
     VarKeyInfo info;
-    bool ok;
-    SDDLParseResult result = _new_parse_result();
-    ok = _parse_var_key(result, decl, &info);
-    if (!ok)
+    const char *error;
+    if (!_parse_var_key(decl, strlen(decl), &info, &error))
     {
         return SDDL_ERROR_PARSING;
     }
     *outDirection = info.direction;
     *outDatatype = info.datatype;
-    *outName = RedString_strdup(info.name);
+    *outName = malloc(info.name_len + 1);
+    if (!*outName)
+    {
+        return SDDL_ERROR_PARSING;
+    }
+    memcpy(*outName, info.name, info.name_len);
+    (*outName)[info.name_len] = '\0';
     if (info.datatype == SDDL_DATATYPE_ARRAY)
     {
         *outArrayElementDatatype = info.array_datatype;
         *outArraySize = info.array_num_elements;
     }
-    sddl_free_parse_result(result);
     return SDDL_SUCCESS;
 }
 
+unsigned sddl_parse_decls(const char * const *decls, unsigned count, SDDLDeclInfo *out)
+{
+    unsigned i;
+    unsigned numOk = 0;
+    for (i = 0; i < count; i++)
+    {
+        VarKeyInfo info;
+        const char *error;
+        if (!_parse_var_key(decls[i], strlen(decls[i]), &info, &error))
+        {
+            memset(&out[i], 0, sizeof(out[i]));
+            out[i].result = SDDL_ERROR_PARSING;
+            continue;
+        }
+        out[i].result = SDDL_SUCCESS;
+        out[i].direction = info.direction;
+        out[i].datatype = info.datatype;
+        out[i].array_datatype = info.array_datatype;
+        out[i].array_num_elements = info.array_num_elements;
+        out[i].name = info.name;
+        out[i].name_len = info.name_len;
+        numOk++;
+    }
+    return numOk;
+}
+
 SDDLDirectionEnum sddl_var_direction(SDDLVarDecl var)
 {
     return var->direction;
@@ -1006,18 +1349,17 @@ SDDLDirectionEnum sddl_var_direction(SDDLVarDecl var)
 
 SDDLDirectionEnum sddl_var_concrete_direction(SDDLVarDecl var)
 {
-    if (var->direction == SDDL_DIRECTION_INHERIT)
+    // Resolved once for document vars; programmatic vars can still be
+    // moved into a struct, so walk up for those.
+    if (var->in_document)
     {
-        if (var->parent)
-        {
-            return sddl_var_concrete_direction(var->parent);
-        }
-        else
-        {
-            return SDDL_DIRECTION_INOUT;
-        }
+        return var->concrete_direction;
     }
-    return var->direction;
+    while (var->direction == SDDL_DIRECTION_INHERIT && var->parent)
+    {
+        var = var->parent;
+    }
+    return (var->direction == SDDL_DIRECTION_INHERIT) ? SDDL_DIRECTION_INOUT : var->direction;
 }
 
 RedJsonObject _construct_definition_object(SDDLVarDecl var)
@@ -1040,6 +1382,7 @@ RedJsonObject _construct_definition_object(SDDLVarDecl var)
             memberJsonObj = _construct_definition_object(member);
             if (!memberJsonObj)
             {
+                RedJsonObject_Free(out);
                 return NULL;
             }
 
@@ -1047,13 +1390,13 @@ RedJsonObject _construct_definition_object(SDDLVarDecl var)
         }
     }
 
-    if (var->minValue != NULL)
+    if (var->has_min_value)
     {
-        RedJsonObject_SetNumber(out, "min-value", *(var->minValue));
+        RedJsonObject_SetNumber(out, "min-value", var->min_value);
     }
-    if (var->maxValue != NULL)
+    if (var->has_max_value)
     {
-        RedJsonObject_SetNumber(out, "max-value", *(var->maxValue));
+        RedJsonObject_SetNumber(out, "max-value", var->max_value);
     }
     if (var->description != NULL)
     {
@@ -1070,166 +1413,166 @@ RedJsonObject _construct_definition_object(SDDLVarDecl var)
     if (var->numeric_display_hint != SDDL_NUMERIC_DISPLAY_HINT_INVALID)
     {
         RedJsonObject_SetString(out, "numeric-display-hint", 
-                _display_hint_to_string(var->numeric_display_hint));
+                _sddl_display_hint_to_string(var->numeric_display_hint));
     }
     return out;
 }
 
-char * _construct_decl_string(SDDLVarDecl var)
+// Writes the declaration key for <var> (e.g. "out float32[16] samples") into
+// <buf>, snprintf-style.  Returns the full length regardless of <cap>.
+static size_t _sddl_format_decl_string(SDDLVarDecl var, char *buf, size_t cap)
 {
-    RedStringList s = RedStringList_New();
+    const char *direction = "";
+    const char *separator = "";
+    int len;
 
     if (var->direction != SDDL_DIRECTION_INHERIT)
     {
-        RedStringList_AppendChars(s, sddl_direction_string(var->direction));
+        direction = sddl_direction_string(var->direction);
+        separator = " ";
     }
 
     if (var->datatype == SDDL_DATATYPE_ARRAY)
     {
-        RedStringList_AppendPrintf(s, "%s[%d] %s", 
+        len = snprintf(buf, cap, "%s%s%s[%u] %s", 
+                direction, separator,
                 sddl_datatype_string(var->array_datatype),
                 var->array_num_elements,
                 var->name);
     }
     else
     {
-        RedStringList_AppendPrintf(s, "%s %s", 
+        len = snprintf(buf, cap, "%s%s%s %s", 
+                direction, separator,
                 sddl_datatype_string(var->datatype),
                 var->name);
     }
-
-    return RedStringList_JoinToNewChars(s, " ");
+    return (len < 0) ? 0 : (size_t)len;
 }
 
-SDDLVarDecl sddl_var_new_basic(
+// Allocates a standalone var decl.  The struct, its name and its declaration
+// string share a single heap allocation.
+static SDDLVarDecl _sddl_var_new(
         SDDLDatatypeEnum datatype, 
+        SDDLDatatypeEnum arrayDatatype,
+        size_t numItems,
         SDDLDirectionEnum direction, 
         const char *name)
 {
+    struct SDDLVarDecl_t tmp;
     SDDLVarDecl out;
-    out = calloc(1, sizeof(struct SDDLVarDecl_t));
+    size_t nameLen = strlen(name);
+    size_t declLen;
+    char *chars;
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.name = (char *)name;
+    tmp.datatype = datatype;
+    tmp.array_datatype = arrayDatatype;
+    tmp.array_num_elements = numItems;
+    tmp.direction = direction;
+    declLen = _sddl_format_decl_string(&tmp, NULL, 0);
+
+    out = _sddl_calloc(1, sizeof(struct SDDLVarDecl_t) + nameLen + 1 + declLen + 1);
     if (!out)
     {
         return NULL;
     }
+    *out = tmp;
 
-    out->name = RedString_strdup(name);
-    if (!out->name)
-    {
-        return NULL;
-    }
-    out->datatype = datatype;
-    out->direction = direction;
+    chars = (char *)(out + 1);
+    memcpy(chars, name, nameLen + 1);
+    _sddl_var_set_name(out, chars);
 
-    out->decl_string = _construct_decl_string(out);
-    if (!out->decl_string)
-    {
-        return NULL;
-    }
+    out->decl_string = chars + nameLen + 1;
+    _sddl_format_decl_string(out, out->decl_string, declLen + 1);
 
-    out->json = _construct_definition_object(out);
-    if (!out->json)
-    {
-        return NULL;
-    }
+    // The JSON definition is built by sddl_var_json, if ever needed.
     // TODO: other defaults?
 
     return out;
 }
 
+SDDLVarDecl sddl_var_new_basic(
+        SDDLDatatypeEnum datatype, 
+        SDDLDirectionEnum direction, 
+        const char *name)
+{
+    return _sddl_var_new(datatype, SDDL_DATATYPE_INVALID, 0, direction, name);
+}
+
 SDDLVarDecl sddl_var_new_array(
         SDDLDatatypeEnum childDatatype, 
         size_t numItems, 
         SDDLDirectionEnum direction, 
         const char *name)
 {
-    SDDLVarDecl out;
-    out = calloc(1, sizeof(struct SDDLVarDecl_t));
-    if (!out)
-    {
-        return NULL;
-    }
-
-    out->name = RedString_strdup(name);
-    if (!out->name)
-    {
-        return NULL;
-    }
-    out->datatype = SDDL_DATATYPE_ARRAY;
-    out->array_datatype = childDatatype;
-    out->array_num_elements = numItems;
-    out->direction = direction;
-
-    out->decl_string = _construct_decl_string(out);
-    if (!out->decl_string)
-    {
-        return NULL;
-    }
-
-    out->json = _construct_definition_object(out);
-    if (!out->json)
-    {
-        return NULL;
-    }
-    // TODO: other defaults?
-
-    return out;
+    return _sddl_var_new(SDDL_DATATYPE_ARRAY, childDatatype, numItems, direction, name);
 }
 
 SDDLVarDecl sddl_var_new_struct(
         SDDLDirectionEnum direction, 
         const char *name)
 {
-    SDDLVarDecl out;
-    out = calloc(1, sizeof(struct SDDLVarDecl_t));
-    if (!out)
+    return _sddl_var_new(SDDL_DATATYPE_STRUCT, SDDL_DATATYPE_INVALID, 0, direction, name);
+}
+
+// Drops the cached JSON of <var> and of every struct containing it.
+static void _sddl_var_invalidate_json(SDDLVarDecl var)
+{
+    for (; var && !var->in_document; var = var->parent)
     {
-        return NULL;
+        if (var->json)
+        {
+            RedJsonObject_Free(var->json);
+            var->json = NULL;
+        }
     }
+}
 
-    out->name = RedString_strdup(name);
-    if (!out->name)
+// true on success
+bool sddl_var_struct_add_members(SDDLVarDecl strct, const SDDLVarDecl *members, unsigned count)
+{
+    unsigned i;
+    if (strct->in_document)
     {
-        return NULL;
+        // parsed documents are immutable
+        return false;
     }
-    out->datatype = SDDL_DATATYPE_STRUCT;
-    out->direction = direction;
-
-    out->decl_string = _construct_decl_string(out);
-    if (!out->decl_string)
+    if (strct->struct_num_members + count > strct->struct_members_capacity)
     {
-        return NULL;
+        unsigned capacity = strct->struct_members_capacity ? 2*strct->struct_members_capacity : 4;
+        SDDLVarDecl *grown;
+        while (capacity < strct->struct_num_members + count)
+        {
+            capacity *= 2;
+        }
+        grown = _sddl_realloc(strct->struct_members, capacity*sizeof(SDDLVarDecl));
+        if (!grown)
+        {
+            return false;
+        }
+        strct->struct_members = grown;
+        strct->struct_members_capacity = capacity;
     }
-
-    out->json = _construct_definition_object(out);
-    if (!out->json)
+    for (i = 0; i < count; i++)
     {
-        return NULL;
+        if (!members[i]->in_document)
+        {
+            members[i]->parent = strct;
+        }
+        strct->struct_members[strct->struct_num_members++] = members[i]; // TODO: ref?
     }
-    // TODO: other defaults?
 
-    return out;
+    // member index and JSON are rebuilt on next use
+    _sddl_name_index_free(&strct->member_index);
+    _sddl_var_invalidate_json(strct);
+    return true;
 }
 
-// true on success
 bool sddl_var_struct_add_member(SDDLVarDecl strct, SDDLVarDecl member)
 {
-    strct->struct_num_members++;
-    strct->struct_members = realloc(
-            strct->struct_members, 
-            strct->struct_num_members*
-            sizeof(SDDLVarDecl));
-    if (!strct->struct_members)
-    {
-        return false;
-    }
-    strct->struct_members[strct->struct_num_members - 1] = member; // TODO: ref?
-
-    // reconstruct definition object
-    // TODO: It is inefficient that we do this every time a member is added.
-    strct->json = _construct_definition_object(strct);
-
-    return true;
+    return sddl_var_struct_add_members(strct, &member, 1);
 }
 
 bool sddl_var_is_basic(SDDLVarDecl var)
@@ -0,0 +1,131 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Allocator hooks.
+ *
+ * Every allocation libsddl makes goes through an SDDLAllocator.  Documents
+ * keep a copy of the allocator they were created with, which serves the
+ * document, its arena, its parse result and the parser that built it;
+ * everything else uses the global allocator.
+ */
+#include "sddl_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void * _sddl_libc_malloc(size_t size, void *userdata)
+{
+    (void)userdata;
+    return malloc(size);
+}
+
+static void * _sddl_libc_realloc(void *ptr, size_t size, void *userdata)
+{
+    (void)userdata;
+    return realloc(ptr, size);
+}
+
+static void _sddl_libc_free(void *ptr, void *userdata)
+{
+    (void)userdata;
+    free(ptr);
+}
+
+static const SDDLAllocator _sddl_libc_allocator = {
+    _sddl_libc_malloc,
+    _sddl_libc_realloc,
+    _sddl_libc_free,
+    NULL
+};
+
+static SDDLAllocator _sddl_allocator = {
+    _sddl_libc_malloc,
+    _sddl_libc_realloc,
+    _sddl_libc_free,
+    NULL
+};
+
+void sddl_set_allocator(const SDDLAllocator *allocator)
+{
+    _sddl_allocator = allocator ? *allocator : _sddl_libc_allocator;
+}
+
+const SDDLAllocator * _sddl_global_allocator(void)
+{
+    return &_sddl_allocator;
+}
+
+void * _sddl_malloc_with(const SDDLAllocator *allocator, size_t size)
+{
+    return allocator->malloc_fn(size, allocator->userdata);
+}
+
+void * _sddl_calloc_with(const SDDLAllocator *allocator, size_t count, size_t size)
+{
+    void *ptr;
+    if (size && count > (size_t)-1 / size)
+    {
+        return NULL;
+    }
+    ptr = allocator->malloc_fn(count*size, allocator->userdata);
+    if (ptr)
+    {
+        memset(ptr, 0, count*size);
+    }
+    return ptr;
+}
+
+void * _sddl_realloc_with(const SDDLAllocator *allocator, void *ptr, size_t size)
+{
+    return allocator->realloc_fn(ptr, size, allocator->userdata);
+}
+
+void _sddl_free_with(const SDDLAllocator *allocator, void *ptr)
+{
+    if (ptr)
+    {
+        allocator->free_fn(ptr, allocator->userdata);
+    }
+}
+
+void * _sddl_malloc(size_t size)
+{
+    return _sddl_malloc_with(&_sddl_allocator, size);
+}
+
+void * _sddl_calloc(size_t count, size_t size)
+{
+    return _sddl_calloc_with(&_sddl_allocator, count, size);
+}
+
+void * _sddl_realloc(void *ptr, size_t size)
+{
+    return _sddl_realloc_with(&_sddl_allocator, ptr, size);
+}
+
+void _sddl_free(void *ptr)
+{
+    _sddl_free_with(&_sddl_allocator, ptr);
+}
+
+char * _sddl_strdup(const char *s)
+{
+    size_t len = strlen(s);
+    char *out = _sddl_malloc(len + 1);
+    if (out)
+    {
+        memcpy(out, s, len + 1);
+    }
+    return out;
+}
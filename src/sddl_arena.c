@@ -0,0 +1,139 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "sddl_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define _SDDL_ARENA_MIN_BLOCK_SIZE 1024
+#define _SDDL_ARENA_ALIGN sizeof(double)
+
+struct _SDDLArenaBlock_t
+{
+    _SDDLArenaBlock *next;
+    size_t capacity;
+    size_t used;
+    double data[]; // double keeps the payload suitably aligned
+};
+
+static _SDDLArenaBlock * _sddl_arena_new_block(_SDDLArena *arena, size_t capacity)
+{
+    _SDDLArenaBlock *block;
+    block = _sddl_calloc_with(arena->allocator, 1, sizeof(_SDDLArenaBlock) + capacity);
+    if (!block)
+    {
+        return NULL;
+    }
+    block->capacity = capacity;
+    arena->stats.num_blocks++;
+    arena->stats.bytes_reserved += capacity;
+    return block;
+}
+
+void _sddl_arena_init(_SDDLArena *arena, size_t blockSize, const SDDLAllocator *allocator)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->allocator = allocator;
+    arena->block_size = (blockSize < _SDDL_ARENA_MIN_BLOCK_SIZE) ?
+            _SDDL_ARENA_MIN_BLOCK_SIZE : blockSize;
+}
+
+static void * _sddl_arena_alloc_aligned(_SDDLArena *arena, size_t size, size_t align)
+{
+    _SDDLArenaBlock *block = arena->head;
+    size_t offset = 0;
+
+    if (block)
+    {
+        offset = (block->used + align - 1) & ~(align - 1);
+    }
+
+    if (!block || offset + size > block->capacity)
+    {
+        if (size > arena->block_size / 2)
+        {
+            // Oversized request: give it a dedicated block behind the head
+            // so the remainder of the current block stays usable.
+            _SDDLArenaBlock *big = _sddl_arena_new_block(arena, size);
+            if (!big)
+            {
+                return NULL;
+            }
+            big->used = size;
+            if (block)
+            {
+                big->next = block->next;
+                block->next = big;
+            }
+            else
+            {
+                arena->head = big;
+            }
+            arena->stats.bytes_used += size;
+            arena->stats.num_allocations++;
+            return big->data;
+        }
+
+        if (block)
+        {
+            arena->block_size *= 2;
+        }
+        block = _sddl_arena_new_block(arena, arena->block_size);
+        if (!block)
+        {
+            return NULL;
+        }
+        block->next = arena->head;
+        arena->head = block;
+        offset = 0;
+    }
+
+    arena->stats.bytes_used += (offset - block->used) + size;
+    arena->stats.num_allocations++;
+    block->used = offset + size;
+    return (char *)block->data + offset;
+}
+
+void * _sddl_arena_alloc(_SDDLArena *arena, size_t size)
+{
+    return _sddl_arena_alloc_aligned(arena, size, _SDDL_ARENA_ALIGN);
+}
+
+char * _sddl_arena_strndup(_SDDLArena *arena, const char *s, size_t len)
+{
+    char *out = _sddl_arena_alloc_aligned(arena, len + 1, 1);
+    if (!out)
+    {
+        return NULL;
+    }
+    memcpy(out, s, len);
+    out[len] = '\0';
+    return out;
+}
+
+char * _sddl_arena_strdup(_SDDLArena *arena, const char *s)
+{
+    return _sddl_arena_strndup(arena, s, strlen(s));
+}
+
+void _sddl_arena_free(_SDDLArena *arena)
+{
+    _SDDLArenaBlock *block = arena->head;
+    while (block)
+    {
+        _SDDLArenaBlock *next = block->next;
+        _sddl_free_with(arena->allocator, block);
+        block = next;
+    }
+    arena->head = NULL;
+}
@@ -0,0 +1,53 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Bump allocator backing each SDDLDocument.
+ *
+ * Everything a parsed document owns (var decls, strings, indexes) is carved
+ * out of a short chain of large blocks, so parsing makes a handful of heap
+ * allocations and teardown frees only the blocks.  Individual allocations
+ * are never freed.
+ */
+#ifndef SDDL_ARENA_INCLUDED
+#define SDDL_ARENA_INCLUDED
+
+#include "sddl.h"
+#include <stddef.h>
+
+typedef struct _SDDLArenaBlock_t _SDDLArenaBlock;
+
+typedef struct
+{
+    const SDDLAllocator *allocator;
+    _SDDLArenaBlock *head;
+    size_t block_size;
+    SDDLArenaStats stats;
+} _SDDLArena;
+
+// <blockSize> is the size of the first block; later blocks double in size.
+// Blocks come from <allocator>, which must outlive the arena.
+void _sddl_arena_init(_SDDLArena *arena, size_t blockSize, const SDDLAllocator *allocator);
+
+// Returns zeroed, pointer-aligned memory, or NULL on OOM.
+void * _sddl_arena_alloc(_SDDLArena *arena, size_t size);
+
+// Returns a NUL-terminated copy of the first <len> bytes of <s>.
+char * _sddl_arena_strndup(_SDDLArena *arena, const char *s, size_t len);
+char * _sddl_arena_strdup(_SDDLArena *arena, const char *s);
+
+// Frees every block.  The arena may be reused after _sddl_arena_init.
+void _sddl_arena_free(_SDDLArena *arena);
+
+#endif
@@ -0,0 +1,612 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Content-addressed document cache.
+ *
+ * Documents are found by two 64-bit FNV-1a hashes:
+ *
+ *  - the text hash, over the exact input bytes, which lets a repeat of any
+ *    text seen before skip parsing altogether, and
+ *
+ *  - the canonical hash, over the parsed document (description, authors,
+ *    and every var's declaration and metadata, in order), which catches
+ *    texts that differ only in whitespace, comments or field order.
+ *
+ * Each cached document may have up to _SDDL_CACHE_MAX_ALIASES text hashes
+ * ("aliases") pointing at it, most recently used first; past that the
+ * oldest is dropped.  Both tables are chained hash tables; entries sit on
+ * an LRU list and the least recently used are evicted once the documents'
+ * footprint (arena, var array, source text and aliases) exceeds the bound.
+ * If the newest document alone exceeds it, its older aliases go too.
+ *
+ * FNV-1a is not collision-resistant and texts may come from untrusted
+ * devices, so a hash match is only a candidate: aliases keep a copy of
+ * their text, which must match byte for byte, and a canonical match must
+ * compare equal field by field before its document is shared.
+ *
+ * Parsing happens outside the lock, so threads missing on different texts
+ * parse in parallel.
+ */
+#include "sddl_internal.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _SDDL_FNV64_OFFSET 0xcbf29ce484222325ULL
+#define _SDDL_FNV64_PRIME 0x100000001b3ULL
+#define _SDDL_CACHE_MAX_ALIASES 16
+
+typedef struct _SDDLCacheEntry_t _SDDLCacheEntry;
+
+typedef struct _SDDLCacheAlias_t
+{
+    uint64_t text_hash;
+    char *text;
+    size_t text_len;
+    _SDDLCacheEntry *entry;
+    struct _SDDLCacheAlias_t *next;         // in the alias bucket
+    struct _SDDLCacheAlias_t *next_of_entry;
+} _SDDLCacheAlias;
+
+struct _SDDLCacheEntry_t
+{
+    SDDLDocument doc;
+    uint64_t canonical_hash;
+    size_t footprint;
+    _SDDLCacheAlias *aliases;               // most recently used first
+    unsigned num_aliases;
+    _SDDLCacheEntry *next;                  // in the entry bucket
+    _SDDLCacheEntry *lru_prev;              // towards most recently used
+    _SDDLCacheEntry *lru_next;
+};
+
+struct SDDLCache_t
+{
+    pthread_mutex_t lock;
+    size_t max_bytes;
+    unsigned num_buckets;                   // power of two
+    _SDDLCacheAlias **alias_buckets;
+    _SDDLCacheEntry **entry_buckets;
+    _SDDLCacheEntry *lru_head;              // most recently used
+    _SDDLCacheEntry *lru_tail;
+    SDDLCacheStats stats;
+};
+
+static uint64_t _sddl_hash64(uint64_t h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= _SDDL_FNV64_PRIME;
+    }
+    return h;
+}
+
+static uint64_t _sddl_hash64_string(uint64_t h, const char *s)
+{
+    // Include the terminator so adjacent strings can't run together.
+    return s ? _sddl_hash64(h, s, strlen(s) + 1) : _sddl_hash64(h, "", 1);
+}
+
+static uint64_t _sddl_hash64_value(uint64_t h, bool has, double value)
+{
+    h = _sddl_hash64(h, &has, sizeof(has));
+    return has ? _sddl_hash64(h, &value, sizeof(value)) : h;
+}
+
+static uint64_t _sddl_canonical_hash_vars(uint64_t h, SDDLVarDecl *vars, unsigned count)
+{
+    unsigned i;
+    h = _sddl_hash64(h, &count, sizeof(count));
+    for (i = 0; i < count; i++)
+    {
+        SDDLVarDecl var = vars[i];
+        int fields[5];
+        fields[0] = var->datatype;
+        fields[1] = var->direction;
+        fields[2] = var->numeric_display_hint;
+        fields[3] = var->array_datatype;
+        fields[4] = (int)var->array_num_elements;
+        h = _sddl_hash64(h, var->name, var->name_len + 1);
+        h = _sddl_hash64(h, fields, sizeof(fields));
+        h = _sddl_hash64_value(h, var->has_min_value, var->min_value);
+        h = _sddl_hash64_value(h, var->has_max_value, var->max_value);
+        h = _sddl_hash64_string(h, var->description);
+        h = _sddl_hash64_string(h, var->regex);
+        h = _sddl_hash64_string(h, var->units);
+        h = _sddl_canonical_hash_vars(h, var->struct_members, var->struct_num_members);
+    }
+    return h;
+}
+
+static uint64_t _sddl_canonical_hash(SDDLDocument doc)
+{
+    uint64_t h = _SDDL_FNV64_OFFSET;
+    unsigned i;
+    h = _sddl_hash64_string(h, doc->description);
+    h = _sddl_hash64(h, &doc->num_authors, sizeof(doc->num_authors));
+    for (i = 0; i < doc->num_authors; i++)
+    {
+        h = _sddl_hash64_string(h, doc->authors[i]);
+    }
+    return _sddl_canonical_hash_vars(h, doc->vars, doc->num_vars);
+}
+
+static bool _sddl_cache_strings_equal(const char *a, const char *b)
+{
+    // NULL hashes like "".
+    return !strcmp(a ? a : "", b ? b : "");
+}
+
+static bool _sddl_cache_values_equal(bool hasA, double a, bool hasB, double b)
+{
+    // Compared as hashed: by bit pattern.
+    return hasA == hasB && (!hasA || !memcmp(&a, &b, sizeof(a)));
+}
+
+// Compares everything _sddl_canonical_hash_vars hashes.
+static bool _sddl_canonical_vars_equal(SDDLVarDecl *a, unsigned countA, SDDLVarDecl *b, unsigned countB)
+{
+    unsigned i;
+    if (countA != countB)
+    {
+        return false;
+    }
+    for (i = 0; i < countA; i++)
+    {
+        SDDLVarDecl x = a[i];
+        SDDLVarDecl y = b[i];
+        if (x->name_len != y->name_len || memcmp(x->name, y->name, x->name_len)
+                || x->datatype != y->datatype
+                || x->direction != y->direction
+                || x->numeric_display_hint != y->numeric_display_hint
+                || x->array_datatype != y->array_datatype
+                || x->array_num_elements != y->array_num_elements
+                || !_sddl_cache_values_equal(x->has_min_value, x->min_value, y->has_min_value, y->min_value)
+                || !_sddl_cache_values_equal(x->has_max_value, x->max_value, y->has_max_value, y->max_value)
+                || !_sddl_cache_strings_equal(x->description, y->description)
+                || !_sddl_cache_strings_equal(x->regex, y->regex)
+                || !_sddl_cache_strings_equal(x->units, y->units)
+                || !_sddl_canonical_vars_equal(x->struct_members, x->struct_num_members,
+                        y->struct_members, y->struct_num_members))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _sddl_canonical_equal(SDDLDocument a, SDDLDocument b)
+{
+    unsigned i;
+    if (!_sddl_cache_strings_equal(a->description, b->description) || a->num_authors != b->num_authors)
+    {
+        return false;
+    }
+    for (i = 0; i < a->num_authors; i++)
+    {
+        if (!_sddl_cache_strings_equal(a->authors[i], b->authors[i]))
+        {
+            return false;
+        }
+    }
+    return _sddl_canonical_vars_equal(a->vars, a->num_vars, b->vars, b->num_vars);
+}
+
+static size_t _sddl_document_footprint(SDDLDocument doc)
+{
+    return sizeof(struct SDDLDocument_t)
+        + doc->arena.stats.bytes_reserved
+        + doc->num_vars*sizeof(SDDLVarDecl)
+        + doc->source_len
+        + doc->mapping_len;
+}
+
+static unsigned _sddl_cache_bucket(SDDLCache cache, uint64_t hash)
+{
+    return (unsigned)(hash ^ (hash >> 32)) & (cache->num_buckets - 1);
+}
+
+static _SDDLCacheAlias * _sddl_cache_find_alias(SDDLCache cache, uint64_t textHash, const char *text, size_t len)
+{
+    _SDDLCacheAlias *alias = cache->alias_buckets[_sddl_cache_bucket(cache, textHash)];
+    while (alias && (alias->text_hash != textHash || alias->text_len != len || memcmp(alias->text, text, len)))
+    {
+        alias = alias->next;
+    }
+    return alias;
+}
+
+static _SDDLCacheEntry * _sddl_cache_find_entry(SDDLCache cache, uint64_t canonicalHash, SDDLDocument doc)
+{
+    _SDDLCacheEntry *entry = cache->entry_buckets[_sddl_cache_bucket(cache, canonicalHash)];
+    while (entry && (entry->canonical_hash != canonicalHash || !_sddl_canonical_equal(entry->doc, doc)))
+    {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+static void _sddl_cache_lru_unlink(SDDLCache cache, _SDDLCacheEntry *entry)
+{
+    if (entry->lru_prev)
+    {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else
+    {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next)
+    {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else
+    {
+        cache->lru_tail = entry->lru_prev;
+    }
+}
+
+static void _sddl_cache_lru_push(SDDLCache cache, _SDDLCacheEntry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head)
+    {
+        cache->lru_head->lru_prev = entry;
+    }
+    else
+    {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+static void _sddl_cache_touch(SDDLCache cache, _SDDLCacheEntry *entry)
+{
+    if (cache->lru_head != entry)
+    {
+        _sddl_cache_lru_unlink(cache, entry);
+        _sddl_cache_lru_push(cache, entry);
+    }
+}
+
+// Doubles the bucket count once documents outnumber buckets.  Failure to
+// grow just leaves chains longer.
+static void _sddl_cache_maybe_grow(SDDLCache cache)
+{
+    unsigned numBuckets = 2*cache->num_buckets;
+    _SDDLCacheAlias **aliasBuckets;
+    _SDDLCacheEntry **entryBuckets;
+    _SDDLCacheEntry *entry;
+
+    if (cache->stats.num_documents <= cache->num_buckets)
+    {
+        return;
+    }
+    aliasBuckets = _sddl_calloc(numBuckets, sizeof(_SDDLCacheAlias *));
+    entryBuckets = _sddl_calloc(numBuckets, sizeof(_SDDLCacheEntry *));
+    if (!aliasBuckets || !entryBuckets)
+    {
+        _sddl_free(aliasBuckets);
+        _sddl_free(entryBuckets);
+        return;
+    }
+    _sddl_free(cache->alias_buckets);
+    _sddl_free(cache->entry_buckets);
+    cache->alias_buckets = aliasBuckets;
+    cache->entry_buckets = entryBuckets;
+    cache->num_buckets = numBuckets;
+
+    // Every entry and alias is reachable from the LRU list.
+    for (entry = cache->lru_head; entry; entry = entry->lru_next)
+    {
+        unsigned bucket = _sddl_cache_bucket(cache, entry->canonical_hash);
+        _SDDLCacheAlias *alias;
+        entry->next = entryBuckets[bucket];
+        entryBuckets[bucket] = entry;
+        for (alias = entry->aliases; alias; alias = alias->next_of_entry)
+        {
+            bucket = _sddl_cache_bucket(cache, alias->text_hash);
+            alias->next = aliasBuckets[bucket];
+            aliasBuckets[bucket] = alias;
+        }
+    }
+}
+
+static size_t _sddl_cache_alias_footprint(const _SDDLCacheAlias *alias)
+{
+    return sizeof(_SDDLCacheAlias) + alias->text_len + 1;
+}
+
+// Unlinks <alias> from its bucket and frees it.  Doesn't touch its entry.
+static void _sddl_cache_remove_alias(SDDLCache cache, _SDDLCacheAlias *alias)
+{
+    _SDDLCacheAlias **link = &cache->alias_buckets[_sddl_cache_bucket(cache, alias->text_hash)];
+    while (*link != alias)
+    {
+        link = &(*link)->next;
+    }
+    *link = alias->next;
+    _sddl_free(alias->text);
+    _sddl_free(alias);
+}
+
+// Drops the least recently used alias of <entry>.
+static void _sddl_cache_drop_oldest_alias(SDDLCache cache, _SDDLCacheEntry *entry)
+{
+    _SDDLCacheAlias **link = &entry->aliases;
+    _SDDLCacheAlias *alias;
+    size_t footprint;
+    while ((*link)->next_of_entry)
+    {
+        link = &(*link)->next_of_entry;
+    }
+    alias = *link;
+    *link = NULL;
+    footprint = _sddl_cache_alias_footprint(alias);
+    entry->footprint -= footprint;
+    cache->stats.bytes -= footprint;
+    entry->num_aliases--;
+    _sddl_cache_remove_alias(cache, alias);
+}
+
+// Moves <alias> to the front of its entry's list.
+static void _sddl_cache_touch_alias(_SDDLCacheAlias *alias)
+{
+    _SDDLCacheEntry *entry = alias->entry;
+    _SDDLCacheAlias **link = &entry->aliases;
+    if (*link == alias)
+    {
+        return;
+    }
+    while (*link != alias)
+    {
+        link = &(*link)->next_of_entry;
+    }
+    *link = alias->next_of_entry;
+    alias->next_of_entry = entry->aliases;
+    entry->aliases = alias;
+}
+
+// Returns false on OOM.  The alias and its copy of the text count towards
+// the entry's footprint.
+static bool _sddl_cache_add_alias(SDDLCache cache, _SDDLCacheEntry *entry, uint64_t textHash, const char *text, size_t len)
+{
+    unsigned bucket = _sddl_cache_bucket(cache, textHash);
+    _SDDLCacheAlias *alias = _sddl_malloc(sizeof(_SDDLCacheAlias));
+    size_t footprint;
+    if (!alias)
+    {
+        return false;
+    }
+    alias->text = _sddl_malloc(len + 1);
+    if (!alias->text)
+    {
+        _sddl_free(alias);
+        return false;
+    }
+    if (entry->num_aliases == _SDDL_CACHE_MAX_ALIASES)
+    {
+        _sddl_cache_drop_oldest_alias(cache, entry);
+    }
+    memcpy(alias->text, text, len);
+    alias->text_len = len;
+    footprint = _sddl_cache_alias_footprint(alias);
+    entry->footprint += footprint;
+    cache->stats.bytes += footprint;
+    alias->text_hash = textHash;
+    alias->entry = entry;
+    alias->next = cache->alias_buckets[bucket];
+    cache->alias_buckets[bucket] = alias;
+    alias->next_of_entry = entry->aliases;
+    entry->aliases = alias;
+    entry->num_aliases++;
+    return true;
+}
+
+static void _sddl_cache_evict(SDDLCache cache, _SDDLCacheEntry *entry)
+{
+    _SDDLCacheEntry **link = &cache->entry_buckets[_sddl_cache_bucket(cache, entry->canonical_hash)];
+    while (*link != entry)
+    {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    _sddl_cache_lru_unlink(cache, entry);
+
+    while (entry->aliases)
+    {
+        _SDDLCacheAlias *alias = entry->aliases;
+        entry->aliases = alias->next_of_entry;
+        _sddl_cache_remove_alias(cache, alias);
+    }
+    cache->stats.num_documents--;
+    cache->stats.bytes -= entry->footprint;
+    // Callers holding references keep the document alive.
+    sddl_unref_document(entry->doc);
+    _sddl_free(entry);
+}
+
+// <keep> is the most recently used entry.  It stays, but once it is all
+// that's left its older aliases don't.
+static void _sddl_cache_trim(SDDLCache cache, _SDDLCacheEntry *keep)
+{
+    while (cache->stats.bytes > cache->max_bytes && cache->lru_tail && cache->lru_tail != keep)
+    {
+        _sddl_cache_evict(cache, cache->lru_tail);
+        cache->stats.evictions++;
+    }
+    while (cache->stats.bytes > cache->max_bytes && keep->num_aliases > 1)
+    {
+        _sddl_cache_drop_oldest_alias(cache, keep);
+    }
+}
+
+SDDLCache sddl_cache_new(size_t maxBytes)
+{
+    SDDLCache cache = _sddl_calloc(1, sizeof(struct SDDLCache_t));
+    if (!cache)
+    {
+        return NULL;
+    }
+    cache->max_bytes = maxBytes;
+    cache->num_buckets = 1024;
+    cache->alias_buckets = _sddl_calloc(cache->num_buckets, sizeof(_SDDLCacheAlias *));
+    cache->entry_buckets = _sddl_calloc(cache->num_buckets, sizeof(_SDDLCacheEntry *));
+    if (!cache->alias_buckets || !cache->entry_buckets || pthread_mutex_init(&cache->lock, NULL) != 0)
+    {
+        _sddl_free(cache->alias_buckets);
+        _sddl_free(cache->entry_buckets);
+        _sddl_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void sddl_cache_free(SDDLCache cache)
+{
+    if (!cache)
+    {
+        return;
+    }
+    while (cache->lru_head)
+    {
+        _sddl_cache_evict(cache, cache->lru_head);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    _sddl_free(cache->alias_buckets);
+    _sddl_free(cache->entry_buckets);
+    _sddl_free(cache);
+}
+
+// Parses <len> bytes of <sddl>.  Returns a frozen document, or NULL after
+// handing any failed result to <outFailure>.
+static SDDLDocument _sddl_cache_parse_text(const char *sddl, size_t len, SDDLParseResult *outFailure)
+{
+    SDDLParser parser = sddl_parser_new(NULL, NULL);
+    SDDLParseResult result;
+    SDDLDocument doc = NULL;
+
+    if (!parser)
+    {
+        return NULL;
+    }
+    sddl_parser_feed(parser, sddl, len);
+    result = sddl_parser_finish(parser);
+    if (result && sddl_parse_result_ok(result))
+    {
+        doc = sddl_parse_result_ref_document(result);
+        sddl_document_freeze(doc);
+    }
+    else if (outFailure)
+    {
+        *outFailure = result;
+        return NULL;
+    }
+    sddl_free_parse_result(result);
+    return doc;
+}
+
+SDDLDocument sddl_cache_parse(SDDLCache cache, const char *sddl, size_t len, SDDLParseResult *outFailure)
+{
+    uint64_t textHash = _sddl_hash64(_SDDL_FNV64_OFFSET, sddl, len);
+    uint64_t canonicalHash;
+    size_t footprint;
+    _SDDLCacheAlias *alias;
+    _SDDLCacheEntry *entry;
+    SDDLDocument doc;
+
+    if (outFailure)
+    {
+        *outFailure = NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    alias = _sddl_cache_find_alias(cache, textHash, sddl, len);
+    if (alias)
+    {
+        _sddl_cache_touch(cache, alias->entry);
+        _sddl_cache_touch_alias(alias);
+        cache->stats.text_hits++;
+        doc = sddl_ref_document(alias->entry->doc);
+        pthread_mutex_unlock(&cache->lock);
+        return doc;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    doc = _sddl_cache_parse_text(sddl, len, outFailure);
+    if (!doc)
+    {
+        return NULL;
+    }
+    canonicalHash = _sddl_canonical_hash(doc);
+
+    pthread_mutex_lock(&cache->lock);
+    entry = _sddl_cache_find_entry(cache, canonicalHash, doc);
+    if (entry)
+    {
+        // Same schema, different text (or another thread got here first):
+        // share the cached document and remember this text too.
+        alias = _sddl_cache_find_alias(cache, textHash, sddl, len);
+        if (alias)
+        {
+            _sddl_cache_touch_alias(alias);
+        }
+        else
+        {
+            _sddl_cache_add_alias(cache, entry, textHash, sddl, len);
+        }
+        _sddl_cache_touch(cache, entry);
+        _sddl_cache_trim(cache, entry);
+        cache->stats.canonical_hits++;
+        sddl_unref_document(doc);
+        doc = sddl_ref_document(entry->doc);
+        pthread_mutex_unlock(&cache->lock);
+        return doc;
+    }
+
+    cache->stats.misses++;
+    entry = _sddl_calloc(1, sizeof(_SDDLCacheEntry));
+    if (!entry || !_sddl_cache_add_alias(cache, entry, textHash, sddl, len))
+    {
+        // Still usable, just not cached.
+        _sddl_free(entry);
+        pthread_mutex_unlock(&cache->lock);
+        return doc;
+    }
+    entry->doc = sddl_ref_document(doc);
+    entry->canonical_hash = canonicalHash;
+    footprint = _sddl_document_footprint(doc);
+    entry->footprint += footprint;
+    entry->next = cache->entry_buckets[_sddl_cache_bucket(cache, canonicalHash)];
+    cache->entry_buckets[_sddl_cache_bucket(cache, canonicalHash)] = entry;
+    _sddl_cache_lru_push(cache, entry);
+    cache->stats.num_documents++;
+    cache->stats.bytes += footprint;
+    _sddl_cache_trim(cache, entry);
+    _sddl_cache_maybe_grow(cache);
+    pthread_mutex_unlock(&cache->lock);
+    return doc;
+}
+
+void sddl_cache_stats(SDDLCache cache, SDDLCacheStats *outStats)
+{
+    pthread_mutex_lock(&cache->lock);
+    *outStats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,534 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Packed binary value codec.
+ *
+ * A codec flattens a var (or a whole document) into a list of fields: basic
+ * vars, struct members recursively, and arrays, each of which is one field
+ * of <count> consecutive elements (with one SDDLValue per element).  A
+ * record is those values back to back, little-endian, with no padding:
+ *
+ *      bool                1 byte, 0 or 1
+ *      int8/uint8          1 byte
+ *      int16/uint16        2 bytes
+ *      int32/uint32        4 bytes
+ *      float32             4 bytes, IEEE 754
+ *      float64             8 bytes, IEEE 754
+ *      datetime            8 bytes, signed
+ *      string              uint16 length, then that many bytes
+ *
+ * void vars carry no value and are skipped.  Records without strings have a
+ * fixed size, and the codec encodes them from a precomputed field list.
+ */
+#include "sddl_internal.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    SDDLVarDecl var;
+    SDDLDatatypeEnum datatype;
+    unsigned size;          // bytes per element, string contents excluded
+    unsigned count;         // 1, or the array's number of elements
+    unsigned first_value;   // index of the first element's SDDLValue
+} _SDDLCodecField;
+
+struct SDDLCodec_t
+{
+    unsigned num_fields;
+    unsigned capacity;
+    _SDDLCodecField *fields;
+    unsigned num_values;
+    size_t fixed_size;  // bytes taken by everything but string contents
+    bool has_strings;
+};
+
+static size_t _sddl_codec_datatype_size(SDDLDatatypeEnum datatype)
+{
+    switch (datatype)
+    {
+        case SDDL_DATATYPE_BOOL:
+        case SDDL_DATATYPE_INT8:
+        case SDDL_DATATYPE_UINT8:
+            return 1;
+        case SDDL_DATATYPE_INT16:
+        case SDDL_DATATYPE_UINT16:
+        case SDDL_DATATYPE_STRING:
+            return 2;
+        case SDDL_DATATYPE_INT32:
+        case SDDL_DATATYPE_UINT32:
+        case SDDL_DATATYPE_FLOAT32:
+            return 4;
+        case SDDL_DATATYPE_FLOAT64:
+        case SDDL_DATATYPE_DATETIME:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// Adds a field of <count> elements of <datatype>.
+static bool _sddl_codec_add_field(SDDLCodec codec, SDDLVarDecl var, SDDLDatatypeEnum datatype, unsigned count)
+{
+    _SDDLCodecField *field;
+    size_t size = _sddl_codec_datatype_size(datatype);
+
+    if (datatype == SDDL_DATATYPE_VOID || count == 0)
+    {
+        return true;
+    }
+    if (!sddl_datatype_is_basic(datatype))
+    {
+        // arrays of structs or arrays have no layout
+        return false;
+    }
+    if (count > UINT_MAX - codec->num_values || count > (SIZE_MAX - codec->fixed_size)/size)
+    {
+        return false;
+    }
+    if (codec->num_fields == codec->capacity)
+    {
+        unsigned capacity = codec->capacity ? 2*codec->capacity : 16;
+        _SDDLCodecField *fields;
+        if (codec->capacity > UINT_MAX/2)
+        {
+            return false;
+        }
+        fields = _sddl_realloc(codec->fields, (size_t)capacity*sizeof(_SDDLCodecField));
+        if (!fields)
+        {
+            return false;
+        }
+        codec->fields = fields;
+        codec->capacity = capacity;
+    }
+    field = &codec->fields[codec->num_fields++];
+    field->var = var;
+    field->datatype = datatype;
+    field->size = (unsigned)size;
+    field->count = count;
+    field->first_value = codec->num_values;
+    codec->num_values += count;
+    codec->fixed_size += size*count;
+    if (datatype == SDDL_DATATYPE_STRING)
+    {
+        codec->has_strings = true;
+    }
+    return true;
+}
+
+static bool _sddl_codec_add_var(SDDLCodec codec, SDDLVarDecl var)
+{
+    unsigned i;
+    switch (var->datatype)
+    {
+        case SDDL_DATATYPE_STRUCT:
+        {
+            for (i = 0; i < var->struct_num_members; i++)
+            {
+                if (!_sddl_codec_add_var(codec, var->struct_members[i]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case SDDL_DATATYPE_ARRAY:
+        {
+            return _sddl_codec_add_field(codec, var, var->array_datatype, var->array_num_elements);
+        }
+        default:
+        {
+            return _sddl_codec_add_field(codec, var, var->datatype, 1);
+        }
+    }
+}
+
+static SDDLCodec _sddl_codec_new(SDDLVarDecl *vars, unsigned count)
+{
+    SDDLCodec codec;
+    unsigned i;
+
+    codec = _sddl_calloc(1, sizeof(struct SDDLCodec_t));
+    if (!codec)
+    {
+        return NULL;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (!_sddl_codec_add_var(codec, vars[i]))
+        {
+            sddl_codec_free(codec);
+            return NULL;
+        }
+    }
+    return codec;
+}
+
+SDDLCodec sddl_codec_new_for_document(SDDLDocument doc)
+{
+    return _sddl_codec_new(doc->vars, doc->num_vars);
+}
+
+SDDLCodec sddl_codec_new_for_var(SDDLVarDecl var)
+{
+    return _sddl_codec_new(&var, 1);
+}
+
+void sddl_codec_free(SDDLCodec codec)
+{
+    if (codec)
+    {
+        _sddl_free(codec->fields);
+        _sddl_free(codec);
+    }
+}
+
+unsigned sddl_codec_num_values(SDDLCodec codec)
+{
+    return codec->num_values;
+}
+
+// The field holding value <index>: the last one starting at or before it.
+static const _SDDLCodecField * _sddl_codec_field_of_value(SDDLCodec codec, unsigned index)
+{
+    unsigned lo = 0;
+    unsigned hi = codec->num_fields;
+    while (hi - lo > 1)
+    {
+        unsigned mid = lo + (hi - lo)/2;
+        if (codec->fields[mid].first_value <= index)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return &codec->fields[lo];
+}
+
+SDDLVarDecl sddl_codec_value_var(SDDLCodec codec, unsigned index)
+{
+    return _sddl_codec_field_of_value(codec, index)->var;
+}
+
+SDDLDatatypeEnum sddl_codec_value_datatype(SDDLCodec codec, unsigned index)
+{
+    return _sddl_codec_field_of_value(codec, index)->datatype;
+}
+
+bool sddl_codec_is_fixed_size(SDDLCodec codec)
+{
+    return !codec->has_strings;
+}
+
+size_t sddl_codec_encoded_size(SDDLCodec codec, const SDDLValue *values)
+{
+    size_t size = codec->fixed_size;
+    unsigned i;
+    if (!codec->has_strings)
+    {
+        return size;
+    }
+    for (i = 0; i < codec->num_fields; i++)
+    {
+        const _SDDLCodecField *field = &codec->fields[i];
+        unsigned j;
+        if (field->datatype != SDDL_DATATYPE_STRING)
+        {
+            continue;
+        }
+        for (j = 0; j < field->count; j++)
+        {
+            size += values[field->first_value + j].string.len;
+        }
+    }
+    return size;
+}
+
+static void _sddl_put_le(uint8_t *out, uint64_t v, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++)
+    {
+        out[i] = (uint8_t)(v >> (8*i));
+    }
+}
+
+static uint64_t _sddl_get_le(const uint8_t *in, size_t size)
+{
+    uint64_t v = 0;
+    size_t i;
+    for (i = 0; i < size; i++)
+    {
+        v |= (uint64_t)in[i] << (8*i);
+    }
+    return v;
+}
+
+// Encodes one value of a fixed-width <datatype> at <out>.
+static void _sddl_codec_encode_value(SDDLDatatypeEnum datatype, const SDDLValue *v, uint8_t *out)
+{
+    switch (datatype)
+    {
+        case SDDL_DATATYPE_BOOL:
+            *out = v->b ? 1 : 0;
+            break;
+        case SDDL_DATATYPE_INT8:
+            *out = (uint8_t)v->i8;
+            break;
+        case SDDL_DATATYPE_UINT8:
+            *out = v->u8;
+            break;
+        case SDDL_DATATYPE_INT16:
+            _sddl_put_le(out, (uint16_t)v->i16, 2);
+            break;
+        case SDDL_DATATYPE_UINT16:
+            _sddl_put_le(out, v->u16, 2);
+            break;
+        case SDDL_DATATYPE_INT32:
+            _sddl_put_le(out, (uint32_t)v->i32, 4);
+            break;
+        case SDDL_DATATYPE_UINT32:
+            _sddl_put_le(out, v->u32, 4);
+            break;
+        case SDDL_DATATYPE_FLOAT32:
+        {
+            uint32_t bits;
+            memcpy(&bits, &v->f32, sizeof(bits));
+            _sddl_put_le(out, bits, 4);
+            break;
+        }
+        case SDDL_DATATYPE_FLOAT64:
+        {
+            uint64_t bits;
+            memcpy(&bits, &v->f64, sizeof(bits));
+            _sddl_put_le(out, bits, 8);
+            break;
+        }
+        case SDDL_DATATYPE_DATETIME:
+            _sddl_put_le(out, (uint64_t)v->datetime, 8);
+            break;
+        default:
+            break;
+    }
+}
+
+// Decodes one value of a fixed-width <datatype> from <in>.
+static void _sddl_codec_decode_value(SDDLDatatypeEnum datatype, const uint8_t *in, SDDLValue *v)
+{
+    switch (datatype)
+    {
+        case SDDL_DATATYPE_BOOL:
+            v->b = (*in != 0);
+            break;
+        case SDDL_DATATYPE_INT8:
+            v->i8 = (int8_t)*in;
+            break;
+        case SDDL_DATATYPE_UINT8:
+            v->u8 = *in;
+            break;
+        case SDDL_DATATYPE_INT16:
+            v->i16 = (int16_t)_sddl_get_le(in, 2);
+            break;
+        case SDDL_DATATYPE_UINT16:
+            v->u16 = (uint16_t)_sddl_get_le(in, 2);
+            break;
+        case SDDL_DATATYPE_INT32:
+            v->i32 = (int32_t)_sddl_get_le(in, 4);
+            break;
+        case SDDL_DATATYPE_UINT32:
+            v->u32 = (uint32_t)_sddl_get_le(in, 4);
+            break;
+        case SDDL_DATATYPE_FLOAT32:
+        {
+            uint32_t bits = (uint32_t)_sddl_get_le(in, 4);
+            memcpy(&v->f32, &bits, sizeof(bits));
+            break;
+        }
+        case SDDL_DATATYPE_FLOAT64:
+        {
+            uint64_t bits = _sddl_get_le(in, 8);
+            memcpy(&v->f64, &bits, sizeof(bits));
+            break;
+        }
+        case SDDL_DATATYPE_DATETIME:
+            v->datetime = (int64_t)_sddl_get_le(in, 8);
+            break;
+        default:
+            break;
+    }
+}
+
+// Encodes one record.  The caller has checked that <out> is big enough.
+static uint8_t * _sddl_codec_encode_record(SDDLCodec codec, const SDDLValue *values, uint8_t *out)
+{
+    unsigned i;
+    for (i = 0; i < codec->num_fields; i++)
+    {
+        const _SDDLCodecField *field = &codec->fields[i];
+        const SDDLValue *v = &values[field->first_value];
+        unsigned j;
+        if (field->datatype == SDDL_DATATYPE_STRING)
+        {
+            for (j = 0; j < field->count; j++)
+            {
+                _sddl_put_le(out, v[j].string.len, 2);
+                out += 2;
+                memcpy(out, v[j].string.chars, v[j].string.len);
+                out += v[j].string.len;
+            }
+            continue;
+        }
+        for (j = 0; j < field->count; j++)
+        {
+            _sddl_codec_encode_value(field->datatype, &v[j], out);
+            out += field->size;
+        }
+    }
+    return out;
+}
+
+// Decodes one record, returning NULL if <in> ends early.
+static const uint8_t * _sddl_codec_decode_record(SDDLCodec codec, const uint8_t *in, const uint8_t *end, SDDLValue *values)
+{
+    // Fixed-width bytes not yet consumed; string contents come on top, so
+    // this is re-checked after each one.
+    size_t fixedLeft = codec->fixed_size;
+    unsigned i;
+
+    if ((size_t)(end - in) < fixedLeft)
+    {
+        return NULL;
+    }
+    for (i = 0; i < codec->num_fields; i++)
+    {
+        const _SDDLCodecField *field = &codec->fields[i];
+        SDDLValue *v = &values[field->first_value];
+        unsigned j;
+        if (field->datatype == SDDL_DATATYPE_STRING)
+        {
+            for (j = 0; j < field->count; j++)
+            {
+                size_t len = (size_t)_sddl_get_le(in, 2);
+                in += 2;
+                fixedLeft -= 2;
+                if ((size_t)(end - in) < fixedLeft || (size_t)(end - in) - fixedLeft < len)
+                {
+                    return NULL;
+                }
+                v[j].string.chars = (const char *)in;
+                v[j].string.len = len;
+                in += len;
+            }
+            continue;
+        }
+        for (j = 0; j < field->count; j++)
+        {
+            _sddl_codec_decode_value(field->datatype, in, &v[j]);
+            in += field->size;
+        }
+        fixedLeft -= (size_t)field->size*field->count;
+    }
+    return in;
+}
+
+size_t sddl_codec_encode(SDDLCodec codec, const SDDLValue *values, void *buf, size_t bufSize)
+{
+    return sddl_codec_encode_records(codec, values, 1, buf, bufSize);
+}
+
+size_t sddl_codec_encode_records(SDDLCodec codec, const SDDLValue *values, unsigned numRecords, void *buf, size_t bufSize)
+{
+    uint8_t *out = buf;
+    size_t total = 0;
+    unsigned r;
+
+    if (numRecords && codec->num_values > SIZE_MAX/sizeof(SDDLValue)/numRecords)
+    {
+        return 0;
+    }
+    if (codec->has_strings)
+    {
+        for (r = 0; r < numRecords; r++)
+        {
+            const SDDLValue *record = &values[(size_t)r*codec->num_values];
+            unsigned i;
+            for (i = 0; i < codec->num_fields; i++)
+            {
+                const _SDDLCodecField *field = &codec->fields[i];
+                unsigned j;
+                if (field->datatype != SDDL_DATATYPE_STRING)
+                {
+                    continue;
+                }
+                for (j = 0; j < field->count; j++)
+                {
+                    if (record[field->first_value + j].string.len > UINT16_MAX)
+                    {
+                        return 0;
+                    }
+                }
+            }
+            // Can't overflow: every string is at most 64 KiB and was
+            // passed in memory.
+            total += sddl_codec_encoded_size(codec, record);
+        }
+    }
+    else
+    {
+        if (numRecords && codec->fixed_size > SIZE_MAX/numRecords)
+        {
+            return 0;
+        }
+        total = codec->fixed_size*numRecords;
+    }
+    if (total > bufSize)
+    {
+        return 0;
+    }
+
+    for (r = 0; r < numRecords; r++)
+    {
+        out = _sddl_codec_encode_record(codec, &values[(size_t)r*codec->num_values], out);
+    }
+    return total;
+}
+
+size_t sddl_codec_decode(SDDLCodec codec, const void *buf, size_t len, SDDLValue *outValues)
+{
+    return sddl_codec_decode_records(codec, buf, len, 1, outValues);
+}
+
+size_t sddl_codec_decode_records(SDDLCodec codec, const void *buf, size_t len, unsigned numRecords, SDDLValue *outValues)
+{
+    const uint8_t *in = buf;
+    const uint8_t *end = in + len;
+    unsigned r;
+
+    for (r = 0; r < numRecords; r++)
+    {
+        in = _sddl_codec_decode_record(codec, in, end, &outValues[(size_t)r*codec->num_values]);
+        if (!in)
+        {
+            return 0;
+        }
+    }
+    return in - (const uint8_t *)buf;
+}
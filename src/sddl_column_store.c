@@ -0,0 +1,342 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Columnar time-series store.
+ *
+ * Each numeric, bool or datetime var of a document (struct members
+ * included) gets one column: a single array of its native C type, used as
+ * a ring buffer.  Rows share a timestamp column, and all columns wrap
+ * together, so row i of every column sits at the same physical slot.  Once
+ * full, each append overwrites the oldest row.
+ */
+#include "sddl_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    SDDLVarDecl var;
+    SDDLDatatypeEnum datatype;
+    size_t element_size;
+    char *data;
+} _SDDLColumn;
+
+struct SDDLColumnStore_t
+{
+    size_t capacity;
+    size_t head;        // physical slot of the oldest row
+    size_t num_rows;
+    int64_t *timestamps;
+    unsigned num_columns;
+    _SDDLColumn *columns;
+    _SDDLPtrIndex column_index;  // var -> column
+};
+
+static size_t _sddl_column_element_size(SDDLDatatypeEnum datatype)
+{
+    switch (datatype)
+    {
+        case SDDL_DATATYPE_BOOL:
+            return sizeof(bool);
+        case SDDL_DATATYPE_INT8:
+        case SDDL_DATATYPE_UINT8:
+            return 1;
+        case SDDL_DATATYPE_INT16:
+        case SDDL_DATATYPE_UINT16:
+            return 2;
+        case SDDL_DATATYPE_INT32:
+        case SDDL_DATATYPE_UINT32:
+        case SDDL_DATATYPE_FLOAT32:
+            return 4;
+        case SDDL_DATATYPE_FLOAT64:
+        case SDDL_DATATYPE_DATETIME:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+SDDLColumnStore sddl_column_store_new(SDDLDocument doc, size_t capacity)
+{
+    SDDLColumnStore store;
+    unsigned i;
+
+    if (capacity == 0)
+    {
+        return NULL;
+    }
+    store = _sddl_calloc(1, sizeof(struct SDDLColumnStore_t));
+    if (!store)
+    {
+        return NULL;
+    }
+    store->capacity = capacity;
+    store->timestamps = _sddl_malloc(capacity*sizeof(int64_t));
+    store->columns = _sddl_calloc(doc->num_paths + 1, sizeof(_SDDLColumn));
+    if (!store->timestamps || !store->columns)
+    {
+        goto fail;
+    }
+
+    // The path table lists every var and struct member exactly once.
+    for (i = 0; i < doc->num_paths; i++)
+    {
+        SDDLVarDecl var = doc->paths[i].var;
+        size_t elementSize = _sddl_column_element_size(var->datatype);
+        _SDDLColumn *column;
+        if (elementSize == 0)
+        {
+            continue;
+        }
+        column = &store->columns[store->num_columns];
+        column->var = var;
+        column->datatype = var->datatype;
+        column->element_size = elementSize;
+        column->data = _sddl_malloc(capacity*elementSize);
+        if (!column->data)
+        {
+            goto fail;
+        }
+        store->num_columns++;
+    }
+
+    if (!_sddl_ptr_index_init(&store->column_index, store->num_columns))
+    {
+        goto fail;
+    }
+    for (i = 0; i < store->num_columns; i++)
+    {
+        _sddl_ptr_index_insert(&store->column_index, store->columns[i].var, i);
+    }
+    return store;
+
+fail:
+    sddl_column_store_free(store);
+    return NULL;
+}
+
+void sddl_column_store_free(SDDLColumnStore store)
+{
+    unsigned i;
+    if (!store)
+    {
+        return;
+    }
+    for (i = 0; i < store->num_columns; i++)
+    {
+        _sddl_free(store->columns[i].data);
+    }
+    _sddl_ptr_index_free(&store->column_index);
+    _sddl_free(store->columns);
+    _sddl_free(store->timestamps);
+    _sddl_free(store);
+}
+
+unsigned sddl_column_store_num_columns(SDDLColumnStore store)
+{
+    return store->num_columns;
+}
+
+SDDLVarDecl sddl_column_store_column_var(SDDLColumnStore store, unsigned column)
+{
+    return store->columns[column].var;
+}
+
+int sddl_column_store_column_index(SDDLColumnStore store, SDDLVarDecl var)
+{
+    return _sddl_ptr_index_lookup(&store->column_index, var);
+}
+
+size_t sddl_column_store_capacity(SDDLColumnStore store)
+{
+    return store->capacity;
+}
+
+size_t sddl_column_store_num_rows(SDDLColumnStore store)
+{
+    return store->num_rows;
+}
+
+static void _sddl_column_put(_SDDLColumn *column, size_t slot, const SDDLValue *v)
+{
+    void *dst = &column->data[slot*column->element_size];
+    switch (column->datatype)
+    {
+        case SDDL_DATATYPE_BOOL:
+            *(bool *)dst = v->b;
+            break;
+        case SDDL_DATATYPE_INT8:
+            *(int8_t *)dst = v->i8;
+            break;
+        case SDDL_DATATYPE_UINT8:
+            *(uint8_t *)dst = v->u8;
+            break;
+        case SDDL_DATATYPE_INT16:
+            *(int16_t *)dst = v->i16;
+            break;
+        case SDDL_DATATYPE_UINT16:
+            *(uint16_t *)dst = v->u16;
+            break;
+        case SDDL_DATATYPE_INT32:
+            *(int32_t *)dst = v->i32;
+            break;
+        case SDDL_DATATYPE_UINT32:
+            *(uint32_t *)dst = v->u32;
+            break;
+        case SDDL_DATATYPE_FLOAT32:
+            *(float *)dst = v->f32;
+            break;
+        case SDDL_DATATYPE_FLOAT64:
+            *(double *)dst = v->f64;
+            break;
+        case SDDL_DATATYPE_DATETIME:
+            *(int64_t *)dst = v->datetime;
+            break;
+        default:
+            break;
+    }
+}
+
+// Claims the slot for a new row, evicting the oldest row when full.
+static size_t _sddl_column_store_next_slot(SDDLColumnStore store)
+{
+    size_t slot = store->head + store->num_rows;
+    if (slot >= store->capacity)
+    {
+        slot -= store->capacity;
+    }
+    if (store->num_rows == store->capacity)
+    {
+        store->head = (store->head + 1 == store->capacity) ? 0 : store->head + 1;
+    }
+    else
+    {
+        store->num_rows++;
+    }
+    return slot;
+}
+
+static int64_t _sddl_column_store_last_timestamp(SDDLColumnStore store)
+{
+    size_t slot = store->head + store->num_rows - 1;
+    if (slot >= store->capacity)
+    {
+        slot -= store->capacity;
+    }
+    return store->timestamps[slot];
+}
+
+bool sddl_column_store_append_row(SDDLColumnStore store, int64_t timestamp, const SDDLValue *values)
+{
+    return sddl_column_store_append_rows(store, &timestamp, values, 1) == 1;
+}
+
+size_t sddl_column_store_append_rows(SDDLColumnStore store, const int64_t *timestamps, const SDDLValue *values, size_t numRows)
+{
+    size_t r;
+    for (r = 0; r < numRows; r++)
+    {
+        const SDDLValue *row = &values[r*store->num_columns];
+        size_t slot;
+        unsigned c;
+
+        if (store->num_rows && timestamps[r] < _sddl_column_store_last_timestamp(store))
+        {
+            // range scans rely on ordered timestamps
+            return r;
+        }
+        slot = _sddl_column_store_next_slot(store);
+        store->timestamps[slot] = timestamps[r];
+        for (c = 0; c < store->num_columns; c++)
+        {
+            _sddl_column_put(&store->columns[c], slot, &row[c]);
+        }
+    }
+    return numRows;
+}
+
+static size_t _sddl_column_store_slot(SDDLColumnStore store, size_t row)
+{
+    size_t slot = store->head + row;
+    return (slot >= store->capacity) ? slot - store->capacity : slot;
+}
+
+// First retained row with a timestamp >= <t>.
+static size_t _sddl_column_store_lower_bound(SDDLColumnStore store, int64_t t)
+{
+    size_t lo = 0;
+    size_t hi = store->num_rows;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo)/2;
+        if (store->timestamps[_sddl_column_store_slot(store, mid)] < t)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+size_t sddl_column_store_find_range(SDDLColumnStore store, int64_t from, int64_t to, size_t *outFirstRow)
+{
+    size_t first = _sddl_column_store_lower_bound(store, from);
+    size_t end = (to == INT64_MAX) ? store->num_rows : _sddl_column_store_lower_bound(store, to + 1);
+    *outFirstRow = first;
+    return (end > first) ? end - first : 0;
+}
+
+// Returns the contiguous run of <count> rows starting at <row> that fits
+// before the ring wraps.
+static size_t _sddl_column_store_run(SDDLColumnStore store, size_t row, size_t count, size_t *outSlot)
+{
+    size_t slot;
+    if (row >= store->num_rows)
+    {
+        return 0;
+    }
+    if (count > store->num_rows - row)
+    {
+        count = store->num_rows - row;
+    }
+    slot = _sddl_column_store_slot(store, row);
+    *outSlot = slot;
+    return (count < store->capacity - slot) ? count : store->capacity - slot;
+}
+
+const void * sddl_column_store_column_span(SDDLColumnStore store, unsigned column, size_t row, size_t *inOutCount)
+{
+    size_t slot;
+    *inOutCount = _sddl_column_store_run(store, row, *inOutCount, &slot);
+    if (*inOutCount == 0)
+    {
+        return NULL;
+    }
+    return &store->columns[column].data[slot*store->columns[column].element_size];
+}
+
+const int64_t * sddl_column_store_timestamp_span(SDDLColumnStore store, size_t row, size_t *inOutCount)
+{
+    size_t slot;
+    *inOutCount = _sddl_column_store_run(store, row, *inOutCount, &slot);
+    if (*inOutCount == 0)
+    {
+        return NULL;
+    }
+    return &store->timestamps[slot];
+}
@@ -0,0 +1,228 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Structural diff between two documents.
+ *
+ * Vars are matched by dotted path, so a struct member is the same var in
+ * both documents if its struct is.  Each document's path table lists every
+ * var and struct member once; every old path is looked up in the new
+ * document's path index and vice versa, using the hash stored with the
+ * path, which makes the diff linear in the number of vars.
+ *
+ * Only the outermost var of an added or removed subtree is reported.
+ */
+#include "sddl_internal.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct SDDLDiff_t
+{
+    SDDLDocument old_doc;
+    SDDLDocument new_doc;
+    unsigned num_entries;
+    unsigned capacity;
+    SDDLDiffEntry *entries;
+};
+
+static bool _sddl_diff_add(SDDLDiff diff, SDDLDiffKindEnum kind, unsigned changes,
+        const char *path, SDDLVarDecl oldVar, SDDLVarDecl newVar)
+{
+    SDDLDiffEntry *entry;
+    if (diff->num_entries == diff->capacity)
+    {
+        unsigned capacity = diff->capacity ? 2*diff->capacity : 16;
+        SDDLDiffEntry *entries = _sddl_realloc(diff->entries, capacity*sizeof(SDDLDiffEntry));
+        if (!entries)
+        {
+            return false;
+        }
+        diff->entries = entries;
+        diff->capacity = capacity;
+    }
+    entry = &diff->entries[diff->num_entries++];
+    entry->kind = kind;
+    entry->changes = changes;
+    entry->path = path;
+    entry->old_var = oldVar;
+    entry->new_var = newVar;
+    return true;
+}
+
+// Records each var's position among its siblings.
+static void _sddl_diff_index_positions(_SDDLPtrIndex *index, SDDLVarDecl *vars, unsigned count)
+{
+    unsigned i;
+    for (i = 0; i < count; i++)
+    {
+        _sddl_ptr_index_insert(index, vars[i], i);
+        _sddl_diff_index_positions(index, vars[i]->struct_members, vars[i]->struct_num_members);
+    }
+}
+
+static bool _sddl_strings_differ(const char *a, const char *b)
+{
+    return strcmp(a ? a : "", b ? b : "") != 0;
+}
+
+static bool _sddl_limits_differ(bool hasA, double a, bool hasB, double b)
+{
+    return hasA != hasB || (hasA && a != b && !(isnan(a) && isnan(b)));
+}
+
+static unsigned _sddl_diff_vars(SDDLVarDecl a, SDDLVarDecl b)
+{
+    unsigned changes = 0;
+    if (a->datatype != b->datatype)
+    {
+        changes |= SDDL_CHANGE_DATATYPE;
+    }
+    else if (a->datatype == SDDL_DATATYPE_ARRAY
+            && (a->array_datatype != b->array_datatype || a->array_num_elements != b->array_num_elements))
+    {
+        changes |= SDDL_CHANGE_ARRAY;
+    }
+    if (a->direction != b->direction)
+    {
+        changes |= SDDL_CHANGE_DIRECTION;
+    }
+    if (_sddl_limits_differ(a->has_min_value, a->min_value, b->has_min_value, b->min_value)
+            || _sddl_limits_differ(a->has_max_value, a->max_value, b->has_max_value, b->max_value))
+    {
+        changes |= SDDL_CHANGE_RANGE;
+    }
+    if (_sddl_strings_differ(a->units, b->units))
+    {
+        changes |= SDDL_CHANGE_UNITS;
+    }
+    if (_sddl_strings_differ(a->regex, b->regex))
+    {
+        changes |= SDDL_CHANGE_REGEX;
+    }
+    if (a->numeric_display_hint != b->numeric_display_hint)
+    {
+        changes |= SDDL_CHANGE_DISPLAY_HINT;
+    }
+    if (_sddl_strings_differ(a->description, b->description))
+    {
+        changes |= SDDL_CHANGE_DESCRIPTION;
+    }
+    return changes;
+}
+
+// True if the struct containing <entry>, if any, also exists in <doc>.
+static bool _sddl_diff_parent_in(SDDLDocument doc, const _SDDLPathEntry *entry)
+{
+    size_t len;
+    if (!entry->var->parent)
+    {
+        return true;
+    }
+    len = entry->path_len - entry->var->name_len - 1;
+    return sddl_document_var_by_path_hashed(doc, entry->path, len, sddl_name_hash(entry->path, len)) != NULL;
+}
+
+static SDDLVarDecl _sddl_diff_lookup(SDDLDocument doc, const _SDDLPathEntry *entry)
+{
+    return sddl_document_var_by_path_hashed(doc, entry->path, entry->path_len, entry->path_hash);
+}
+
+SDDLDiff sddl_document_diff(SDDLDocument oldDoc, SDDLDocument newDoc)
+{
+    SDDLDiff diff;
+    _SDDLPtrIndex positions = {0};
+    unsigned i;
+
+    diff = _sddl_calloc(1, sizeof(struct SDDLDiff_t));
+    if (!diff)
+    {
+        return NULL;
+    }
+    diff->old_doc = sddl_ref_document(oldDoc);
+    diff->new_doc = sddl_ref_document(newDoc);
+
+    if (!_sddl_ptr_index_init(&positions, oldDoc->num_paths + newDoc->num_paths))
+    {
+        goto fail;
+    }
+    _sddl_diff_index_positions(&positions, oldDoc->vars, oldDoc->num_vars);
+    _sddl_diff_index_positions(&positions, newDoc->vars, newDoc->num_vars);
+
+    // Removed and changed vars, in old document order.
+    for (i = 0; i < oldDoc->num_paths; i++)
+    {
+        const _SDDLPathEntry *entry = &oldDoc->paths[i];
+        SDDLVarDecl oldVar = entry->var;
+        SDDLVarDecl newVar = _sddl_diff_lookup(newDoc, entry);
+        unsigned changes;
+        if (!newVar)
+        {
+            if (_sddl_diff_parent_in(newDoc, entry)
+                    && !_sddl_diff_add(diff, SDDL_DIFF_REMOVED, 0, entry->path, oldVar, NULL))
+            {
+                goto fail;
+            }
+            continue;
+        }
+        changes = _sddl_diff_vars(oldVar, newVar);
+        if (_sddl_ptr_index_lookup(&positions, oldVar) != _sddl_ptr_index_lookup(&positions, newVar))
+        {
+            changes |= SDDL_CHANGE_POSITION;
+        }
+        if (changes && !_sddl_diff_add(diff, SDDL_DIFF_CHANGED, changes, entry->path, oldVar, newVar))
+        {
+            goto fail;
+        }
+    }
+
+    // Added vars, in new document order.
+    for (i = 0; i < newDoc->num_paths; i++)
+    {
+        const _SDDLPathEntry *entry = &newDoc->paths[i];
+        if (!_sddl_diff_lookup(oldDoc, entry) && _sddl_diff_parent_in(oldDoc, entry)
+                && !_sddl_diff_add(diff, SDDL_DIFF_ADDED, 0, entry->path, NULL, entry->var))
+        {
+            goto fail;
+        }
+    }
+    _sddl_ptr_index_free(&positions);
+    return diff;
+
+fail:
+    _sddl_ptr_index_free(&positions);
+    sddl_diff_free(diff);
+    return NULL;
+}
+
+void sddl_diff_free(SDDLDiff diff)
+{
+    if (diff)
+    {
+        sddl_unref_document(diff->old_doc);
+        sddl_unref_document(diff->new_doc);
+        _sddl_free(diff->entries);
+        _sddl_free(diff);
+    }
+}
+
+unsigned sddl_diff_num_entries(SDDLDiff diff)
+{
+    return diff->num_entries;
+}
+
+const SDDLDiffEntry * sddl_diff_entry(SDDLDiff diff, unsigned index)
+{
+    return &diff->entries[index];
+}
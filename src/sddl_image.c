@@ -0,0 +1,772 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Compiled document images.
+ *
+ * An image is a parsed document laid out flat, with every reference stored
+ * as an index or byte offset so the file can be mapped anywhere:
+ *
+ *      header
+ *      var records     every var and struct member, breadth first, so the
+ *                      top-level vars come first and each struct's members
+ *                      are a contiguous run of records
+ *      path records    the flattened path table, in document order
+ *      name slots      hash slots for the top-level, member and path
+ *                      indexes, usable in place
+ *      authors         string offsets
+ *      string blob     NUL-terminated strings
+ *
+ * Loading checks the header and checksum, then fills in one array of var
+ * structs that point into the mapping.  Nothing is parsed and nothing is
+ * allocated per var.
+ */
+#include "sddl_internal.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define _SDDL_IMAGE_MAGIC "SDDLIMG"
+#define _SDDL_IMAGE_VERSION 1
+#define _SDDL_IMAGE_BYTE_ORDER 0x01020304
+#define _SDDL_IMAGE_NO_STRING UINT32_MAX
+#define _SDDL_IMAGE_ALIGN 8
+// Deepest struct nesting accepted when loading; bounds the recursion of
+// everything that walks the var tree.
+#define _SDDL_IMAGE_MAX_DEPTH 1024
+
+#define _SDDL_IMAGE_HAS_MAX_VALUE 0x1
+#define _SDDL_IMAGE_HAS_MIN_VALUE 0x2
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;
+    // FNV-1a (sddl_name_hash) of everything following the header
+    uint32_t checksum;
+    uint64_t total_size;
+
+    uint32_t num_records;
+    uint32_t num_vars;      // top-level vars: records [0, num_vars)
+    uint32_t num_paths;
+    uint32_t num_slots;
+    uint32_t num_authors;
+    uint32_t description;   // string offset
+    uint32_t var_index_capacity;
+    uint32_t var_index_slot;
+    uint32_t path_index_capacity;
+    uint32_t path_index_slot;
+    uint32_t strings_size;
+    uint32_t reserved;
+
+    uint64_t records_offset;
+    uint64_t paths_offset;
+    uint64_t slots_offset;
+    uint64_t authors_offset;
+    uint64_t strings_offset;
+} _SDDLImageHeader;
+
+typedef struct
+{
+    double max_value;
+    double min_value;
+    uint32_t name;
+    uint32_t name_len;
+    uint32_t name_hash;
+    uint32_t decl_string;
+    uint32_t description;
+    uint32_t regex;
+    uint32_t units;
+    uint32_t flags;
+    uint32_t datatype;
+    uint32_t direction;
+    uint32_t numeric_display_hint;
+    uint32_t array_datatype;
+    uint32_t array_num_elements;
+    uint32_t parent;        // record index + 1, or 0 for top-level vars
+    uint32_t first_member;  // record index
+    uint32_t num_members;
+    uint32_t member_index_capacity;
+    uint32_t member_index_slot;
+} _SDDLImageRecord;
+
+typedef struct
+{
+    uint32_t record;
+    uint32_t path;
+    uint32_t path_len;
+    uint32_t path_hash;
+} _SDDLImagePath;
+
+/*
+ * Writing
+ */
+
+typedef struct
+{
+    char *chars;
+    size_t len;
+    size_t capacity;
+} _SDDLImageBuffer;
+
+static bool _sddl_image_reserve(_SDDLImageBuffer *buf, size_t len)
+{
+    if (buf->len + len > buf->capacity)
+    {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        char *chars;
+        while (buf->len + len > capacity)
+        {
+            capacity *= 2;
+        }
+        chars = _sddl_realloc(buf->chars, capacity);
+        if (!chars)
+        {
+            return false;
+        }
+        buf->chars = chars;
+        buf->capacity = capacity;
+    }
+    return true;
+}
+
+static bool _sddl_image_add_string(_SDDLImageBuffer *strings, const char *s, uint32_t *outOffset)
+{
+    size_t len;
+    if (!s)
+    {
+        *outOffset = _SDDL_IMAGE_NO_STRING;
+        return true;
+    }
+    len = strlen(s) + 1;
+    if (strings->len + len >= _SDDL_IMAGE_NO_STRING || !_sddl_image_reserve(strings, len))
+    {
+        return false;
+    }
+    memcpy(&strings->chars[strings->len], s, len);
+    *outOffset = (uint32_t)strings->len;
+    strings->len += len;
+    return true;
+}
+
+static uint32_t _sddl_image_add_slots(_SDDLNameSlot *slots, uint32_t *numSlots, const _SDDLNameIndex *index)
+{
+    uint32_t first = *numSlots;
+    if (index->capacity)
+    {
+        memcpy(&slots[first], index->slots, index->capacity*sizeof(_SDDLNameSlot));
+        *numSlots += index->capacity;
+    }
+    return first;
+}
+
+// Appends path records in the same preorder _sddl_document_finalize used,
+// checking that they line up with the document's path table.
+static bool _sddl_image_add_paths(
+        SDDLDocument doc,
+        SDDLVarDecl *records,
+        _SDDLImageRecord *out,
+        uint32_t first,
+        uint32_t count,
+        _SDDLImagePath *paths,
+        uint32_t *numPaths)
+{
+    uint32_t i;
+    for (i = first; i < first + count; i++)
+    {
+        _SDDLPathEntry *entry;
+        if (*numPaths >= doc->num_paths)
+        {
+            return false;
+        }
+        entry = &doc->paths[*numPaths];
+        if (entry->var != records[i])
+        {
+            return false;
+        }
+        paths[*numPaths].record = i;
+        paths[*numPaths].path_len = (uint32_t)entry->path_len;
+        paths[*numPaths].path_hash = entry->path_hash;
+        (*numPaths)++;
+
+        if (!_sddl_image_add_paths(doc, records, out, out[i].first_member, out[i].num_members, paths, numPaths))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writes <len> bytes to <filename> through a temporary file in the same
+// directory, renamed over it once complete.  Processes that have the old
+// image mapped keep reading the old file, and a failed write leaves it
+// untouched.
+static bool _sddl_image_write_file(const char *filename, const char *chars, size_t len)
+{
+    char *tmpName;
+    size_t nameLen = strlen(filename);
+    bool ok;
+    FILE *fp;
+    int fd;
+
+    tmpName = _sddl_malloc(nameLen + sizeof(".XXXXXX"));
+    if (!tmpName)
+    {
+        return false;
+    }
+    memcpy(tmpName, filename, nameLen);
+    memcpy(&tmpName[nameLen], ".XXXXXX", sizeof(".XXXXXX"));
+    fd = mkstemp(tmpName);
+    if (fd < 0)
+    {
+        _sddl_free(tmpName);
+        return false;
+    }
+    // mkstemp creates the file private to its owner; images are not.
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    fp = fdopen(fd, "wb");
+    if (!fp)
+    {
+        close(fd);
+        unlink(tmpName);
+        _sddl_free(tmpName);
+        return false;
+    }
+    ok = (fwrite(chars, 1, len, fp) == len);
+    ok = ok && fflush(fp) == 0 && fsync(fd) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && rename(tmpName, filename) == 0;
+    if (!ok)
+    {
+        unlink(tmpName);
+    }
+    _sddl_free(tmpName);
+    return ok;
+}
+
+static size_t _sddl_image_align(size_t offset)
+{
+    return (offset + _SDDL_IMAGE_ALIGN - 1) & ~(size_t)(_SDDL_IMAGE_ALIGN - 1);
+}
+
+bool sddl_document_compile(SDDLDocument doc, const char *filename)
+{
+    _SDDLImageHeader header;
+    SDDLVarDecl *records = NULL;
+    _SDDLImageRecord *out = NULL;
+    _SDDLImagePath *paths = NULL;
+    _SDDLNameSlot *slots = NULL;
+    uint32_t *authors = NULL;
+    _SDDLImageBuffer strings = {0};
+    _SDDLImageBuffer image = {0};
+    uint32_t numRecords;
+    uint32_t totalRecords;
+    uint32_t numPaths = 0;
+    uint32_t numSlots = 0;
+    size_t totalSlots;
+    uint32_t i;
+    size_t offset;
+    bool ok = false;
+
+    memset(&header, 0, sizeof(header));
+
+    // Breadth-first numbering: members are queued as their struct is
+    // visited, so each struct's members end up contiguous.
+    totalRecords = doc->num_paths;
+    records = _sddl_malloc((totalRecords + 1)*sizeof(SDDLVarDecl));
+    out = _sddl_calloc(totalRecords + 1, sizeof(_SDDLImageRecord));
+    paths = _sddl_malloc((doc->num_paths + 1)*sizeof(_SDDLImagePath));
+    authors = _sddl_malloc((doc->num_authors + 1)*sizeof(uint32_t));
+    if (!records || !out || !paths || !authors)
+    {
+        goto done;
+    }
+    if (doc->num_vars > totalRecords)
+    {
+        // path table missing (OOM during finalize)
+        goto done;
+    }
+    memcpy(records, doc->vars, doc->num_vars*sizeof(SDDLVarDecl));
+    numRecords = doc->num_vars;
+    totalSlots = doc->var_index.capacity + doc->path_index.capacity;
+    for (i = 0; i < numRecords; i++)
+    {
+        SDDLVarDecl var = records[i];
+        uint32_t j;
+        if (numRecords + var->struct_num_members > totalRecords)
+        {
+            goto done;
+        }
+        out[i].first_member = numRecords;
+        out[i].num_members = var->struct_num_members;
+        for (j = 0; j < var->struct_num_members; j++)
+        {
+            out[numRecords].parent = i + 1;
+            records[numRecords++] = var->struct_members[j];
+        }
+        totalSlots += var->member_index.capacity;
+    }
+    if (numRecords != totalRecords)
+    {
+        goto done;
+    }
+
+    slots = _sddl_malloc((totalSlots + 1)*sizeof(_SDDLNameSlot));
+    if (!slots)
+    {
+        goto done;
+    }
+    header.var_index_capacity = doc->var_index.capacity;
+    header.var_index_slot = _sddl_image_add_slots(slots, &numSlots, &doc->var_index);
+    header.path_index_capacity = doc->path_index.capacity;
+    header.path_index_slot = _sddl_image_add_slots(slots, &numSlots, &doc->path_index);
+
+    for (i = 0; i < numRecords; i++)
+    {
+        SDDLVarDecl var = records[i];
+        _SDDLImageRecord *rec = &out[i];
+        rec->name_len = (uint32_t)var->name_len;
+        rec->name_hash = var->name_hash;
+        rec->max_value = var->max_value;
+        rec->min_value = var->min_value;
+        rec->flags = (var->has_max_value ? _SDDL_IMAGE_HAS_MAX_VALUE : 0) |
+                (var->has_min_value ? _SDDL_IMAGE_HAS_MIN_VALUE : 0);
+        rec->datatype = var->datatype;
+        rec->direction = var->direction;
+        rec->numeric_display_hint = var->numeric_display_hint;
+        rec->array_datatype = var->array_datatype;
+        rec->array_num_elements = var->array_num_elements;
+        rec->member_index_capacity = var->member_index.capacity;
+        rec->member_index_slot = _sddl_image_add_slots(slots, &numSlots, &var->member_index);
+        if (!_sddl_image_add_string(&strings, var->name, &rec->name)
+                || !_sddl_image_add_string(&strings, var->decl_string, &rec->decl_string)
+                || !_sddl_image_add_string(&strings, var->description, &rec->description)
+                || !_sddl_image_add_string(&strings, var->regex, &rec->regex)
+                || !_sddl_image_add_string(&strings, var->units, &rec->units))
+        {
+            goto done;
+        }
+    }
+
+    if (!_sddl_image_add_paths(doc, records, out, 0, doc->num_vars, paths, &numPaths)
+            || numPaths != doc->num_paths)
+    {
+        goto done;
+    }
+    for (i = 0; i < numPaths; i++)
+    {
+        if (!_sddl_image_add_string(&strings, doc->paths[i].path, &paths[i].path))
+        {
+            goto done;
+        }
+    }
+
+    for (i = 0; i < doc->num_authors; i++)
+    {
+        if (!_sddl_image_add_string(&strings, doc->authors[i], &authors[i]))
+        {
+            goto done;
+        }
+    }
+    if (!_sddl_image_add_string(&strings, doc->description ? doc->description : "", &header.description))
+    {
+        goto done;
+    }
+
+    memcpy(header.magic, _SDDL_IMAGE_MAGIC, sizeof(_SDDL_IMAGE_MAGIC));
+    header.version = _SDDL_IMAGE_VERSION;
+    header.byte_order = _SDDL_IMAGE_BYTE_ORDER;
+    header.header_size = sizeof(header);
+    header.num_records = numRecords;
+    header.num_vars = doc->num_vars;
+    header.num_paths = numPaths;
+    header.num_slots = numSlots;
+    header.num_authors = doc->num_authors;
+    header.strings_size = (uint32_t)strings.len;
+
+    offset = _sddl_image_align(sizeof(header));
+    header.records_offset = offset;
+    offset = _sddl_image_align(offset + numRecords*sizeof(_SDDLImageRecord));
+    header.paths_offset = offset;
+    offset = _sddl_image_align(offset + numPaths*sizeof(_SDDLImagePath));
+    header.slots_offset = offset;
+    offset = _sddl_image_align(offset + numSlots*sizeof(_SDDLNameSlot));
+    header.authors_offset = offset;
+    offset = _sddl_image_align(offset + doc->num_authors*sizeof(uint32_t));
+    header.strings_offset = offset;
+    offset += strings.len;
+    header.total_size = offset;
+
+    if (!_sddl_image_reserve(&image, offset))
+    {
+        goto done;
+    }
+    memset(image.chars, 0, offset);
+    memcpy(&image.chars[header.records_offset], out, numRecords*sizeof(_SDDLImageRecord));
+    memcpy(&image.chars[header.paths_offset], paths, numPaths*sizeof(_SDDLImagePath));
+    memcpy(&image.chars[header.slots_offset], slots, numSlots*sizeof(_SDDLNameSlot));
+    memcpy(&image.chars[header.authors_offset], authors, doc->num_authors*sizeof(uint32_t));
+    memcpy(&image.chars[header.strings_offset], strings.chars, strings.len);
+    header.checksum = sddl_name_hash(&image.chars[sizeof(header)], offset - sizeof(header));
+    memcpy(image.chars, &header, sizeof(header));
+
+    ok = _sddl_image_write_file(filename, image.chars, offset);
+
+done:
+    _sddl_free(records);
+    _sddl_free(out);
+    _sddl_free(paths);
+    _sddl_free(slots);
+    _sddl_free(authors);
+    _sddl_free(strings.chars);
+    _sddl_free(image.chars);
+    return ok;
+}
+
+/*
+ * Loading
+ */
+
+static bool _sddl_image_section_ok(const _SDDLImageHeader *header, uint64_t offset, uint64_t count, size_t itemSize)
+{
+    return offset % _SDDL_IMAGE_ALIGN == 0
+        && offset >= sizeof(*header)
+        && offset <= header->total_size
+        && count <= (header->total_size - offset) / itemSize;
+}
+
+static bool _sddl_image_string(const _SDDLImageHeader *header, const char *blob, uint32_t offset, char **out)
+{
+    if (offset == _SDDL_IMAGE_NO_STRING)
+    {
+        *out = NULL;
+        return true;
+    }
+    if (offset >= header->strings_size)
+    {
+        return false;
+    }
+    *out = (char *)&blob[offset];
+    return true;
+}
+
+// Points <index> at slots in the image, checking every slot refers to one
+// of <count> items.
+static bool _sddl_image_index(
+        const _SDDLImageHeader *header,
+        _SDDLNameSlot *slots,
+        uint32_t first,
+        uint32_t capacity,
+        uint32_t count,
+        _SDDLNameIndex *index)
+{
+    uint32_t i;
+    if (capacity & (capacity - 1))
+    {
+        return false;
+    }
+    if (first > header->num_slots || capacity > header->num_slots - first)
+    {
+        return false;
+    }
+    for (i = first; i < first + capacity; i++)
+    {
+        if (slots[i].pos > count)
+        {
+            return false;
+        }
+    }
+    index->capacity = capacity;
+    index->slots = capacity ? &slots[first] : NULL;
+    return true;
+}
+
+static bool _sddl_image_header_ok(const _SDDLImageHeader *header, size_t fileSize)
+{
+    if (fileSize < sizeof(*header)
+            || memcmp(header->magic, _SDDL_IMAGE_MAGIC, sizeof(_SDDL_IMAGE_MAGIC))
+            || header->version != _SDDL_IMAGE_VERSION
+            || header->byte_order != _SDDL_IMAGE_BYTE_ORDER
+            || header->header_size != sizeof(*header)
+            || header->total_size != fileSize)
+    {
+        return false;
+    }
+    return header->num_vars <= header->num_records
+        && header->num_paths == header->num_records
+        && _sddl_image_section_ok(header, header->records_offset, header->num_records, sizeof(_SDDLImageRecord))
+        && _sddl_image_section_ok(header, header->paths_offset, header->num_paths, sizeof(_SDDLImagePath))
+        && _sddl_image_section_ok(header, header->slots_offset, header->num_slots, sizeof(_SDDLNameSlot))
+        && _sddl_image_section_ok(header, header->authors_offset, header->num_authors, sizeof(uint32_t))
+        && header->strings_offset <= header->total_size
+        && header->strings_size == header->total_size - header->strings_offset;
+}
+
+// Checks that the records form the tree sddl_document_compile lays out:
+// top-level vars first, then each struct's members, contiguous and after
+// the struct, every member claimed by exactly one struct, and only structs
+// having members.  Anything else could send the loader into a cycle or
+// past the end of its tables.
+static bool _sddl_image_tree_ok(const _SDDLImageHeader *header, const _SDDLImageRecord *records)
+{
+    uint32_t *depths;
+    uint64_t numMembers = 0;
+    bool ok = false;
+    uint32_t i;
+
+    depths = _sddl_malloc((header->num_records + 1)*sizeof(uint32_t));
+    if (!depths)
+    {
+        return false;
+    }
+    for (i = 0; i < header->num_records; i++)
+    {
+        const _SDDLImageRecord *rec = &records[i];
+        uint32_t j;
+
+        if (i < header->num_vars)
+        {
+            if (rec->parent != 0)
+            {
+                goto done;
+            }
+            depths[i] = 0;
+        }
+        else
+        {
+            // Parents come first, so their depth is known.
+            if (rec->parent == 0 || rec->parent > i)
+            {
+                goto done;
+            }
+            depths[i] = depths[rec->parent - 1] + 1;
+            if (depths[i] > _SDDL_IMAGE_MAX_DEPTH)
+            {
+                goto done;
+            }
+        }
+
+        if (rec->num_members == 0)
+        {
+            continue;
+        }
+        if (rec->datatype != SDDL_DATATYPE_STRUCT
+                || rec->first_member <= i
+                || rec->first_member > header->num_records
+                || rec->num_members > header->num_records - rec->first_member)
+        {
+            goto done;
+        }
+        // A record can only name one parent, so no record is claimed twice.
+        for (j = rec->first_member; j < rec->first_member + rec->num_members; j++)
+        {
+            if (records[j].parent != i + 1)
+            {
+                goto done;
+            }
+        }
+        numMembers += rec->num_members;
+    }
+    // ...and with every non-top-level record claimed, each is claimed once.
+    ok = (numMembers == header->num_records - header->num_vars);
+
+done:
+    _sddl_free(depths);
+    return ok;
+}
+
+static SDDLDocument _sddl_image_open(char *image, size_t imageLen)
+{
+    const _SDDLImageHeader *header = (const _SDDLImageHeader *)image;
+    const _SDDLImageRecord *records;
+    const _SDDLImagePath *paths;
+    const uint32_t *authors;
+    _SDDLNameSlot *slots;
+    const char *blob;
+    SDDLDocument doc;
+    struct SDDLVarDecl_t *vars;
+    SDDLVarDecl *ptrs;
+    uint32_t i;
+
+    if (!_sddl_image_header_ok(header, imageLen))
+    {
+        return NULL;
+    }
+    if (sddl_name_hash(&image[sizeof(*header)], imageLen - sizeof(*header)) != header->checksum)
+    {
+        return NULL;
+    }
+    records = (const _SDDLImageRecord *)&image[header->records_offset];
+    paths = (const _SDDLImagePath *)&image[header->paths_offset];
+    slots = (_SDDLNameSlot *)&image[header->slots_offset];
+    authors = (const uint32_t *)&image[header->authors_offset];
+    blob = &image[header->strings_offset];
+    if (header->strings_size == 0 || blob[header->strings_size - 1] != '\0')
+    {
+        return NULL;
+    }
+    if (!_sddl_image_tree_ok(header, records))
+    {
+        return NULL;
+    }
+
+    // One arena block holds every var struct, path entry, flat table entry
+    // and author pointer.
+    doc = _sddl_document_new(
+            header->num_records*sizeof(struct SDDLVarDecl_t) +
+            header->num_paths*sizeof(_SDDLPathEntry) +
+            2*header->num_paths*sizeof(SDDLFlatVar) +
+            _SDDL_NUM_FLAT_ROWS*((header->num_paths + 63)/64)*sizeof(uint64_t) +
+            header->num_authors*sizeof(char *) + 64, NULL);
+    if (!doc)
+    {
+        return NULL;
+    }
+    vars = _sddl_arena_alloc(&doc->arena, header->num_records*sizeof(struct SDDLVarDecl_t));
+    doc->paths = _sddl_arena_alloc(&doc->arena, header->num_paths*sizeof(_SDDLPathEntry));
+    doc->authors = _sddl_arena_alloc(&doc->arena, header->num_authors*sizeof(char *));
+    // Top-level vars come first, so one pointer array serves as both the
+    // document's var list and every struct's member list.
+    ptrs = _sddl_malloc_with(&doc->allocator, (header->num_records + 1)*sizeof(SDDLVarDecl));
+    doc->vars = ptrs;
+    if ((header->num_records && !vars) || !doc->paths || !doc->authors || !ptrs)
+    {
+        goto fail;
+    }
+    doc->num_vars = header->num_vars;
+    doc->num_paths = header->num_paths;
+    doc->num_authors = header->num_authors;
+
+    for (i = 0; i < header->num_records; i++)
+    {
+        const _SDDLImageRecord *rec = &records[i];
+        SDDLVarDecl var = &vars[i];
+        ptrs[i] = var;
+
+        // Member ranges were checked by _sddl_image_tree_ok.
+        if (!_sddl_image_string(header, blob, rec->name, &var->name)
+                || !var->name
+                || strlen(var->name) != rec->name_len
+                || !_sddl_image_string(header, blob, rec->decl_string, &var->decl_string)
+                || !_sddl_image_string(header, blob, rec->description, &var->description)
+                || !_sddl_image_string(header, blob, rec->regex, &var->regex)
+                || !_sddl_image_string(header, blob, rec->units, &var->units))
+        {
+            goto fail;
+        }
+        var->name_len = rec->name_len;
+        var->name_hash = rec->name_hash;
+        var->datatype = rec->datatype;
+        var->direction = rec->direction;
+        var->max_value = rec->max_value;
+        var->min_value = rec->min_value;
+        var->has_max_value = (rec->flags & _SDDL_IMAGE_HAS_MAX_VALUE) != 0;
+        var->has_min_value = (rec->flags & _SDDL_IMAGE_HAS_MIN_VALUE) != 0;
+        var->numeric_display_hint = rec->numeric_display_hint;
+        var->array_datatype = rec->array_datatype;
+        var->array_num_elements = rec->array_num_elements;
+        var->struct_num_members = rec->num_members;
+        var->struct_members = rec->num_members ? &ptrs[rec->first_member] : NULL;
+        var->parent = rec->parent ? &vars[rec->parent - 1] : NULL;
+        var->in_document = true;
+        if (!_sddl_image_index(header, slots, rec->member_index_slot, rec->member_index_capacity, rec->num_members, &var->member_index))
+        {
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < header->num_paths; i++)
+    {
+        const _SDDLImagePath *path = &paths[i];
+        if (path->record >= header->num_records
+                || !_sddl_image_string(header, blob, path->path, &doc->paths[i].path)
+                || !doc->paths[i].path
+                || strlen(doc->paths[i].path) != path->path_len)
+        {
+            goto fail;
+        }
+        doc->paths[i].var = &vars[path->record];
+        doc->paths[i].path_len = path->path_len;
+        doc->paths[i].path_hash = path->path_hash;
+    }
+
+    for (i = 0; i < header->num_authors; i++)
+    {
+        if (!_sddl_image_string(header, blob, authors[i], &doc->authors[i]) || !doc->authors[i])
+        {
+            goto fail;
+        }
+    }
+    if (!_sddl_image_string(header, blob, header->description, &doc->description) || !doc->description)
+    {
+        goto fail;
+    }
+
+    if (!_sddl_image_index(header, slots, header->var_index_slot, header->var_index_capacity, header->num_vars, &doc->var_index)
+            || !_sddl_image_index(header, slots, header->path_index_slot, header->path_index_capacity, header->num_paths, &doc->path_index))
+    {
+        goto fail;
+    }
+
+    _sddl_resolve_directions(doc->vars, doc->num_vars, SDDL_DIRECTION_INOUT);
+    if (!_sddl_document_build_flat_vars(doc))
+    {
+        goto fail;
+    }
+
+    doc->mapping = image;
+    doc->mapping_len = imageLen;
+    return doc;
+
+fail:
+    sddl_unref_document(doc);
+    return NULL;
+}
+
+SDDLDocument sddl_document_load_image(const char *filename)
+{
+    struct stat st;
+    char *image;
+    SDDLDocument doc;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(_SDDLImageHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    doc = _sddl_image_open(image, st.st_size);
+    if (!doc)
+    {
+        munmap(image, st.st_size);
+    }
+    return doc;
+}
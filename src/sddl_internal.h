@@ -0,0 +1,272 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Definitions shared by the libsddl translation units.  Not installed.
+ */
+#ifndef SDDL_INTERNAL_INCLUDED
+#define SDDL_INTERNAL_INCLUDED
+
+#include "sddl.h"
+#include "sddl_arena.h"
+#include "red_string.h"
+#include "red_json.h"
+
+/*
+ * Allocation (see sddl_alloc.c).  The *_with variants take the allocator
+ * explicitly; the others use the global one.  _sddl_free_with and
+ * _sddl_free accept NULL.
+ */
+const SDDLAllocator * _sddl_global_allocator(void);
+void * _sddl_malloc_with(const SDDLAllocator *allocator, size_t size);
+void * _sddl_calloc_with(const SDDLAllocator *allocator, size_t count, size_t size);
+void * _sddl_realloc_with(const SDDLAllocator *allocator, void *ptr, size_t size);
+void _sddl_free_with(const SDDLAllocator *allocator, void *ptr);
+void * _sddl_malloc(size_t size);
+void * _sddl_calloc(size_t count, size_t size);
+void * _sddl_realloc(void *ptr, size_t size);
+void _sddl_free(void *ptr);
+char * _sddl_strdup(const char *s);
+
+/*
+ * Open-addressing hash table over an array of named items (vars, struct
+ * members or flattened paths).  Each slot caches the item's full hash next
+ * to its position, so mismatching names are rejected without touching the
+ * item itself.  <capacity> is always a power of two (or 0 when the index is
+ * not built, in which case lookups fall back to a linear scan).
+ */
+typedef struct
+{
+    uint32_t hash;
+    uint32_t pos; // position in the item array + 1; 0 marks an empty slot
+} _SDDLNameSlot;
+
+typedef struct
+{
+    unsigned capacity;
+    _SDDLNameSlot *slots;
+} _SDDLNameIndex;
+
+// Returns the name and hash of item <pos> in <items>.
+typedef uint32_t (*_SDDLNameKeyFunc)(const void *items, unsigned pos, const char **outName, size_t *outLen);
+
+// Returns the position of the first of <count> <items> named <name>, or -1.
+int _sddl_name_index_lookup(
+        const _SDDLNameIndex *index,
+        _SDDLNameKeyFunc keyFunc,
+        const void *items,
+        unsigned count,
+        const char *name,
+        size_t len,
+        uint32_t hash);
+
+// Builds (or rebuilds) <index> over <count> <items>.  Returns false on OOM,
+// in which case the index is left empty.  The slots come from <arena> when
+// given (and must then never be passed to _sddl_name_index_free), otherwise
+// from the heap.
+bool _sddl_name_index_build(
+        _SDDLNameIndex *index, 
+        _SDDLArena *arena,
+        _SDDLNameKeyFunc keyFunc, 
+        const void *items, 
+        unsigned count);
+
+void _sddl_name_index_free(_SDDLNameIndex *index);
+
+/*
+ * Open-addressing map from pointers (typically SDDLVarDecls) to small
+ * integers, for side tables keyed by var.
+ */
+typedef struct
+{
+    const void *key; // NULL marks an empty slot
+    unsigned value;
+} _SDDLPtrSlot;
+
+typedef struct
+{
+    unsigned capacity;
+    _SDDLPtrSlot *slots;
+} _SDDLPtrIndex;
+
+// Sizes an empty index for <count> keys.  Returns false on OOM.
+bool _sddl_ptr_index_init(_SDDLPtrIndex *index, unsigned count);
+// The first value inserted for a key wins.
+void _sddl_ptr_index_insert(_SDDLPtrIndex *index, const void *key, unsigned value);
+// Returns the value for <key>, or -1.
+int _sddl_ptr_index_lookup(const _SDDLPtrIndex *index, const void *key);
+void _sddl_ptr_index_free(_SDDLPtrIndex *index);
+
+// Entry in a document's flattened table of every var and struct member,
+// addressed by dotted path (e.g. "motor.temp.max").
+typedef struct
+{
+    SDDLVarDecl var;
+    char *path;
+    size_t path_len;
+    uint32_t path_hash;
+} _SDDLPathEntry;
+
+// Diagnostics that fit in the parse result itself.  Most parses have none,
+// and a failed one stops at its first error.
+#define _SDDL_INLINE_DIAGNOSTICS 8
+
+struct SDDLParseResult_t
+{
+    bool ok;
+    SDDLDocument doc;
+    // <diagnostics> points at <inline_diagnostics> until more are needed,
+    // then at an array from the document's allocator.
+    unsigned num_diagnostics;
+    unsigned diagnostics_capacity;
+    SDDLDiagnostic *diagnostics;
+    SDDLDiagnostic inline_diagnostics[_SDDL_INLINE_DIAGNOSTICS];
+    unsigned max_diagnostics;   // 0: no limit
+    unsigned num_dropped_diagnostics;
+    unsigned num_errors;
+    // Formatted messages; NULL until asked for.
+    RedStringList errors;
+    RedStringList warnings;
+#ifdef SDDL_PARSE_STATS
+    bool has_stats;
+    SDDLParseStats stats;
+#endif
+};
+
+struct SDDLDocument_t
+{
+    unsigned refcnt;    // only accessed atomically
+    bool frozen;
+    // Serves the document, its arena and var array, and its parse result.
+    SDDLAllocator allocator;
+    _SDDLArena arena;
+    unsigned num_authors;
+    char **authors;
+    char *description;
+    unsigned num_vars;
+    SDDLVarDecl *vars;
+    // Source text read from a file and parsed in situ (see
+    // _sddl_read_file), or NULL.  Allocated with <allocator>.
+    char *source;
+    size_t source_len;
+    // Compiled image mapping (see sddl_document_load_image), or NULL.
+    // Unmapped when the document is freed.
+    char *mapping;
+    size_t mapping_len;
+    _SDDLNameIndex var_index;
+    unsigned num_paths;
+    _SDDLPathEntry *paths;
+    _SDDLNameIndex path_index;
+    // Flattened var table, in the same order as <paths>, and its leaves
+    unsigned num_flat_vars;
+    SDDLFlatVar *flat_vars;
+    unsigned num_leaf_vars;
+    SDDLFlatVar *leaf_vars;
+    // Bitsets over the flat table, _SDDL_NUM_FLAT_ROWS rows of <flat_words>
+    // words each (see _SDDL_*_ROW).  NULL if the flat table wasn't built.
+    unsigned flat_words;
+    uint64_t *flat_bits;
+};
+
+// Rows of a document's flat var bitsets: one per concrete direction, one
+// per datatype, and one marking the leaves.
+#define _SDDL_NUM_DIRECTIONS (SDDL_DIRECTION_OUT + 1)
+#define _SDDL_NUM_DATATYPES (SDDL_DATATYPE_ARRAY + 1)
+#define _SDDL_DIRECTION_ROW(direction) (direction)
+#define _SDDL_DATATYPE_ROW(datatype) (_SDDL_NUM_DIRECTIONS + (datatype))
+#define _SDDL_LEAF_ROW (_SDDL_NUM_DIRECTIONS + _SDDL_NUM_DATATYPES)
+#define _SDDL_NUM_FLAT_ROWS (_SDDL_LEAF_ROW + 1)
+
+struct SDDLVarDecl_t
+{
+    char *name;
+    size_t name_len;
+    uint32_t name_hash;
+    char *decl_string;
+    char *description;
+    void *extra;
+    SDDLDatatypeEnum datatype;
+    SDDLDirectionEnum direction;
+    // <direction> with INHERIT resolved; set for document vars only
+    SDDLDirectionEnum concrete_direction;
+    double max_value;
+    double min_value;
+    bool has_max_value;
+    bool has_min_value;
+    SDDLNumericDisplayHintEnum numeric_display_hint;
+    char *regex;
+    char *units;
+    unsigned struct_num_members;
+    unsigned struct_members_capacity;   // programmatic structs only
+    SDDLVarDecl *struct_members;
+    _SDDLNameIndex member_index;
+    unsigned array_num_elements;
+    SDDLDatatypeEnum array_datatype;
+    // JSON definition; built lazily for programmatic vars, NULL until then
+    RedJsonObject json;
+    SDDLVarDecl parent;
+    // true for vars that live in a document's arena; those are immutable
+    bool in_document;
+    // set by sddl_document_freeze; <extra> can no longer be changed either
+    bool frozen;
+};
+
+// Result of parsing a declaration key such as "out float32 temp".
+typedef struct
+{
+    SDDLDatatypeEnum datatype;
+    SDDLOptionalityEnum optionality;
+    SDDLDirectionEnum direction;
+    SDDLDatatypeEnum array_datatype;
+    size_t array_num_elements;
+    // points into the key; not NUL-terminated
+    const char *name;
+    size_t name_len;
+} VarKeyInfo;
+
+// Returns an empty document with a refcount of 1.  A NULL <allocator>
+// means the global one.
+SDDLDocument _sddl_document_new(size_t arenaBlockSize, const SDDLAllocator *allocator);
+
+SDDLParseResult _sddl_new_parse_result(size_t arenaBlockSize, const SDDLAllocator *allocator);
+
+// Appends a copy of <diag> (but not of its strings), unless the result's
+// limit has been reached.  Returns false on OOM.
+bool _sddl_parse_result_add_diagnostic(SDDLParseResult result, const SDDLDiagnostic *diag);
+
+// Builds a parsed document's name indexes and flattened path table.
+// Returns false on OOM; lookups still work (by linear scan) in that case.
+bool _sddl_document_finalize(SDDLDocument doc);
+// Builds the flat var tables and their bitsets from doc->paths.  Returns
+// false on OOM.
+bool _sddl_document_build_flat_vars(SDDLDocument doc);
+// Sets the concrete direction of <vars> and, recursively, their members.
+// <inherited> is the concrete direction of their struct, or INOUT at the
+// top level.
+void _sddl_resolve_directions(SDDLVarDecl *vars, unsigned count, SDDLDirectionEnum inherited);
+
+void _sddl_var_set_name(SDDLVarDecl var, char *name);
+
+// Builds a new JSON definition object for <var>, recursing into members.
+RedJsonObject _construct_definition_object(SDDLVarDecl var);
+
+SDDLDatatypeEnum _sddl_datatype_from_chars(const char *s, size_t len);
+SDDLNumericDisplayHintEnum _sddl_display_hint_from_chars(const char *s, size_t len);
+const char * _sddl_display_hint_to_string(SDDLNumericDisplayHintEnum v);
+
+// True if the key declares a Cloud Variable, false otherwise (with a static
+// message in <outError>).  Does not allocate.
+bool _parse_var_key(const char *key, size_t len, VarKeyInfo *out, const char **outError);
+
+#endif
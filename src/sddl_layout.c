@@ -0,0 +1,309 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Memory layout of var values.
+ *
+ * Values are laid out the way a C compiler would lay out the matching
+ * struct, with these C types:
+ *
+ *      bool            bool
+ *      int8 .. uint32  int8_t .. uint32_t
+ *      float32/64      float / double
+ *      datetime        int64_t
+ *      string          const char *
+ *      void            nothing
+ *      T[N]            T[N]
+ *      struct          struct, members in declaration order
+ *
+ * A document is laid out as a struct of its top-level vars.
+ */
+#include "sddl_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define _SDDL_CACHE_LINE_SIZE 64
+
+struct SDDLLayout_t
+{
+    SDDLLayoutModeEnum mode;
+    size_t size;
+    size_t alignment;
+    unsigned num_entries;
+    unsigned capacity;
+    SDDLLayoutEntry *entries;
+    _SDDLPtrIndex entry_index;  // var -> position in entries
+};
+
+static size_t _sddl_align_up(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+static size_t _sddl_layout_basic_size(SDDLDatatypeEnum datatype)
+{
+    switch (datatype)
+    {
+        case SDDL_DATATYPE_BOOL:
+            return sizeof(bool);
+        case SDDL_DATATYPE_INT8:
+        case SDDL_DATATYPE_UINT8:
+            return 1;
+        case SDDL_DATATYPE_INT16:
+        case SDDL_DATATYPE_UINT16:
+            return 2;
+        case SDDL_DATATYPE_INT32:
+        case SDDL_DATATYPE_UINT32:
+        case SDDL_DATATYPE_FLOAT32:
+            return 4;
+        case SDDL_DATATYPE_FLOAT64:
+        case SDDL_DATATYPE_DATETIME:
+            return 8;
+        case SDDL_DATATYPE_STRING:
+            return sizeof(const char *);
+        default:
+            return 0;
+    }
+}
+
+static SDDLLayoutEntry * _sddl_layout_add_entry(SDDLLayout layout, SDDLVarDecl var)
+{
+    SDDLLayoutEntry *entry;
+    if (layout->num_entries == layout->capacity)
+    {
+        unsigned capacity = layout->capacity ? 2*layout->capacity : 16;
+        SDDLLayoutEntry *entries = _sddl_realloc(layout->entries, capacity*sizeof(SDDLLayoutEntry));
+        if (!entries)
+        {
+            return NULL;
+        }
+        layout->entries = entries;
+        layout->capacity = capacity;
+    }
+    entry = &layout->entries[layout->num_entries++];
+    memset(entry, 0, sizeof(*entry));
+    entry->var = var;
+    return entry;
+}
+
+static bool _sddl_layout_var(SDDLLayout layout, SDDLVarDecl var, size_t *outSize, size_t *outAlignment);
+
+// Lays out <count> <vars> as the members of a struct.  Offsets are first
+// recorded relative to the struct and rebased by _sddl_layout_rebase.
+static bool _sddl_layout_members(
+        SDDLLayout layout,
+        SDDLVarDecl *vars,
+        unsigned count,
+        bool isRoot,
+        size_t *outSize,
+        size_t *outAlignment)
+{
+    size_t offset = 0;
+    size_t alignment = 1;
+    unsigned i;
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned pos = layout->num_entries;
+        size_t size;
+        size_t memberAlignment;
+        if (!_sddl_layout_var(layout, vars[i], &size, &memberAlignment))
+        {
+            return false;
+        }
+        if (isRoot && layout->mode == SDDL_LAYOUT_CACHE_LINE)
+        {
+            // Each top-level value gets cache lines of its own, so writers
+            // of different vars never share a line.
+            memberAlignment = _SDDL_CACHE_LINE_SIZE;
+            size = _sddl_align_up(size, _SDDL_CACHE_LINE_SIZE);
+        }
+        offset = _sddl_align_up(offset, memberAlignment);
+        layout->entries[pos].offset = offset;
+        offset += size;
+        if (memberAlignment > alignment)
+        {
+            alignment = memberAlignment;
+        }
+    }
+    *outSize = _sddl_align_up(offset, alignment);
+    *outAlignment = alignment;
+    return true;
+}
+
+static bool _sddl_layout_var(SDDLLayout layout, SDDLVarDecl var, size_t *outSize, size_t *outAlignment)
+{
+    unsigned pos = layout->num_entries;
+    SDDLLayoutEntry *entry = _sddl_layout_add_entry(layout, var);
+    size_t size;
+    size_t alignment;
+
+    if (!entry)
+    {
+        return false;
+    }
+    switch (var->datatype)
+    {
+        case SDDL_DATATYPE_STRUCT:
+        {
+            if (!_sddl_layout_members(layout, var->struct_members, var->struct_num_members, false, &size, &alignment))
+            {
+                return false;
+            }
+            break;
+        }
+        case SDDL_DATATYPE_ARRAY:
+        {
+            size_t elementSize;
+            if (!sddl_datatype_is_basic(var->array_datatype))
+            {
+                // no layout for arrays of structs or arrays
+                return false;
+            }
+            elementSize = _sddl_layout_basic_size(var->array_datatype);
+            alignment = (layout->mode == SDDL_LAYOUT_PACKED || elementSize == 0) ? 1 : elementSize;
+            size = elementSize*var->array_num_elements;
+            layout->entries[pos].element_size = elementSize;
+            break;
+        }
+        case SDDL_DATATYPE_INVALID:
+        {
+            return false;
+        }
+        default:
+        {
+            size = _sddl_layout_basic_size(var->datatype);
+            alignment = (layout->mode == SDDL_LAYOUT_PACKED || size == 0) ? 1 : size;
+            break;
+        }
+    }
+    if (layout->mode == SDDL_LAYOUT_PACKED)
+    {
+        alignment = 1;
+    }
+
+    // <entry> may have moved as members were added.
+    entry = &layout->entries[pos];
+    entry->size = size;
+    entry->alignment = alignment;
+    if (var->datatype != SDDL_DATATYPE_ARRAY)
+    {
+        entry->element_size = size;
+    }
+    *outSize = size;
+    *outAlignment = alignment;
+    return true;
+}
+
+// Turns member offsets, recorded relative to their parent struct, into
+// offsets from the start of the layout.  Entries are in preorder.
+static unsigned _sddl_layout_rebase(SDDLLayout layout, unsigned pos, size_t base)
+{
+    SDDLLayoutEntry *entry = &layout->entries[pos];
+    SDDLVarDecl var = entry->var;
+    unsigned next = pos + 1;
+    unsigned i;
+
+    entry->offset += base;
+    if (var->datatype == SDDL_DATATYPE_STRUCT)
+    {
+        for (i = 0; i < var->struct_num_members; i++)
+        {
+            next = _sddl_layout_rebase(layout, next, entry->offset);
+        }
+    }
+    return next;
+}
+
+static SDDLLayout _sddl_layout_new(SDDLVarDecl *vars, unsigned count, SDDLLayoutModeEnum mode)
+{
+    SDDLLayout layout;
+    unsigned pos;
+    unsigned i;
+
+    layout = _sddl_calloc(1, sizeof(struct SDDLLayout_t));
+    if (!layout)
+    {
+        return NULL;
+    }
+    layout->mode = mode;
+    if (!_sddl_layout_members(layout, vars, count, true, &layout->size, &layout->alignment))
+    {
+        goto fail;
+    }
+    for (pos = 0; pos < layout->num_entries; )
+    {
+        pos = _sddl_layout_rebase(layout, pos, 0);
+    }
+
+    if (!_sddl_ptr_index_init(&layout->entry_index, layout->num_entries))
+    {
+        goto fail;
+    }
+    for (i = 0; i < layout->num_entries; i++)
+    {
+        _sddl_ptr_index_insert(&layout->entry_index, layout->entries[i].var, i);
+    }
+    return layout;
+
+fail:
+    sddl_layout_free(layout);
+    return NULL;
+}
+
+SDDLLayout sddl_layout_new_for_document(SDDLDocument doc, SDDLLayoutModeEnum mode)
+{
+    return _sddl_layout_new(doc->vars, doc->num_vars, mode);
+}
+
+SDDLLayout sddl_layout_new_for_var(SDDLVarDecl var, SDDLLayoutModeEnum mode)
+{
+    return _sddl_layout_new(&var, 1, mode);
+}
+
+void sddl_layout_free(SDDLLayout layout)
+{
+    if (layout)
+    {
+        _sddl_ptr_index_free(&layout->entry_index);
+        _sddl_free(layout->entries);
+        _sddl_free(layout);
+    }
+}
+
+size_t sddl_layout_size(SDDLLayout layout)
+{
+    return layout->size;
+}
+
+size_t sddl_layout_alignment(SDDLLayout layout)
+{
+    return layout->alignment;
+}
+
+unsigned sddl_layout_num_entries(SDDLLayout layout)
+{
+    return layout->num_entries;
+}
+
+const SDDLLayoutEntry * sddl_layout_entry(SDDLLayout layout, unsigned index)
+{
+    return &layout->entries[index];
+}
+
+const SDDLLayoutEntry * sddl_layout_entry_for_var(SDDLLayout layout, SDDLVarDecl var)
+{
+    int pos = _sddl_ptr_index_lookup(&layout->entry_index, var);
+    return (pos < 0) ? NULL : &layout->entries[pos];
+}
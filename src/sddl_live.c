@@ -0,0 +1,333 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Live schemas: a document that can be swapped while being read.
+ *
+ * Readers never lock.  A reader announces itself by bumping the reader
+ * count of the current epoch (one of two), loads the current document,
+ * takes a reference to it, and leaves the epoch again.  The reference
+ * keeps the document alive from then on; the epoch only has to cover the
+ * window between loading the pointer and taking the reference.
+ *
+ * A writer publishes the new document, then waits for a grace period
+ * before dropping the live schema's reference to the old one.  As in
+ * userspace RCU, the grace period flips the epoch and waits for the old
+ * epoch's readers to leave, twice, so that a reader which read the epoch
+ * just before a flip is still waited for.  Readers that arrive during the
+ * grace period see the new document and are not waited for, so writers
+ * can't be starved.
+ *
+ * File watching uses inotify on the file's directory rather than on the
+ * file itself, so replacing the file by rename (as editors and deployment
+ * tools do) is picked up too.  Parsed documents own a copy of the file's
+ * text, so snapshots held by readers stay intact however the file is
+ * replaced, including by rewriting it in place.
+ */
+#include "sddl_internal.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+struct SDDLLiveSchema_t
+{
+    SDDLDocument current;           // only accessed atomically
+    unsigned epoch;                 // only accessed atomically; 0 or 1
+    unsigned readers[2];            // only accessed atomically
+    pthread_mutex_t write_lock;     // serializes writers
+    char *filename;                 // NULL unless loaded from a file
+
+    // File watching
+    bool watching;
+    pthread_t watch_thread;
+    int inotify_fd;
+    int stop_pipe[2];
+    SDDLLiveReloadCallback callback;
+    void *callback_userdata;
+};
+
+SDDLLiveSchema sddl_live_schema_new(SDDLDocument doc)
+{
+    SDDLLiveSchema live = _sddl_calloc(1, sizeof(struct SDDLLiveSchema_t));
+    if (!live)
+    {
+        return NULL;
+    }
+    if (pthread_mutex_init(&live->write_lock, NULL) != 0)
+    {
+        _sddl_free(live);
+        return NULL;
+    }
+    sddl_document_freeze(doc);
+    live->current = sddl_ref_document(doc);
+    live->inotify_fd = -1;
+    live->stop_pipe[0] = live->stop_pipe[1] = -1;
+    return live;
+}
+
+// Parses <filename>.  Returns a new reference to the document, or NULL
+// after handing any failed result to <outFailure>.
+static SDDLDocument _sddl_live_load(const char *filename, SDDLParseResult *outFailure)
+{
+    SDDLParseResult result = sddl_load_and_parse(filename);
+    SDDLDocument doc = NULL;
+
+    if (outFailure)
+    {
+        *outFailure = NULL;
+    }
+    if (result && sddl_parse_result_ok(result))
+    {
+        doc = sddl_parse_result_ref_document(result);
+    }
+    else if (outFailure)
+    {
+        *outFailure = result;
+        return NULL;
+    }
+    sddl_free_parse_result(result);
+    return doc;
+}
+
+SDDLLiveSchema sddl_live_schema_load(const char *filename, SDDLParseResult *outFailure)
+{
+    SDDLDocument doc = _sddl_live_load(filename, outFailure);
+    SDDLLiveSchema live;
+
+    if (!doc)
+    {
+        return NULL;
+    }
+    live = sddl_live_schema_new(doc);
+    sddl_unref_document(doc);
+    if (!live)
+    {
+        return NULL;
+    }
+    live->filename = _sddl_strdup(filename);
+    if (!live->filename)
+    {
+        sddl_live_schema_free(live);
+        return NULL;
+    }
+    return live;
+}
+
+void sddl_live_schema_free(SDDLLiveSchema live)
+{
+    if (!live)
+    {
+        return;
+    }
+    if (live->watching)
+    {
+        // Closing the write end wakes the watcher, which then exits.
+        close(live->stop_pipe[1]);
+        pthread_join(live->watch_thread, NULL);
+        close(live->stop_pipe[0]);
+        close(live->inotify_fd);
+    }
+    // No readers may remain at this point.
+    sddl_unref_document(live->current);
+    pthread_mutex_destroy(&live->write_lock);
+    _sddl_free(live->filename);
+    _sddl_free(live);
+}
+
+SDDLDocument sddl_live_schema_acquire(SDDLLiveSchema live)
+{
+    unsigned epoch = __atomic_load_n(&live->epoch, __ATOMIC_SEQ_CST);
+    SDDLDocument doc;
+
+    __atomic_fetch_add(&live->readers[epoch], 1, __ATOMIC_SEQ_CST);
+    doc = sddl_ref_document(__atomic_load_n(&live->current, __ATOMIC_SEQ_CST));
+    __atomic_fetch_sub(&live->readers[epoch], 1, __ATOMIC_RELEASE);
+    return doc;
+}
+
+static void _sddl_live_wait_for_readers(SDDLLiveSchema live)
+{
+    unsigned phase;
+    for (phase = 0; phase < 2; phase++)
+    {
+        unsigned old = __atomic_load_n(&live->epoch, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&live->epoch, old ^ 1, __ATOMIC_SEQ_CST);
+        // Readers hold the epoch for a handful of instructions.
+        while (__atomic_load_n(&live->readers[old], __ATOMIC_ACQUIRE) != 0)
+        {
+            sched_yield();
+        }
+    }
+}
+
+void sddl_live_schema_replace(SDDLLiveSchema live, SDDLDocument doc)
+{
+    SDDLDocument old;
+
+    sddl_document_freeze(doc);
+    sddl_ref_document(doc);
+
+    pthread_mutex_lock(&live->write_lock);
+    old = __atomic_exchange_n(&live->current, doc, __ATOMIC_SEQ_CST);
+    _sddl_live_wait_for_readers(live);
+    pthread_mutex_unlock(&live->write_lock);
+
+    // Readers that got the old document hold their own references.
+    sddl_unref_document(old);
+}
+
+bool sddl_live_schema_reload(SDDLLiveSchema live, SDDLParseResult *outFailure)
+{
+    SDDLDocument doc;
+
+    if (outFailure)
+    {
+        *outFailure = NULL;
+    }
+    if (!live->filename)
+    {
+        return false;
+    }
+    doc = _sddl_live_load(live->filename, outFailure);
+    if (!doc)
+    {
+        return false;
+    }
+    sddl_live_schema_replace(live, doc);
+    sddl_unref_document(doc);
+    return true;
+}
+
+// True if <event> concerns our file, given the directory is being watched.
+static bool _sddl_live_event_matches(SDDLLiveSchema live, const struct inotify_event *event)
+{
+    const char *slash = strrchr(live->filename, '/');
+    const char *basename = slash ? slash + 1 : live->filename;
+    return event->len > 0 && !strcmp(event->name, basename);
+}
+
+static void * _sddl_live_watch_main(void *arg)
+{
+    SDDLLiveSchema live = arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;)
+    {
+        struct pollfd fds[2];
+        ssize_t len;
+        ssize_t offset;
+        bool changed = false;
+
+        fds[0].fd = live->inotify_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = live->stop_pipe[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents)
+        {
+            break;
+        }
+
+        len = read(live->inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            continue;
+        }
+        for (offset = 0; offset < len; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *)&buf[offset];
+            changed = changed || _sddl_live_event_matches(live, event);
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+        if (changed)
+        {
+            bool reloaded = sddl_live_schema_reload(live, NULL);
+            if (live->callback)
+            {
+                live->callback(live, reloaded, live->callback_userdata);
+            }
+        }
+    }
+    return NULL;
+}
+
+bool sddl_live_schema_watch(SDDLLiveSchema live, SDDLLiveReloadCallback callback, void *userdata)
+{
+    char dirname[PATH_MAX];
+    const char *slash;
+
+    if (!live->filename || live->watching)
+    {
+        return false;
+    }
+    slash = strrchr(live->filename, '/');
+    if (!slash)
+    {
+        strcpy(dirname, ".");
+    }
+    else if ((size_t)(slash - live->filename) < sizeof(dirname))
+    {
+        // "/x" lives in "/"
+        size_t len = (slash == live->filename) ? 1 : (size_t)(slash - live->filename);
+        memcpy(dirname, live->filename, len);
+        dirname[len] = '\0';
+    }
+    else
+    {
+        return false;
+    }
+
+    live->inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (live->inotify_fd < 0)
+    {
+        return false;
+    }
+    if (inotify_add_watch(live->inotify_fd, dirname, IN_CLOSE_WRITE | IN_MOVED_TO) < 0
+            || pipe(live->stop_pipe) != 0)
+    {
+        goto fail;
+    }
+    live->callback = callback;
+    live->callback_userdata = userdata;
+    if (pthread_create(&live->watch_thread, NULL, _sddl_live_watch_main, live) != 0)
+    {
+        goto fail;
+    }
+    live->watching = true;
+    return true;
+
+fail:
+    close(live->inotify_fd);
+    live->inotify_fd = -1;
+    if (live->stop_pipe[0] >= 0)
+    {
+        close(live->stop_pipe[0]);
+        close(live->stop_pipe[1]);
+        live->stop_pipe[0] = live->stop_pipe[1] = -1;
+    }
+    return false;
+}
@@ -0,0 +1,232 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Parallel batch loading.
+ *
+ * Files are parsed by a pool of threads that claim the next unparsed file
+ * from a shared atomic counter, so a few large files can't leave the other
+ * threads idle.  Each file is parsed independently with
+ * sddl_load_and_parse, which shares no state between documents, and its
+ * result is stored in that file's slot, keeping results in input order.
+ * The calling thread works alongside the pool.
+ */
+#include "sddl_internal.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct SDDLLoadBatch_t
+{
+    unsigned num_files;
+    char **filenames;
+    SDDLParseResult *results;
+    unsigned next_file;     // only accessed atomically
+};
+
+static void * _sddl_load_batch_worker(void *arg)
+{
+    SDDLLoadBatch batch = arg;
+    unsigned i;
+    while ((i = __atomic_fetch_add(&batch->next_file, 1, __ATOMIC_RELAXED)) < batch->num_files)
+    {
+        batch->results[i] = sddl_load_and_parse(batch->filenames[i]);
+    }
+    return NULL;
+}
+
+static unsigned _sddl_default_num_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (unsigned)n : 1;
+}
+
+// Parses every file in <batch>, which owns <filenames>.
+static SDDLLoadBatch _sddl_load_batch_run(SDDLLoadBatch batch, unsigned numThreads)
+{
+    pthread_t *threads;
+    unsigned numStarted = 0;
+
+    batch->results = _sddl_calloc(batch->num_files + 1, sizeof(SDDLParseResult));
+    if (!batch->results)
+    {
+        sddl_load_batch_free(batch);
+        return NULL;
+    }
+
+    if (numThreads == 0)
+    {
+        numThreads = _sddl_default_num_threads();
+    }
+    if (numThreads > batch->num_files)
+    {
+        numThreads = batch->num_files;
+    }
+
+    // The calling thread is one of the <numThreads>.  If threads can't be
+    // started, the ones we have do all the work.
+    threads = (numThreads > 1) ? _sddl_malloc((numThreads - 1)*sizeof(pthread_t)) : NULL;
+    if (threads)
+    {
+        while (numStarted < numThreads - 1
+                && pthread_create(&threads[numStarted], NULL, _sddl_load_batch_worker, batch) == 0)
+        {
+            numStarted++;
+        }
+    }
+    _sddl_load_batch_worker(batch);
+    while (numStarted > 0)
+    {
+        pthread_join(threads[--numStarted], NULL);
+    }
+    _sddl_free(threads);
+    return batch;
+}
+
+SDDLLoadBatch sddl_load_batch_files(const char * const *filenames, unsigned count, unsigned numThreads)
+{
+    SDDLLoadBatch batch;
+    unsigned i;
+
+    batch = _sddl_calloc(1, sizeof(struct SDDLLoadBatch_t));
+    if (!batch)
+    {
+        return NULL;
+    }
+    batch->filenames = _sddl_calloc(count + 1, sizeof(char *));
+    if (!batch->filenames)
+    {
+        _sddl_free(batch);
+        return NULL;
+    }
+    for (i = 0; i < count; i++)
+    {
+        batch->filenames[i] = _sddl_strdup(filenames[i]);
+        if (!batch->filenames[i])
+        {
+            sddl_load_batch_free(batch);
+            return NULL;
+        }
+        batch->num_files++;
+    }
+    return _sddl_load_batch_run(batch, numThreads);
+}
+
+static bool _sddl_has_sddl_suffix(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 5 && !strcmp(&name[len - 5], ".sddl");
+}
+
+static int _sddl_compare_filenames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+SDDLLoadBatch sddl_load_batch_dir(const char *dirname, unsigned numThreads)
+{
+    SDDLLoadBatch batch;
+    DIR *dir;
+    struct dirent *entry;
+    unsigned capacity = 0;
+
+    dir = opendir(dirname);
+    if (!dir)
+    {
+        return NULL;
+    }
+    batch = _sddl_calloc(1, sizeof(struct SDDLLoadBatch_t));
+    if (!batch)
+    {
+        closedir(dir);
+        return NULL;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char *filename;
+        if (!_sddl_has_sddl_suffix(entry->d_name))
+        {
+            continue;
+        }
+        if (batch->num_files == capacity)
+        {
+            char **filenames;
+            capacity = capacity ? 2*capacity : 64;
+            filenames = _sddl_realloc(batch->filenames, capacity*sizeof(char *));
+            if (!filenames)
+            {
+                goto fail;
+            }
+            batch->filenames = filenames;
+        }
+        filename = _sddl_malloc(strlen(dirname) + strlen(entry->d_name) + 2);
+        if (!filename)
+        {
+            goto fail;
+        }
+        sprintf(filename, "%s/%s", dirname, entry->d_name);
+        batch->filenames[batch->num_files++] = filename;
+    }
+    closedir(dir);
+
+    // readdir order is arbitrary; make the result order reproducible.
+    if (batch->num_files > 1)
+    {
+        qsort(batch->filenames, batch->num_files, sizeof(char *), _sddl_compare_filenames);
+    }
+    return _sddl_load_batch_run(batch, numThreads);
+
+fail:
+    closedir(dir);
+    sddl_load_batch_free(batch);
+    return NULL;
+}
+
+void sddl_load_batch_free(SDDLLoadBatch batch)
+{
+    unsigned i;
+    if (!batch)
+    {
+        return;
+    }
+    for (i = 0; i < batch->num_files; i++)
+    {
+        _sddl_free(batch->filenames[i]);
+        if (batch->results)
+        {
+            sddl_free_parse_result(batch->results[i]);
+        }
+    }
+    _sddl_free(batch->filenames);
+    _sddl_free(batch->results);
+    _sddl_free(batch);
+}
+
+unsigned sddl_load_batch_num_files(SDDLLoadBatch batch)
+{
+    return batch->num_files;
+}
+
+const char * sddl_load_batch_filename(SDDLLoadBatch batch, unsigned index)
+{
+    return batch->filenames[index];
+}
+
+SDDLParseResult sddl_load_batch_result(SDDLLoadBatch batch, unsigned index)
+{
+    return batch->results[index];
+}
@@ -0,0 +1,1659 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Native SDDL parser.
+ *
+ * SDDL is JSON with two relaxations: C-style comments and trailing commas.
+ * Rather than building a generic JSON tree and walking it a second time,
+ * the lexer below turns input bytes into tokens and hands each one straight
+ * to a small grammar state machine, which fills in SDDLVarDecls as it goes.
+ *
+ * Both halves keep all their state in the SDDLParser, so input can be fed
+ * in arbitrary chunks (see sddl_parser_feed); nothing is ever re-scanned and
+ * only the string currently being lexed is ever buffered.
+ *
+ * Structs nest: inside a struct's definition, a key that isn't one of the
+ * known fields but parses as a declaration starts a member, which gets a
+ * frame of its own.  Finished members collect on a stack until their
+ * struct closes, and are then moved into the arena in one piece.
+ *
+ * When the parser owns a writable copy of the whole input (a file read
+ * into a buffer the document keeps), it runs "in situ": strings are
+ * unescaped in place and NUL-terminated over their closing quote, so the
+ * document can point straight into the source instead of copying.
+ *
+ * Built with SDDL_PARSE_STATS, the parser can also time each phase and
+ * count what it allocates (see SDDLParseStats).  Without it, the
+ * _SDDL_STATS_* macros below expand to nothing.
+ */
+#include "sddl_internal.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define _SDDL_MAX_DEPTH 64
+
+#ifdef SDDL_PARSE_STATS
+static uint64_t _sddl_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+// Timestamp to pass to _SDDL_STATS_END, or 0 when not collecting.
+#define _SDDL_STATS_BEGIN(p) ((p)->stats ? _sddl_stats_now() : 0)
+// Adds the time since <start> to <field> of the parser's stats.
+#define _SDDL_STATS_END(p, field, start) \
+    do { if ((p)->stats) (p)->stats->field += _sddl_stats_now() - (start); } while (0)
+// Runs <stmt>, which may refer to (p)->stats, when collecting.
+#define _SDDL_STATS_DO(p, stmt) \
+    do { if ((p)->stats) { stmt; } } while (0)
+#else
+#define _SDDL_STATS_BEGIN(p) 0
+#define _SDDL_STATS_END(p, field, start) ((void)(start))
+#define _SDDL_STATS_DO(p, stmt) do { } while (0)
+#endif
+
+typedef enum
+{
+    _SDDL_TOKEN_LBRACE,
+    _SDDL_TOKEN_RBRACE,
+    _SDDL_TOKEN_LBRACKET,
+    _SDDL_TOKEN_RBRACKET,
+    _SDDL_TOKEN_COLON,
+    _SDDL_TOKEN_COMMA,
+    _SDDL_TOKEN_STRING,
+    _SDDL_TOKEN_NUMBER,
+    _SDDL_TOKEN_TRUE,
+    _SDDL_TOKEN_FALSE,
+    _SDDL_TOKEN_NULL,
+} _SDDLTokenType;
+
+typedef struct
+{
+    _SDDLTokenType type;
+    // STRING only: the unescaped contents.  <stable> strings are
+    // NUL-terminated and live as long as the document; others are only
+    // valid until the next token.
+    const char *chars;
+    size_t len;
+    bool stable;
+    // NUMBER only
+    double number;
+    // position of the token's first character
+    unsigned line;
+    unsigned col;
+    size_t offset;
+} _SDDLToken;
+
+typedef enum
+{
+    _SDDL_LEX_DEFAULT,
+    _SDDL_LEX_SLASH,
+    _SDDL_LEX_BLOCK_COMMENT,
+    _SDDL_LEX_BLOCK_COMMENT_STAR,
+    _SDDL_LEX_LINE_COMMENT,
+    _SDDL_LEX_STRING,
+    _SDDL_LEX_STRING_ESCAPE,
+    _SDDL_LEX_STRING_UNICODE,
+    _SDDL_LEX_SCALAR,
+} _SDDLLexState;
+
+typedef enum
+{
+    _SDDL_PARSE_EXPECT_DOCUMENT,
+    _SDDL_PARSE_EXPECT_KEY,
+    _SDDL_PARSE_EXPECT_COLON,
+    _SDDL_PARSE_EXPECT_VALUE,
+    _SDDL_PARSE_EXPECT_COMMA,
+    _SDDL_PARSE_SKIP_VALUE,
+    _SDDL_PARSE_EXPECT_AUTHOR,
+    _SDDL_PARSE_EXPECT_AUTHOR_COMMA,
+    _SDDL_PARSE_DONE,
+} _SDDLParseState;
+
+typedef struct
+{
+    char *chars;
+    size_t len;
+    size_t capacity;
+} _SDDLBuffer;
+
+struct SDDLParser_t
+{
+    SDDLParseResult result;
+    SDDLDocument doc;
+    SDDLVarCallback callback;
+    void *callback_userdata;
+    bool insitu;
+    bool failed;
+    bool fail_fast;
+#ifdef SDDL_PARSE_STATS
+    SDDLParseStats *stats;  // NULL unless collecting
+#endif
+
+    // lexer
+    _SDDLLexState lex_state;
+    size_t chunk_offset;    // absolute offset of the current chunk
+    unsigned line;
+    size_t line_start;      // absolute offset of the current line
+    _SDDLToken token;       // token being lexed
+    size_t string_start;    // index of the string contents in the chunk
+    bool string_copying;    // contents are being collected in <scratch>
+    char *insitu_write;     // in-situ unescape cursor
+    unsigned unicode_digits;
+    uint32_t unicode_value;
+    uint32_t high_surrogate;
+    _SDDLBuffer scratch;
+    _SDDLBuffer scalar;     // number or keyword being lexed
+
+    // grammar
+    _SDDLParseState state;
+    unsigned skip_depth;
+    unsigned depth;
+    // frames[0] is the document (NULL); deeper frames are vars being built
+    SDDLVarDecl frames[_SDDL_MAX_DEPTH];
+    // Members of the structs being built, innermost last.  A struct's own
+    // members start at member_base[] of its frame, and are moved into the
+    // arena when it closes.
+    SDDLVarDecl *members;
+    unsigned num_members;
+    unsigned members_capacity;
+    unsigned member_base[_SDDL_MAX_DEPTH];
+    _SDDLBuffer key;
+    unsigned key_line;
+    unsigned key_col;
+    size_t key_offset;
+
+    // document under construction
+    unsigned vars_capacity;
+    char **authors;
+    unsigned authors_capacity;
+};
+
+static bool _sddl_buffer_append(SDDLParser p, _SDDLBuffer *buf, const char *chars, size_t len)
+{
+    if (buf->len + len + 1 > buf->capacity)
+    {
+        size_t capacity = buf->capacity ? buf->capacity : 64;
+        char *newChars;
+        while (buf->len + len + 1 > capacity)
+        {
+            capacity *= 2;
+        }
+        newChars = _sddl_realloc_with(&p->doc->allocator, buf->chars, capacity);
+        if (!newChars)
+        {
+            return false;
+        }
+        buf->chars = newChars;
+        buf->capacity = capacity;
+        _SDDL_STATS_DO(p, p->stats->heap_allocations++; p->stats->heap_bytes += capacity);
+    }
+    memcpy(&buf->chars[buf->len], chars, len);
+    buf->len += len;
+    buf->chars[buf->len] = '\0';
+    return true;
+}
+
+/*
+ * Diagnostics
+ *
+ * Nothing is formatted while parsing: a diagnostic is a code, a position,
+ * a literal message and, where it helps, a copy of the offending text.
+ */
+
+// Dotted path of the var being parsed, in the document's arena, or "" at
+// document level.
+static const char * _sddl_diagnostic_path(SDDLParser p)
+{
+    size_t len = 0;
+    char *path;
+    char *out;
+    unsigned i;
+
+    if (p->depth < 2)
+    {
+        return "";
+    }
+    for (i = 1; i < p->depth; i++)
+    {
+        len += p->frames[i]->name_len + 1;
+    }
+    path = _sddl_arena_alloc(&p->doc->arena, len);
+    if (!path)
+    {
+        return "";
+    }
+    for (out = path, i = 1; i < p->depth; i++)
+    {
+        memcpy(out, p->frames[i]->name, p->frames[i]->name_len);
+        out += p->frames[i]->name_len;
+        *out++ = (i + 1 < p->depth) ? '.' : '\0';
+    }
+    return path;
+}
+
+// Records a diagnostic.  <message> must be a literal; <detail> (NULL for
+// none) is copied.  Returns false if the parse must stop, which errors
+// always do and, with fail_fast, warnings too.
+static bool _sddl_diagnose(SDDLParser p, bool isError, SDDLDiagnosticCodeEnum code,
+        unsigned line, unsigned col, size_t offset,
+        const char *message, const char *detail, size_t detailLen)
+{
+    SDDLDiagnostic diag;
+
+    diag.code = code;
+    diag.is_error = isError || p->fail_fast;
+    diag.offset = offset;
+    diag.line = line;
+    diag.col = col;
+    diag.message = message;
+    diag.path = "";
+    diag.detail = "";
+    if (code != SDDL_DIAGNOSTIC_OUT_OF_MEMORY)
+    {
+        diag.path = _sddl_diagnostic_path(p);
+        if (detail)
+        {
+            diag.detail = _sddl_arena_strndup(&p->doc->arena, detail, detailLen);
+            if (!diag.detail)
+            {
+                diag.detail = "";
+            }
+        }
+    }
+    if (!_sddl_parse_result_add_diagnostic(p->result, &diag))
+    {
+        // Only a warning can fail to fit; this lands in the slot kept free
+        // for the error.
+        diag.code = SDDL_DIAGNOSTIC_OUT_OF_MEMORY;
+        diag.is_error = true;
+        diag.message = "Out of memory";
+        diag.path = "";
+        diag.detail = "";
+        _sddl_parse_result_add_diagnostic(p->result, &diag);
+        p->failed = true;
+        return false;
+    }
+    if (diag.is_error)
+    {
+        p->failed = true;
+        return false;
+    }
+    return true;
+}
+
+static bool _sddl_parse_error(SDDLParser p, SDDLDiagnosticCodeEnum code, const _SDDLToken *tok, const char *message)
+{
+    return _sddl_diagnose(p, true, code, tok->line, tok->col, tok->offset, message, NULL, 0);
+}
+
+// Same as _sddl_parse_error, with the token's text as the detail.
+static bool _sddl_parse_error_text(SDDLParser p, SDDLDiagnosticCodeEnum code, const _SDDLToken *tok, const char *message)
+{
+    return _sddl_diagnose(p, true, code, tok->line, tok->col, tok->offset, message, tok->chars, tok->len);
+}
+
+static bool _sddl_key_is(SDDLParser p, const char *literal)
+{
+    return !strcmp(p->key.chars, literal);
+}
+
+// Returns a copy of a STRING token's contents that lives as long as the
+// document.
+static char * _sddl_keep_string(SDDLParser p, const _SDDLToken *tok)
+{
+    if (tok->stable)
+    {
+        return (char *)tok->chars;
+    }
+    return _sddl_arena_strndup(&p->doc->arena, tok->chars, tok->len);
+}
+
+static bool _sddl_parse_oom(SDDLParser p, const _SDDLToken *tok)
+{
+    return _sddl_parse_error(p, SDDL_DIAGNOSTIC_OUT_OF_MEMORY, tok, "Out of memory");
+}
+
+/*
+ * Grammar
+ */
+
+static bool _sddl_parse_key_decl(SDDLParser p, VarKeyInfo *info, const char **outError)
+{
+    uint64_t start = _SDDL_STATS_BEGIN(p);
+    bool ok = _parse_var_key(p->key.chars, p->key.len, info, outError);
+    _SDDL_STATS_END(p, decl_ns, start);
+    return ok;
+}
+
+// Starts a var or struct member declared by the current key, whose
+// definition object <tok> opens.
+static bool _sddl_push_var(SDDLParser p, const _SDDLToken *tok, const VarKeyInfo *info)
+{
+    SDDLVarDecl var;
+
+    if (tok->type != _SDDL_TOKEN_LBRACE)
+    {
+        return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok, "Expected object for variable metadata");
+    }
+
+    if (p->depth == _SDDL_MAX_DEPTH)
+    {
+        return _sddl_parse_error(p, SDDL_DIAGNOSTIC_TOO_DEEP, tok, "Variables nested too deeply");
+    }
+
+    var = _sddl_arena_alloc(&p->doc->arena, sizeof(struct SDDLVarDecl_t));
+    if (!var)
+    {
+        return _sddl_parse_oom(p, tok);
+    }
+    _sddl_var_set_name(var, _sddl_arena_strndup(&p->doc->arena, info->name, info->name_len));
+    if (!var->name)
+    {
+        return _sddl_parse_oom(p, tok);
+    }
+    var->in_document = true;
+    var->description = "";
+    var->units = "";
+    var->numeric_display_hint = SDDL_NUMERIC_DISPLAY_HINT_NORMAL;
+    var->datatype = info->datatype;
+    var->direction = info->direction;
+    if (info->datatype == SDDL_DATATYPE_ARRAY)
+    {
+        var->array_datatype = info->array_datatype;
+        var->array_num_elements = info->array_num_elements;
+    }
+    var->parent = p->frames[p->depth - 1];
+
+    p->member_base[p->depth] = p->num_members;
+    p->frames[p->depth++] = var;
+    p->state = _SDDL_PARSE_EXPECT_KEY;
+    _SDDL_STATS_DO(p,
+        p->stats->num_vars++;
+        p->stats->num_structs += (var->datatype == SDDL_DATATYPE_STRUCT);
+        if (p->depth - 1 > p->stats->max_depth)
+            p->stats->max_depth = p->depth - 1);
+    return true;
+}
+
+static bool _sddl_begin_var(SDDLParser p, const _SDDLToken *tok)
+{
+    VarKeyInfo info;
+    const char *error;
+
+    if (!_sddl_parse_key_decl(p, &info, &error))
+    {
+        return _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_BAD_DECLARATION, p->key_line, p->key_col, p->key_offset,
+                error, p->key.chars, p->key.len);
+    }
+    return _sddl_push_var(p, tok, &info);
+}
+
+// Moves the members of the struct in the innermost frame off the member
+// stack and into the arena.
+static bool _sddl_end_struct(SDDLParser p, SDDLVarDecl strct)
+{
+    unsigned base = p->member_base[p->depth];
+    unsigned count = p->num_members - base;
+
+    if (count > 0)
+    {
+        strct->struct_members = _sddl_arena_alloc(&p->doc->arena, count*sizeof(SDDLVarDecl));
+        if (!strct->struct_members)
+        {
+            return false;
+        }
+        memcpy(strct->struct_members, &p->members[base], count*sizeof(SDDLVarDecl));
+        strct->struct_num_members = count;
+    }
+    p->num_members = base;
+    return true;
+}
+
+// Adds a finished struct member to the member stack.
+static bool _sddl_add_member(SDDLParser p, SDDLVarDecl var)
+{
+    if (p->num_members == p->members_capacity)
+    {
+        unsigned capacity = p->members_capacity ? 2*p->members_capacity : 16;
+        uint64_t start = _SDDL_STATS_BEGIN(p);
+        SDDLVarDecl *members = _sddl_realloc_with(&p->doc->allocator, p->members, capacity*sizeof(SDDLVarDecl));
+        _SDDL_STATS_END(p, var_table_ns, start);
+        if (!members)
+        {
+            return false;
+        }
+        p->members = members;
+        p->members_capacity = capacity;
+        _SDDL_STATS_DO(p, p->stats->heap_allocations++; p->stats->heap_bytes += capacity*sizeof(SDDLVarDecl));
+    }
+    p->members[p->num_members++] = var;
+    return true;
+}
+
+// Handles the '}' closing the innermost frame.
+static bool _sddl_end_object(SDDLParser p, const _SDDLToken *tok)
+{
+    SDDLDocument doc = p->doc;
+    SDDLVarDecl var;
+
+    p->depth--;
+    if (p->depth == 0)
+    {
+        p->state = _SDDL_PARSE_DONE;
+        return true;
+    }
+
+    var = p->frames[p->depth];
+    p->state = _SDDL_PARSE_EXPECT_COMMA;
+    if (var->datatype == SDDL_DATATYPE_STRUCT && !_sddl_end_struct(p, var))
+    {
+        return _sddl_parse_oom(p, tok);
+    }
+    if (p->depth > 1)
+    {
+        return _sddl_add_member(p, var) || _sddl_parse_oom(p, tok);
+    }
+
+    if (doc->num_vars == p->vars_capacity)
+    {
+        unsigned capacity = p->vars_capacity ? 2*p->vars_capacity : 16;
+        uint64_t start = _SDDL_STATS_BEGIN(p);
+        SDDLVarDecl *vars = _sddl_realloc_with(&doc->allocator, doc->vars, capacity*sizeof(SDDLVarDecl));
+        _SDDL_STATS_END(p, var_table_ns, start);
+        if (!vars)
+        {
+            return _sddl_parse_oom(p, tok);
+        }
+        doc->vars = vars;
+        p->vars_capacity = capacity;
+        _SDDL_STATS_DO(p, p->stats->heap_allocations++; p->stats->heap_bytes += capacity*sizeof(SDDLVarDecl));
+    }
+    doc->vars[doc->num_vars++] = var;
+    if (p->callback)
+    {
+        p->callback(var, p->callback_userdata);
+    }
+    return true;
+}
+
+static void _sddl_skip_value(SDDLParser p, const _SDDLToken *tok)
+{
+    if (tok->type == _SDDL_TOKEN_LBRACE || tok->type == _SDDL_TOKEN_LBRACKET)
+    {
+        p->skip_depth = 1;
+        p->state = _SDDL_PARSE_SKIP_VALUE;
+    }
+    else
+    {
+        p->state = _SDDL_PARSE_EXPECT_COMMA;
+    }
+}
+
+static bool _sddl_parse_document_field(SDDLParser p, const _SDDLToken *tok)
+{
+    if (_sddl_key_is(p, "description"))
+    {
+        if (tok->type != _SDDL_TOKEN_STRING)
+        {
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok, "description must be string");
+        }
+        p->doc->description = _sddl_keep_string(p, tok);
+        if (!p->doc->description)
+        {
+            return _sddl_parse_oom(p, tok);
+        }
+        p->state = _SDDL_PARSE_EXPECT_COMMA;
+        return true;
+    }
+    else if (_sddl_key_is(p, "authors"))
+    {
+        if (tok->type != _SDDL_TOKEN_LBRACKET)
+        {
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok, "authors must be list of strings");
+        }
+        p->state = _SDDL_PARSE_EXPECT_AUTHOR;
+        return true;
+    }
+    return _sddl_begin_var(p, tok);
+}
+
+static bool _sddl_parse_var_field(SDDLParser p, SDDLVarDecl var, const _SDDLToken *tok)
+{
+    p->state = _SDDL_PARSE_EXPECT_COMMA;
+
+    if (_sddl_key_is(p, "datatype"))
+    {
+        if (tok->type != _SDDL_TOKEN_STRING)
+        {
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok, "datatype must be string");
+        }
+        var->datatype = _sddl_datatype_from_chars(tok->chars, tok->len);
+        if (var->datatype == SDDL_DATATYPE_INVALID)
+        {
+            return _sddl_parse_error_text(p, SDDL_DIAGNOSTIC_BAD_FIELD_VALUE, tok, "invalid datatype");
+        }
+        // Never a struct, so members already collected would be lost.
+        if (p->num_members > p->member_base[p->depth - 1])
+        {
+            return _sddl_parse_error_text(p, SDDL_DIAGNOSTIC_BAD_FIELD_VALUE, tok,
+                    "datatype conflicts with struct members");
+        }
+    }
+    else if (_sddl_key_is(p, "description"))
+    {
+        if (tok->type != _SDDL_TOKEN_STRING)
+        {
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok, "description must be string");
+        }
+        var->description = _sddl_keep_string(p, tok);
+        if (!var->description)
+        {
+            return _sddl_parse_oom(p, tok);
+        }
+    }
+    else if (_sddl_key_is(p, "max-value") || _sddl_key_is(p, "min-value"))
+    {
+        bool isMax = _sddl_key_is(p, "max-value");
+        if (tok->type != _SDDL_TOKEN_NULL && tok->type != _SDDL_TOKEN_NUMBER)
+        {
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok,
+                    isMax ? "max-value must be number or null" : "min-value must be number or null");
+        }
+        if (isMax)
+        {
+            var->has_max_value = (tok->type == _SDDL_TOKEN_NUMBER);
+            var->max_value = tok->number;
+        }
+        else
+        {
+            var->has_min_value = (tok->type == _SDDL_TOKEN_NUMBER);
+            var->min_value = tok->number;
+        }
+    }
+    else if (_sddl_key_is(p, "numeric-display-hint"))
+    {
+        if (tok->type != _SDDL_TOKEN_STRING)
+        {
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok, "numeric-display-hint must be string");
+        }
+        var->numeric_display_hint = _sddl_display_hint_from_chars(tok->chars, tok->len);
+        if (var->numeric_display_hint == SDDL_NUMERIC_DISPLAY_HINT_INVALID)
+        {
+            return _sddl_parse_error_text(p, SDDL_DIAGNOSTIC_BAD_FIELD_VALUE, tok, "invalid numeric-display-hint");
+        }
+    }
+    else if (_sddl_key_is(p, "regex"))
+    {
+        if (tok->type != _SDDL_TOKEN_STRING)
+        {
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok, "regex must be string");
+        }
+        var->regex = _sddl_keep_string(p, tok);
+        if (!var->regex)
+        {
+            return _sddl_parse_oom(p, tok);
+        }
+    }
+    else if (_sddl_key_is(p, "units"))
+    {
+        if (tok->type != _SDDL_TOKEN_STRING)
+        {
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok, "units must be string");
+        }
+        var->units = _sddl_keep_string(p, tok);
+        if (!var->units)
+        {
+            return _sddl_parse_oom(p, tok);
+        }
+    }
+    else
+    {
+        VarKeyInfo info;
+        const char *error;
+        if (var->datatype == SDDL_DATATYPE_STRUCT && _sddl_parse_key_decl(p, &info, &error))
+        {
+            return _sddl_push_var(p, tok, &info);
+        }
+        if (!_sddl_diagnose(p, false, SDDL_DIAGNOSTIC_UNEXPECTED_FIELD, p->key_line, p->key_col, p->key_offset,
+                "Unexpected field", p->key.chars, p->key.len))
+        {
+            return false;
+        }
+        _sddl_skip_value(p, tok);
+    }
+    return true;
+}
+
+static bool _sddl_add_author(SDDLParser p, const _SDDLToken *tok)
+{
+    SDDLDocument doc = p->doc;
+    char *author;
+
+    if (doc->num_authors == p->authors_capacity)
+    {
+        unsigned capacity = p->authors_capacity ? 2*p->authors_capacity : 4;
+        char **authors = _sddl_realloc_with(&doc->allocator, p->authors, capacity*sizeof(char *));
+        if (!authors)
+        {
+            return _sddl_parse_oom(p, tok);
+        }
+        p->authors = authors;
+        p->authors_capacity = capacity;
+        _SDDL_STATS_DO(p, p->stats->heap_allocations++; p->stats->heap_bytes += capacity*sizeof(char *));
+    }
+    author = _sddl_keep_string(p, tok);
+    if (!author)
+    {
+        return _sddl_parse_oom(p, tok);
+    }
+    p->authors[doc->num_authors++] = author;
+    return true;
+}
+
+static bool _sddl_parse_token(SDDLParser p, const _SDDLToken *tok)
+{
+    switch (p->state)
+    {
+        case _SDDL_PARSE_EXPECT_DOCUMENT:
+        {
+            if (tok->type != _SDDL_TOKEN_LBRACE)
+            {
+                return _sddl_parse_error(p, SDDL_DIAGNOSTIC_SYNTAX, tok, "Expected '{' at start of document");
+            }
+            p->frames[0] = NULL;
+            p->depth = 1;
+            p->state = _SDDL_PARSE_EXPECT_KEY;
+            return true;
+        }
+        case _SDDL_PARSE_EXPECT_KEY:
+        {
+            if (tok->type == _SDDL_TOKEN_RBRACE)
+            {
+                return _sddl_end_object(p, tok);
+            }
+            if (tok->type != _SDDL_TOKEN_STRING)
+            {
+                return _sddl_parse_error(p, SDDL_DIAGNOSTIC_SYNTAX, tok, "Expected string key or '}'");
+            }
+            p->key.len = 0;
+            if (!_sddl_buffer_append(p, &p->key, tok->chars, tok->len))
+            {
+                return _sddl_parse_oom(p, tok);
+            }
+            p->key_line = tok->line;
+            p->key_col = tok->col;
+            p->key_offset = tok->offset;
+            p->state = _SDDL_PARSE_EXPECT_COLON;
+            return true;
+        }
+        case _SDDL_PARSE_EXPECT_COLON:
+        {
+            if (tok->type != _SDDL_TOKEN_COLON)
+            {
+                return _sddl_parse_error(p, SDDL_DIAGNOSTIC_SYNTAX, tok, "Expected ':' after key");
+            }
+            p->state = _SDDL_PARSE_EXPECT_VALUE;
+            return true;
+        }
+        case _SDDL_PARSE_EXPECT_VALUE:
+        {
+            SDDLVarDecl var = p->frames[p->depth - 1];
+            switch (tok->type)
+            {
+                case _SDDL_TOKEN_RBRACE:
+                case _SDDL_TOKEN_RBRACKET:
+                case _SDDL_TOKEN_COLON:
+                case _SDDL_TOKEN_COMMA:
+                    return _sddl_parse_error(p, SDDL_DIAGNOSTIC_SYNTAX, tok, "Expected value");
+                default:
+                    break;
+            }
+            if (!var)
+            {
+                return _sddl_parse_document_field(p, tok);
+            }
+            return _sddl_parse_var_field(p, var, tok);
+        }
+        case _SDDL_PARSE_EXPECT_COMMA:
+        {
+            if (tok->type == _SDDL_TOKEN_COMMA)
+            {
+                // A '}' may follow, which permits trailing commas.
+                p->state = _SDDL_PARSE_EXPECT_KEY;
+                return true;
+            }
+            if (tok->type == _SDDL_TOKEN_RBRACE)
+            {
+                return _sddl_end_object(p, tok);
+            }
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_SYNTAX, tok, "Expected ',' or '}'");
+        }
+        case _SDDL_PARSE_SKIP_VALUE:
+        {
+            if (tok->type == _SDDL_TOKEN_LBRACE || tok->type == _SDDL_TOKEN_LBRACKET)
+            {
+                p->skip_depth++;
+            }
+            else if (tok->type == _SDDL_TOKEN_RBRACE || tok->type == _SDDL_TOKEN_RBRACKET)
+            {
+                p->skip_depth--;
+                if (p->skip_depth == 0)
+                {
+                    p->state = _SDDL_PARSE_EXPECT_COMMA;
+                }
+            }
+            return true;
+        }
+        case _SDDL_PARSE_EXPECT_AUTHOR:
+        {
+            if (tok->type == _SDDL_TOKEN_RBRACKET)
+            {
+                p->state = _SDDL_PARSE_EXPECT_COMMA;
+                return true;
+            }
+            if (tok->type != _SDDL_TOKEN_STRING)
+            {
+                return _sddl_parse_error(p, SDDL_DIAGNOSTIC_WRONG_TYPE, tok, "authors must be list of strings");
+            }
+            p->state = _SDDL_PARSE_EXPECT_AUTHOR_COMMA;
+            return _sddl_add_author(p, tok);
+        }
+        case _SDDL_PARSE_EXPECT_AUTHOR_COMMA:
+        {
+            if (tok->type == _SDDL_TOKEN_COMMA)
+            {
+                p->state = _SDDL_PARSE_EXPECT_AUTHOR;
+                return true;
+            }
+            if (tok->type == _SDDL_TOKEN_RBRACKET)
+            {
+                p->state = _SDDL_PARSE_EXPECT_COMMA;
+                return true;
+            }
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_SYNTAX, tok, "Expected ',' or ']'");
+        }
+        case _SDDL_PARSE_DONE:
+        default:
+        {
+            return _sddl_parse_error(p, SDDL_DIAGNOSTIC_SYNTAX, tok, "Unexpected content after document");
+        }
+    }
+}
+
+/*
+ * Lexer
+ */
+
+static void _sddl_lex_mark(SDDLParser p, size_t i)
+{
+    size_t offset = p->chunk_offset + i;
+    p->token.line = p->line;
+    p->token.col = (unsigned)(offset - p->line_start) + 1;
+    p->token.offset = offset;
+}
+
+// Hands the finished token to the grammar.
+static bool _sddl_lex_emit(SDDLParser p)
+{
+    uint64_t start = _SDDL_STATS_BEGIN(p);
+    bool ok = _sddl_parse_token(p, &p->token);
+    _SDDL_STATS_END(p, grammar_ns, start);
+    _SDDL_STATS_DO(p, p->stats->num_tokens++);
+    return ok;
+}
+
+static bool _sddl_lex_simple(SDDLParser p, _SDDLTokenType type, size_t i)
+{
+    _sddl_lex_mark(p, i);
+    p->token.type = type;
+    return _sddl_lex_emit(p);
+}
+
+// Appends one byte of decoded string contents.
+static bool _sddl_lex_string_put(SDDLParser p, const char *chars, size_t len)
+{
+    if (p->insitu)
+    {
+        memcpy(p->insitu_write, chars, len);
+        p->insitu_write += len;
+        return true;
+    }
+    if (!_sddl_buffer_append(p, &p->scratch, chars, len))
+    {
+        return _sddl_parse_oom(p, &p->token);
+    }
+    return true;
+}
+
+static bool _sddl_lex_put_codepoint(SDDLParser p, uint32_t cp)
+{
+    char utf8[4];
+    size_t len;
+    if (cp < 0x80)
+    {
+        utf8[0] = (char)cp;
+        len = 1;
+    }
+    else if (cp < 0x800)
+    {
+        utf8[0] = (char)(0xC0 | (cp >> 6));
+        utf8[1] = (char)(0x80 | (cp & 0x3F));
+        len = 2;
+    }
+    else if (cp < 0x10000)
+    {
+        utf8[0] = (char)(0xE0 | (cp >> 12));
+        utf8[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (cp & 0x3F));
+        len = 3;
+    }
+    else
+    {
+        utf8[0] = (char)(0xF0 | (cp >> 18));
+        utf8[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (cp & 0x3F));
+        len = 4;
+    }
+    return _sddl_lex_string_put(p, utf8, len);
+}
+
+// Emits U+FFFD for a high surrogate that was not followed by a low one.
+static bool _sddl_lex_flush_surrogate(SDDLParser p)
+{
+    if (p->high_surrogate)
+    {
+        p->high_surrogate = 0;
+        return _sddl_lex_put_codepoint(p, 0xFFFD);
+    }
+    return true;
+}
+
+static bool _sddl_lex_unicode(SDDLParser p)
+{
+    uint32_t cp = p->unicode_value;
+    if (cp >= 0xD800 && cp < 0xDC00)
+    {
+        if (!_sddl_lex_flush_surrogate(p))
+        {
+            return false;
+        }
+        p->high_surrogate = cp;
+        return true;
+    }
+    if (cp >= 0xDC00 && cp < 0xE000 && p->high_surrogate)
+    {
+        cp = 0x10000 + ((p->high_surrogate - 0xD800) << 10) + (cp - 0xDC00);
+        p->high_surrogate = 0;
+        return _sddl_lex_put_codepoint(p, cp);
+    }
+    if (!_sddl_lex_flush_surrogate(p))
+    {
+        return false;
+    }
+    return _sddl_lex_put_codepoint(p, cp);
+}
+
+static bool _sddl_lex_end_string(SDDLParser p, char *buf, size_t end)
+{
+    if (!_sddl_lex_flush_surrogate(p))
+    {
+        return false;
+    }
+    p->token.type = _SDDL_TOKEN_STRING;
+    if (p->insitu)
+    {
+        p->token.chars = &buf[p->string_start];
+        p->token.len = p->insitu_write - &buf[p->string_start];
+        *p->insitu_write = '\0';
+        p->token.stable = true;
+    }
+    else if (p->string_copying)
+    {
+        p->token.chars = p->scratch.chars;
+        p->token.len = p->scratch.len;
+        p->token.stable = false;
+    }
+    else
+    {
+        p->token.chars = &buf[p->string_start];
+        p->token.len = end - p->string_start;
+        p->token.stable = false;
+    }
+    return _sddl_lex_emit(p);
+}
+
+// True if <s> follows the JSON number grammar, which strtod alone doesn't
+// enforce (it also takes hex, "inf", "nan", "1." and the like).
+static bool _sddl_is_json_number(const char *s)
+{
+    if (*s == '-')
+    {
+        s++;
+    }
+    if (*s == '0')
+    {
+        s++;
+    }
+    else if (isdigit((unsigned char)*s))
+    {
+        while (isdigit((unsigned char)*s))
+            s++;
+    }
+    else
+    {
+        return false;
+    }
+    if (*s == '.')
+    {
+        s++;
+        if (!isdigit((unsigned char)*s))
+        {
+            return false;
+        }
+        while (isdigit((unsigned char)*s))
+            s++;
+    }
+    if (*s == 'e' || *s == 'E')
+    {
+        s++;
+        if (*s == '+' || *s == '-')
+        {
+            s++;
+        }
+        if (!isdigit((unsigned char)*s))
+        {
+            return false;
+        }
+        while (isdigit((unsigned char)*s))
+            s++;
+    }
+    return *s == '\0';
+}
+
+static bool _sddl_lex_end_scalar(SDDLParser p)
+{
+    const char *s = p->scalar.chars;
+
+    if (!strcmp(s, "true"))
+    {
+        p->token.type = _SDDL_TOKEN_TRUE;
+    }
+    else if (!strcmp(s, "false"))
+    {
+        p->token.type = _SDDL_TOKEN_FALSE;
+    }
+    else if (!strcmp(s, "null"))
+    {
+        p->token.type = _SDDL_TOKEN_NULL;
+    }
+    else
+    {
+        const char *point = localeconv()->decimal_point;
+        char *dot;
+        if (s[0] != '-' && !isdigit((unsigned char)s[0]))
+        {
+            return _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_BAD_LITERAL, p->token.line, p->token.col, p->token.offset,
+                    "Invalid value", s, p->scalar.len);
+        }
+        if (!_sddl_is_json_number(s))
+        {
+            return _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_BAD_LITERAL, p->token.line, p->token.col, p->token.offset,
+                    "Invalid number", s, p->scalar.len);
+        }
+        // strtod expects the locale's decimal point.
+        dot = strchr(p->scalar.chars, '.');
+        if (dot && point[0] != '.' && point[0] != '\0' && point[1] == '\0')
+        {
+            *dot = point[0];
+        }
+        p->token.number = strtod(s, NULL);
+        if (isinf(p->token.number))
+        {
+            if (dot)
+            {
+                *dot = '.';
+            }
+            return _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_BAD_LITERAL, p->token.line, p->token.col, p->token.offset,
+                    "Number out of range", s, p->scalar.len);
+        }
+        p->token.type = _SDDL_TOKEN_NUMBER;
+    }
+    return _sddl_lex_emit(p);
+}
+
+static bool _sddl_is_scalar_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '-' || c == '+' || c == '.';
+}
+
+static void _sddl_lex_newline(SDDLParser p, size_t i)
+{
+    p->line++;
+    p->line_start = p->chunk_offset + i + 1;
+}
+
+// Consumes <len> bytes of <buf>.  <buf> is only written to in in-situ mode.
+static bool _sddl_lex(SDDLParser p, char *buf, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len && !p->failed)
+    {
+        char c = buf[i];
+        switch (p->lex_state)
+        {
+            case _SDDL_LEX_DEFAULT:
+            {
+                switch (c)
+                {
+                    case '\n':
+                        _sddl_lex_newline(p, i);
+                        i++;
+                        break;
+                    case ' ':
+                    case '\t':
+                    case '\r':
+                        i++;
+                        break;
+                    case '{':
+                        _sddl_lex_simple(p, _SDDL_TOKEN_LBRACE, i++);
+                        break;
+                    case '}':
+                        _sddl_lex_simple(p, _SDDL_TOKEN_RBRACE, i++);
+                        break;
+                    case '[':
+                        _sddl_lex_simple(p, _SDDL_TOKEN_LBRACKET, i++);
+                        break;
+                    case ']':
+                        _sddl_lex_simple(p, _SDDL_TOKEN_RBRACKET, i++);
+                        break;
+                    case ':':
+                        _sddl_lex_simple(p, _SDDL_TOKEN_COLON, i++);
+                        break;
+                    case ',':
+                        _sddl_lex_simple(p, _SDDL_TOKEN_COMMA, i++);
+                        break;
+                    case '/':
+                        p->lex_state = _SDDL_LEX_SLASH;
+                        i++;
+                        break;
+                    case '"':
+                        _sddl_lex_mark(p, i);
+                        i++;
+                        p->lex_state = _SDDL_LEX_STRING;
+                        p->string_start = i;
+                        p->string_copying = false;
+                        p->scratch.len = 0;
+                        p->insitu_write = &buf[i];
+                        break;
+                    default:
+                        if (!_sddl_is_scalar_char(c))
+                        {
+                            _sddl_lex_mark(p, i);
+                            return _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_SYNTAX, p->token.line, p->token.col,
+                                    p->token.offset, "Unexpected character", &c, 1);
+                        }
+                        _sddl_lex_mark(p, i);
+                        p->lex_state = _SDDL_LEX_SCALAR;
+                        p->scalar.len = 0;
+                        break;
+                }
+                break;
+            }
+            case _SDDL_LEX_SLASH:
+            {
+                if (c == '*')
+                {
+                    p->lex_state = _SDDL_LEX_BLOCK_COMMENT;
+                }
+                else if (c == '/')
+                {
+                    p->lex_state = _SDDL_LEX_LINE_COMMENT;
+                }
+                else
+                {
+                    _sddl_lex_mark(p, i);
+                    return _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_SYNTAX, p->token.line, p->token.col, p->token.offset,
+                            "Unexpected character", "/", 1);
+                }
+                i++;
+                break;
+            }
+            case _SDDL_LEX_BLOCK_COMMENT:
+            {
+                while (i < len && buf[i] != '*')
+                {
+                    if (buf[i] == '\n')
+                    {
+                        _sddl_lex_newline(p, i);
+                    }
+                    i++;
+                }
+                if (i < len)
+                {
+                    p->lex_state = _SDDL_LEX_BLOCK_COMMENT_STAR;
+                    i++;
+                }
+                break;
+            }
+            case _SDDL_LEX_BLOCK_COMMENT_STAR:
+            {
+                if (c == '/')
+                {
+                    p->lex_state = _SDDL_LEX_DEFAULT;
+                }
+                else if (c != '*')
+                {
+                    if (c == '\n')
+                    {
+                        _sddl_lex_newline(p, i);
+                    }
+                    p->lex_state = _SDDL_LEX_BLOCK_COMMENT;
+                }
+                i++;
+                break;
+            }
+            case _SDDL_LEX_LINE_COMMENT:
+            {
+                while (i < len && buf[i] != '\n')
+                {
+                    i++;
+                }
+                if (i < len)
+                {
+                    // let DEFAULT account for the newline
+                    p->lex_state = _SDDL_LEX_DEFAULT;
+                }
+                break;
+            }
+            case _SDDL_LEX_STRING:
+            {
+                size_t j = i;
+                while (j < len && buf[j] != '"' && buf[j] != '\\')
+                {
+                    if (buf[j] == '\n')
+                    {
+                        _sddl_lex_newline(p, j);
+                    }
+                    j++;
+                }
+
+                // bytes [i, j) are literal contents
+                if (p->insitu)
+                {
+                    if (p->insitu_write != &buf[i])
+                    {
+                        memmove(p->insitu_write, &buf[i], j - i);
+                    }
+                    p->insitu_write += j - i;
+                }
+                else if (p->string_copying)
+                {
+                    if (!_sddl_lex_string_put(p, &buf[i], j - i))
+                    {
+                        return false;
+                    }
+                }
+                i = j;
+                if (i == len)
+                {
+                    break;
+                }
+
+                if (buf[i] == '"')
+                {
+                    p->lex_state = _SDDL_LEX_DEFAULT;
+                    if (!_sddl_lex_end_string(p, buf, i))
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    if (!p->insitu && !p->string_copying)
+                    {
+                        // first escape: switch to building the contents in
+                        // the scratch buffer
+                        p->string_copying = true;
+                        if (!_sddl_lex_string_put(p, &buf[p->string_start], i - p->string_start))
+                        {
+                            return false;
+                        }
+                    }
+                    p->lex_state = _SDDL_LEX_STRING_ESCAPE;
+                }
+                i++;
+                break;
+            }
+            case _SDDL_LEX_STRING_ESCAPE:
+            {
+                char out;
+                p->lex_state = _SDDL_LEX_STRING;
+                switch (c)
+                {
+                    case '"':
+                    case '\\':
+                    case '/':
+                        out = c;
+                        break;
+                    case 'b':
+                        out = '\b';
+                        break;
+                    case 'f':
+                        out = '\f';
+                        break;
+                    case 'n':
+                        out = '\n';
+                        break;
+                    case 'r':
+                        out = '\r';
+                        break;
+                    case 't':
+                        out = '\t';
+                        break;
+                    case 'u':
+                        p->lex_state = _SDDL_LEX_STRING_UNICODE;
+                        p->unicode_digits = 0;
+                        p->unicode_value = 0;
+                        i++;
+                        continue;
+                    default:
+                        _sddl_lex_mark(p, i);
+                        return _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_BAD_LITERAL, p->token.line, p->token.col, p->token.offset,
+                                "Invalid escape", &c, 1);
+                }
+                if (!_sddl_lex_flush_surrogate(p) || !_sddl_lex_string_put(p, &out, 1))
+                {
+                    return false;
+                }
+                i++;
+                break;
+            }
+            case _SDDL_LEX_STRING_UNICODE:
+            {
+                if (!isxdigit((unsigned char)c))
+                {
+                    _sddl_lex_mark(p, i);
+                    return _sddl_parse_error(p, SDDL_DIAGNOSTIC_BAD_LITERAL, &p->token, "Invalid \\u escape");
+                }
+                p->unicode_value = (p->unicode_value << 4) |
+                    (uint32_t)(isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10));
+                p->unicode_digits++;
+                i++;
+                if (p->unicode_digits == 4)
+                {
+                    p->lex_state = _SDDL_LEX_STRING;
+                    if (!_sddl_lex_unicode(p))
+                    {
+                        return false;
+                    }
+                }
+                break;
+            }
+            case _SDDL_LEX_SCALAR:
+            {
+                size_t start = i;
+                while (i < len && _sddl_is_scalar_char(buf[i]))
+                {
+                    i++;
+                }
+                if (!_sddl_buffer_append(p, &p->scalar, &buf[start], i - start))
+                {
+                    return _sddl_parse_oom(p, &p->token);
+                }
+                if (i < len)
+                {
+                    // reprocess buf[i] in DEFAULT
+                    p->lex_state = _SDDL_LEX_DEFAULT;
+                    if (!_sddl_lex_end_scalar(p))
+                    {
+                        return false;
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    if (p->failed)
+    {
+        return false;
+    }
+
+    if (p->lex_state == _SDDL_LEX_STRING && !p->insitu && !p->string_copying)
+    {
+        // String continues in the next chunk, so this one's bytes must be
+        // saved before the caller reuses the buffer.
+        p->string_copying = true;
+        if (!_sddl_lex_string_put(p, &buf[p->string_start], len - p->string_start))
+        {
+            return false;
+        }
+    }
+    p->chunk_offset += len;
+    return true;
+}
+
+/*
+ * Driver
+ */
+
+static void _sddl_parser_init(SDDLParser p, SDDLParseResult result, bool insitu, const SDDLParseOptions *options)
+{
+    memset(p, 0, sizeof(*p));
+    p->result = result;
+    p->doc = result->doc;
+    p->insitu = insitu;
+    p->line = 1;
+    p->doc->description = "";
+    if (options)
+    {
+        p->fail_fast = options->fail_fast;
+        result->max_diagnostics = options->max_diagnostics;
+    }
+#ifdef SDDL_PARSE_STATS
+    if (options && options->collect_stats)
+    {
+        result->has_stats = true;
+        p->stats = &result->stats;
+    }
+#endif
+}
+
+// Lexes one chunk.  While collecting stats, <lex_ns> counts all of the time
+// spent here until _sddl_parser_finish takes out the grammar's share.
+static bool _sddl_parser_lex(SDDLParser p, char *buf, size_t len)
+{
+    uint64_t start = _SDDL_STATS_BEGIN(p);
+    bool ok = _sddl_lex(p, buf, len);
+    _SDDL_STATS_END(p, lex_ns, start);
+    _SDDL_STATS_DO(p, p->stats->input_bytes += len);
+    return ok;
+}
+
+#ifdef SDDL_PARSE_STATS
+// Turns the inclusive timings into exclusive ones and adds the arena's
+// allocations.
+static void _sddl_parser_finish_stats(SDDLParseStats *stats, const SDDLArenaStats *arena)
+{
+    uint64_t nested = stats->decl_ns + stats->var_table_ns;
+    stats->lex_ns -= (stats->grammar_ns < stats->lex_ns) ? stats->grammar_ns : stats->lex_ns;
+    stats->grammar_ns -= (nested < stats->grammar_ns) ? nested : stats->grammar_ns;
+    stats->total_ns = stats->lex_ns + stats->grammar_ns + stats->decl_ns
+            + stats->var_table_ns + stats->finish_ns;
+    stats->heap_allocations += arena->num_blocks;
+    stats->heap_bytes += arena->bytes_reserved;
+    stats->arena_allocations = arena->num_allocations;
+    stats->arena_bytes = arena->bytes_used;
+}
+#endif
+
+// Flushes the lexer, checks that the document was complete, and hands the
+// parse result back.  Always releases the parser's own buffers.
+static SDDLParseResult _sddl_parser_finish(SDDLParser p)
+{
+    SDDLParseResult result = p->result;
+    SDDLDocument doc = p->doc;
+    uint64_t start = _SDDL_STATS_BEGIN(p);
+
+    if (!p->failed)
+    {
+        switch (p->lex_state)
+        {
+            case _SDDL_LEX_SCALAR:
+                p->lex_state = _SDDL_LEX_DEFAULT;
+                _sddl_lex_end_scalar(p);
+                break;
+            case _SDDL_LEX_STRING:
+            case _SDDL_LEX_STRING_ESCAPE:
+            case _SDDL_LEX_STRING_UNICODE:
+                _sddl_parse_error(p, SDDL_DIAGNOSTIC_UNTERMINATED, &p->token, "Unterminated string");
+                break;
+            case _SDDL_LEX_BLOCK_COMMENT:
+            case _SDDL_LEX_BLOCK_COMMENT_STAR:
+            case _SDDL_LEX_SLASH:
+                _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_UNTERMINATED, p->line, 1, p->line_start,
+                        "Unterminated comment", NULL, 0);
+                break;
+            default:
+                break;
+        }
+    }
+    if (!p->failed && p->state != _SDDL_PARSE_DONE)
+    {
+        _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_UNTERMINATED, p->line, (unsigned)(p->chunk_offset - p->line_start) + 1,
+                p->chunk_offset, "Unexpected end of document", NULL, 0);
+    }
+
+    if (doc->num_authors)
+    {
+        doc->authors = _sddl_arena_alloc(&doc->arena, doc->num_authors*sizeof(char *));
+        if (doc->authors)
+        {
+            memcpy(doc->authors, p->authors, doc->num_authors*sizeof(char *));
+        }
+        else
+        {
+            doc->num_authors = 0;
+            _sddl_diagnose(p, true, SDDL_DIAGNOSTIC_OUT_OF_MEMORY, p->line, 1, p->line_start, "Out of memory", NULL, 0);
+        }
+    }
+
+    if (!p->failed)
+    {
+        // Without indexes, lookups fall back to linear scans.
+        result->ok = _sddl_document_finalize(doc)
+                || _sddl_diagnose(p, false, SDDL_DIAGNOSTIC_OUT_OF_MEMORY, p->line, 1, p->line_start,
+                        "Out of memory building name indexes", NULL, 0);
+    }
+
+    _sddl_free_with(&doc->allocator, p->scratch.chars);
+    _sddl_free_with(&doc->allocator, p->scalar.chars);
+    _sddl_free_with(&doc->allocator, p->key.chars);
+    _sddl_free_with(&doc->allocator, p->authors);
+    _sddl_free_with(&doc->allocator, p->members);
+
+    _SDDL_STATS_END(p, finish_ns, start);
+    _SDDL_STATS_DO(p, _sddl_parser_finish_stats(p->stats, &doc->arena.stats));
+    return result;
+}
+
+// Parses <len> bytes at <sddl>.  With <insitu> the buffer must be writable,
+// NUL-terminated, and owned by the document (through <source>) for as long
+// as it lives.  If <source> is non-NULL the document takes ownership of it
+// even if parsing fails; it must come from the options' allocator.
+static SDDLParseResult _sddl_parse(char *sddl, size_t len, bool insitu, char *source,
+        const SDDLParseOptions *options)
+{
+    SDDLParseResult result;
+    struct SDDLParser_t parser;
+
+    // Parsed structures take up about twice the room of the source text.
+    // Small documents still need room for a handful of var decls.
+    result = _sddl_new_parse_result(4096 + 2*len, options ? options->allocator : NULL);
+    if (!result)
+    {
+        _sddl_free_with((options && options->allocator) ? options->allocator : _sddl_global_allocator(), source);
+        return NULL;
+    }
+    result->doc->source = source;
+    result->doc->source_len = source ? len + 1 : 0;
+
+    _sddl_parser_init(&parser, result, insitu, options);
+    _sddl_parser_lex(&parser, sddl, len);
+    return _sddl_parser_finish(&parser);
+}
+
+SDDLParser sddl_parser_new(SDDLVarCallback callback, void *userdata)
+{
+    return sddl_parser_new_with_options(callback, userdata, NULL);
+}
+
+SDDLParser sddl_parser_new_with_options(SDDLVarCallback callback, void *userdata, const SDDLParseOptions *options)
+{
+    const SDDLAllocator *allocator = (options && options->allocator) ? options->allocator : _sddl_global_allocator();
+    SDDLParser p;
+    SDDLParseResult result;
+
+    p = _sddl_malloc_with(allocator, sizeof(struct SDDLParser_t));
+    if (!p)
+    {
+        return NULL;
+    }
+    result = _sddl_new_parse_result(16*1024, allocator);
+    if (!result)
+    {
+        _sddl_free_with(allocator, p);
+        return NULL;
+    }
+    _sddl_parser_init(p, result, false, options);
+    p->callback = callback;
+    p->callback_userdata = userdata;
+    return p;
+}
+
+bool sddl_parser_feed(SDDLParser parser, const char *buf, size_t len)
+{
+    if (parser->failed)
+    {
+        return false;
+    }
+    // Never written to outside of in-situ mode.
+    return _sddl_parser_lex(parser, (char *)buf, len);
+}
+
+SDDLParseResult sddl_parser_finish(SDDLParser parser)
+{
+    SDDLParseResult result = _sddl_parser_finish(parser);
+    // The parser came from the document's allocator.
+    _sddl_free_with(&result->doc->allocator, parser);
+    return result;
+}
+
+SDDLParseResult sddl_parse(const char *sddl)
+{
+    return sddl_parse_with_options(sddl, NULL);
+}
+
+SDDLParseResult sddl_parse_with_options(const char *sddl, const SDDLParseOptions *options)
+{
+    // Never written to outside of in-situ mode.
+    return _sddl_parse((char *)sddl, strlen(sddl), false, NULL, options);
+}
+
+// Reads the regular file behind <file> into a NUL-terminated buffer from
+// <allocator>, so it can be parsed in situ.  The document keeps the buffer
+// rather than the file: a file mapping would tie the document's strings to
+// the file, and rewriting or truncating the file would change them or
+// fault.  Returns NULL for empty and non-regular files, and on error.
+static char * _sddl_read_file(FILE *file, const SDDLAllocator *allocator, size_t *outLen)
+{
+    struct stat st;
+    char *buf;
+    size_t len;
+
+    if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        return NULL;
+    }
+    buf = _sddl_malloc_with(allocator, (size_t)st.st_size + 1);
+    if (!buf)
+    {
+        return NULL;
+    }
+    // The file may shrink while being read; parse what was there.
+    len = fread(buf, 1, st.st_size, file);
+    if (ferror(file))
+    {
+        _sddl_free_with(allocator, buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    *outLen = len;
+    return buf;
+}
+
+static SDDLParseResult _sddl_load_and_parse_file(FILE *file, const SDDLParseOptions *options)
+{
+    const SDDLAllocator *allocator = (options && options->allocator) ? options->allocator : _sddl_global_allocator();
+    char *source;
+    size_t sourceLen;
+    char buffer[16*1024];
+    size_t readsize;
+    SDDLParser parser;
+
+    source = _sddl_read_file(file, allocator, &sourceLen);
+    if (source)
+    {
+        // The document takes ownership of the buffer, and its strings
+        // point into it.
+        return _sddl_parse(source, sourceLen, true, source, options);
+    }
+
+    // Pipes, sockets and the like: stream the file through the parser
+    // rather than seeking to find its size.
+    parser = sddl_parser_new_with_options(NULL, NULL, options);
+    if (!parser)
+    {
+        return NULL;
+    }
+    while ((readsize = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        if (!sddl_parser_feed(parser, buffer, readsize))
+        {
+            break;
+        }
+    }
+    if (ferror(file))
+    {
+        sddl_free_parse_result(sddl_parser_finish(parser));
+        return NULL;
+    }
+    return sddl_parser_finish(parser);
+}
+
+SDDLParseResult sddl_load_and_parse(const char *filename)
+{
+    return sddl_load_and_parse_with_options(filename, NULL);
+}
+
+SDDLParseResult sddl_load_and_parse_with_options(const char *filename, const SDDLParseOptions *options)
+{
+    FILE *fp;
+    SDDLParseResult out;
+    fp = fopen(filename, "r");
+    if (!fp)
+    {
+        return NULL;
+    }
+    out = _sddl_load_and_parse_file(fp, options);
+    fclose(fp);
+    return out;
+}
+
+SDDLParseResult sddl_load_and_parse_file(FILE *file)
+{
+    return _sddl_load_and_parse_file(file, NULL);
+}
@@ -0,0 +1,143 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Var queries over the flat var table.
+ *
+ * Each query term picks one or more rows of the document's precomputed
+ * bitsets (see _SDDL_*_ROW): the rows of one term are ORed together, and
+ * the terms ANDed.  The result keeps its bitset, for membership tests, and
+ * the flat indexes of its set bits.
+ */
+#include "sddl_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct SDDLVarSet_t
+{
+    SDDLDocument doc;
+    unsigned num_words;
+    uint64_t *bits;
+    unsigned count;
+    unsigned *indexes;
+};
+
+// ANDs <bits> with the union of the rows starting at <firstRow> selected
+// by <mask>.  A zero mask selects everything.
+static void _sddl_query_term(SDDLDocument doc, uint64_t *bits, unsigned firstRow, unsigned numRows, unsigned mask)
+{
+    unsigned w;
+    if (mask == 0)
+    {
+        return;
+    }
+    for (w = 0; w < doc->flat_words; w++)
+    {
+        uint64_t term = 0;
+        unsigned row;
+        for (row = 0; row < numRows; row++)
+        {
+            if (mask & (1u << row))
+            {
+                term |= doc->flat_bits[(firstRow + row)*doc->flat_words + w];
+            }
+        }
+        bits[w] &= term;
+    }
+}
+
+SDDLVarSet sddl_document_query_vars(SDDLDocument doc, const SDDLVarQuery *query)
+{
+    SDDLVarSet set;
+    unsigned w;
+
+    set = _sddl_calloc(1, sizeof(struct SDDLVarSet_t));
+    if (!set)
+    {
+        return NULL;
+    }
+    set->doc = sddl_ref_document(doc);
+    if (!doc->flat_bits)
+    {
+        // flat table missing (OOM during finalize): nothing matches
+        return set;
+    }
+
+    set->num_words = doc->flat_words;
+    set->bits = _sddl_malloc((set->num_words + 1)*sizeof(uint64_t));
+    if (!set->bits)
+    {
+        goto fail;
+    }
+    memset(set->bits, 0xff, set->num_words*sizeof(uint64_t));
+    if (doc->num_flat_vars % 64)
+    {
+        set->bits[set->num_words - 1] = ((uint64_t)1 << (doc->num_flat_vars % 64)) - 1;
+    }
+    _sddl_query_term(doc, set->bits, _SDDL_DIRECTION_ROW(0), _SDDL_NUM_DIRECTIONS, query->directions);
+    _sddl_query_term(doc, set->bits, _SDDL_DATATYPE_ROW(0), _SDDL_NUM_DATATYPES, query->datatypes);
+    _sddl_query_term(doc, set->bits, _SDDL_LEAF_ROW, 1, query->leaves_only);
+
+    for (w = 0; w < set->num_words; w++)
+    {
+        set->count += __builtin_popcountll(set->bits[w]);
+    }
+    set->indexes = _sddl_malloc((set->count + 1)*sizeof(unsigned));
+    if (!set->indexes)
+    {
+        goto fail;
+    }
+    set->count = 0;
+    for (w = 0; w < set->num_words; w++)
+    {
+        uint64_t word = set->bits[w];
+        while (word)
+        {
+            set->indexes[set->count++] = w*64 + __builtin_ctzll(word);
+            word &= word - 1;
+        }
+    }
+    return set;
+
+fail:
+    sddl_var_set_free(set);
+    return NULL;
+}
+
+void sddl_var_set_free(SDDLVarSet set)
+{
+    if (set)
+    {
+        sddl_unref_document(set->doc);
+        _sddl_free(set->bits);
+        _sddl_free(set->indexes);
+        _sddl_free(set);
+    }
+}
+
+unsigned sddl_var_set_count(SDDLVarSet set)
+{
+    return set->count;
+}
+
+const unsigned * sddl_var_set_indexes(SDDLVarSet set)
+{
+    return set->indexes;
+}
+
+bool sddl_var_set_contains(SDDLVarSet set, unsigned flatIndex)
+{
+    return flatIndex/64 < set->num_words
+        && (set->bits[flatIndex/64] & ((uint64_t)1 << (flatIndex % 64))) != 0;
+}
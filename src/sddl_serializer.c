@@ -0,0 +1,320 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Document serializer.
+ *
+ * Writes canonical SDDL text straight from the document's structures: no
+ * JSON objects, no declaration strings, no allocation.  Canonical means:
+ *
+ *  - 4-space indentation, one field per line, no trailing commas
+ *  - document fields: "description", then "authors", then the vars
+ *  - var fields: "description", "min-value", "max-value",
+ *    "numeric-display-hint", "regex", "units", then struct members as
+ *    nested declarations, the same shape sddl_var_json produces
+ *  - fields holding their default value (empty strings, unset limits, the
+ *    "normal" display hint) are left out
+ *  - numbers are printed with enough digits to read back exactly
+ *
+ * Output goes either straight into the caller's buffer, or through a small
+ * stack buffer that is flushed to a callback whenever it fills.
+ */
+#include "sddl_internal.h"
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _SDDL_WRITER_CHUNK_SIZE 4096
+
+typedef struct
+{
+    // Buffer mode: <buf> is the caller's and <len> counts every byte,
+    // including those that didn't fit.
+    char *buf;
+    size_t cap;
+    size_t len;
+    // Callback mode: bytes collect in <chunk> until it fills.
+    SDDLWriteCallback callback;
+    void *userdata;
+    bool failed;
+    char chunk[_SDDL_WRITER_CHUNK_SIZE];
+} _SDDLWriter;
+
+static void _sddl_writer_flush(_SDDLWriter *w)
+{
+    if (w->len && !w->failed && !w->callback(w->chunk, w->len, w->userdata))
+    {
+        w->failed = true;
+    }
+    w->len = 0;
+}
+
+static void _sddl_write(_SDDLWriter *w, const char *chars, size_t len)
+{
+    if (!w->callback)
+    {
+        if (w->len < w->cap)
+        {
+            size_t room = w->cap - w->len;
+            memcpy(&w->buf[w->len], chars, (len < room) ? len : room);
+        }
+        w->len += len;
+        return;
+    }
+    while (len > 0 && !w->failed)
+    {
+        size_t room = sizeof(w->chunk) - w->len;
+        size_t n = (len < room) ? len : room;
+        memcpy(&w->chunk[w->len], chars, n);
+        w->len += n;
+        chars += n;
+        len -= n;
+        if (w->len == sizeof(w->chunk))
+        {
+            _sddl_writer_flush(w);
+        }
+    }
+}
+
+static void _sddl_write_str(_SDDLWriter *w, const char *s)
+{
+    _sddl_write(w, s, strlen(s));
+}
+
+static void _sddl_write_indent(_SDDLWriter *w, unsigned depth)
+{
+    static const char spaces[] = "                                ";
+    unsigned n = depth*4;
+    while (n > 0)
+    {
+        unsigned chunk = (n < sizeof(spaces) - 1) ? n : sizeof(spaces) - 1;
+        _sddl_write(w, spaces, chunk);
+        n -= chunk;
+    }
+}
+
+// Writes <len> bytes of <s> as a quoted JSON string.  Runs of characters
+// needing no escape are written in one go.
+static void _sddl_write_quoted(_SDDLWriter *w, const char *s, size_t len)
+{
+    size_t start = 0;
+    size_t i;
+
+    _sddl_write(w, "\"", 1);
+    for (i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)s[i];
+        char escape[8];
+        size_t escapeLen = 2;
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+        escape[0] = '\\';
+        switch (c)
+        {
+            case '"':  escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                escapeLen = snprintf(escape, sizeof(escape), "\\u%04x", c);
+                break;
+        }
+        _sddl_write(w, &s[start], i - start);
+        _sddl_write(w, escape, escapeLen);
+        start = i + 1;
+    }
+    _sddl_write(w, &s[start], len - start);
+    _sddl_write(w, "\"", 1);
+}
+
+// Starts a field: separator from the previous one, newline and indent,
+// then the quoted key and colon.
+static void _sddl_write_key(_SDDLWriter *w, unsigned depth, bool *first, const char *key)
+{
+    _sddl_write(w, *first ? "\n" : ",\n", *first ? 1 : 2);
+    *first = false;
+    _sddl_write_indent(w, depth);
+    _sddl_write_quoted(w, key, strlen(key));
+    _sddl_write(w, " : ", 3);
+}
+
+static void _sddl_write_string_field(_SDDLWriter *w, unsigned depth, bool *first, const char *key, const char *value)
+{
+    if (value && value[0])
+    {
+        _sddl_write_key(w, depth, first, key);
+        _sddl_write_quoted(w, value, strlen(value));
+    }
+}
+
+static void _sddl_write_number_field(_SDDLWriter *w, unsigned depth, bool *first, const char *key, double value)
+{
+    char number[32];
+    char decimal;
+    char *point;
+    int len;
+    // JSON has no infinities or NaNs.  The parser never produces them, so
+    // only a doctored image could; leave the limit out.
+    if (!isfinite(value))
+    {
+        return;
+    }
+    // Shortest of the two precisions that reads back exactly.
+    len = snprintf(number, sizeof(number), "%.15g", value);
+    if (strtod(number, NULL) != value)
+    {
+        len = snprintf(number, sizeof(number), "%.17g", value);
+    }
+    // printf used the locale's decimal point; JSON wants '.'.
+    decimal = localeconv()->decimal_point[0];
+    if (decimal && decimal != '.' && (point = strchr(number, decimal)))
+    {
+        *point = '.';
+    }
+    _sddl_write_key(w, depth, first, key);
+    _sddl_write(w, number, len);
+}
+
+// Writes the declaration key, e.g. "out float32[16] samples", without
+// building it as a string first.
+static void _sddl_write_decl(_SDDLWriter *w, SDDLVarDecl var)
+{
+    char count[16];
+    _sddl_write(w, "\"", 1);
+    if (var->direction != SDDL_DIRECTION_INHERIT)
+    {
+        _sddl_write_str(w, sddl_direction_string(var->direction));
+        _sddl_write(w, " ", 1);
+    }
+    if (var->datatype == SDDL_DATATYPE_ARRAY)
+    {
+        _sddl_write_str(w, sddl_datatype_string(var->array_datatype));
+        _sddl_write(w, count, snprintf(count, sizeof(count), "[%u]", var->array_num_elements));
+    }
+    else
+    {
+        _sddl_write_str(w, sddl_datatype_string(var->datatype));
+    }
+    _sddl_write(w, " ", 1);
+    // Names are plain identifiers, so need no escaping.
+    _sddl_write(w, var->name, var->name_len);
+    _sddl_write(w, "\"", 1);
+}
+
+static void _sddl_write_vars(_SDDLWriter *w, unsigned depth, bool *first, SDDLVarDecl *vars, unsigned count)
+{
+    unsigned i;
+    for (i = 0; i < count && !w->failed; i++)
+    {
+        SDDLVarDecl var = vars[i];
+        bool firstField = true;
+
+        _sddl_write(w, *first ? "\n" : ",\n", *first ? 1 : 2);
+        *first = false;
+        _sddl_write_indent(w, depth);
+        _sddl_write_decl(w, var);
+        _sddl_write(w, " : {", 4);
+
+        _sddl_write_string_field(w, depth + 1, &firstField, "description", var->description);
+        if (var->has_min_value)
+        {
+            _sddl_write_number_field(w, depth + 1, &firstField, "min-value", var->min_value);
+        }
+        if (var->has_max_value)
+        {
+            _sddl_write_number_field(w, depth + 1, &firstField, "max-value", var->max_value);
+        }
+        if (var->numeric_display_hint != SDDL_NUMERIC_DISPLAY_HINT_NORMAL
+                && var->numeric_display_hint != SDDL_NUMERIC_DISPLAY_HINT_INVALID)
+        {
+            const char *hint = _sddl_display_hint_to_string(var->numeric_display_hint);
+            _sddl_write_key(w, depth + 1, &firstField, "numeric-display-hint");
+            _sddl_write_quoted(w, hint, strlen(hint));
+        }
+        _sddl_write_string_field(w, depth + 1, &firstField, "regex", var->regex);
+        _sddl_write_string_field(w, depth + 1, &firstField, "units", var->units);
+        _sddl_write_vars(w, depth + 1, &firstField, var->struct_members, var->struct_num_members);
+
+        if (!firstField)
+        {
+            _sddl_write(w, "\n", 1);
+            _sddl_write_indent(w, depth);
+        }
+        _sddl_write(w, "}", 1);
+    }
+}
+
+static void _sddl_write_document(_SDDLWriter *w, SDDLDocument doc)
+{
+    bool first = true;
+    unsigned i;
+
+    _sddl_write(w, "{", 1);
+    _sddl_write_string_field(w, 1, &first, "description", doc->description);
+    if (doc->num_authors > 0)
+    {
+        _sddl_write_key(w, 1, &first, "authors");
+        _sddl_write(w, "[", 1);
+        for (i = 0; i < doc->num_authors; i++)
+        {
+            _sddl_write(w, i ? ",\n" : "\n", i ? 2 : 1);
+            _sddl_write_indent(w, 2);
+            _sddl_write_quoted(w, doc->authors[i], strlen(doc->authors[i]));
+        }
+        _sddl_write(w, "\n", 1);
+        _sddl_write_indent(w, 1);
+        _sddl_write(w, "]", 1);
+    }
+    _sddl_write_vars(w, 1, &first, doc->vars, doc->num_vars);
+    _sddl_write(w, first ? "}\n" : "\n}\n", first ? 2 : 3);
+}
+
+size_t sddl_document_serialize(SDDLDocument doc, char *buf, size_t cap)
+{
+    _SDDLWriter w;
+    w.buf = buf;
+    w.cap = cap;
+    w.len = 0;
+    w.callback = NULL;
+    w.failed = false;
+
+    _sddl_write_document(&w, doc);
+    if (cap > 0)
+    {
+        buf[(w.len < cap) ? w.len : cap - 1] = '\0';
+    }
+    return w.len;
+}
+
+bool sddl_document_serialize_to(SDDLDocument doc, SDDLWriteCallback callback, void *userdata)
+{
+    _SDDLWriter w;
+    w.buf = NULL;
+    w.cap = 0;
+    w.len = 0;
+    w.callback = callback;
+    w.userdata = userdata;
+    w.failed = false;
+
+    _sddl_write_document(&w, doc);
+    _sddl_writer_flush(&w);
+    return !w.failed;
+}
@@ -0,0 +1,252 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Compiled value validation.
+ *
+ * sddl_validator_new walks every var and struct member of a document once
+ * and keeps a flat check for each one that declares min-value, max-value or
+ * regex.  Regexes are compiled up front, and vars sharing a pattern share
+ * one compiled regex.  Checks are found by hashing the var pointer, so
+ * validating a value is a probe plus a comparison (or a regexec), with no
+ * allocation.
+ */
+#include "sddl_internal.h"
+#include <math.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    SDDLVarDecl var;
+    bool has_range;
+    double min_value;   // -INFINITY when unset
+    double max_value;   // INFINITY when unset
+    regex_t *regex;     // NULL when unset
+} _SDDLCheck;
+
+struct SDDLValidator_t
+{
+    unsigned num_checks;
+    _SDDLCheck *checks;
+    _SDDLPtrIndex check_index;  // var -> position in checks
+    unsigned num_regexes;
+    regex_t *regexes;
+    bool *regex_compiled;
+};
+
+static const _SDDLCheck * _sddl_validator_find(SDDLValidator validator, SDDLVarDecl var)
+{
+    int pos = _sddl_ptr_index_lookup(&validator->check_index, var);
+    return (pos < 0) ? NULL : &validator->checks[pos];
+}
+
+static uint32_t _sddl_pattern_key(const void *items, unsigned pos, const char **outName, size_t *outLen)
+{
+    const char *pattern = ((const char * const *)items)[pos];
+    *outName = pattern;
+    *outLen = strlen(pattern);
+    return sddl_name_hash(pattern, *outLen);
+}
+
+SDDLValidator sddl_validator_new(SDDLDocument doc, SDDLVarDecl *outBadVar)
+{
+    SDDLValidator validator;
+    const char **patterns = NULL;
+    _SDDLNameIndex patternIndex = {0};
+    unsigned regexNum = 0;
+    unsigned i;
+
+    if (outBadVar)
+    {
+        *outBadVar = NULL;
+    }
+    validator = _sddl_calloc(1, sizeof(struct SDDLValidator_t));
+    if (!validator)
+    {
+        return NULL;
+    }
+
+    // The path table lists every var and struct member exactly once.
+    validator->checks = _sddl_calloc(doc->num_paths + 1, sizeof(_SDDLCheck));
+    patterns = _sddl_calloc(doc->num_paths + 1, sizeof(char *));
+    if (!validator->checks || !patterns)
+    {
+        goto fail;
+    }
+    for (i = 0; i < doc->num_paths; i++)
+    {
+        SDDLVarDecl var = doc->paths[i].var;
+        bool hasRegex = (var->regex && var->regex[0]);
+        _SDDLCheck *check;
+        if (!var->has_min_value && !var->has_max_value && !hasRegex)
+        {
+            continue;
+        }
+        check = &validator->checks[validator->num_checks];
+        check->var = var;
+        check->has_range = var->has_min_value || var->has_max_value;
+        check->min_value = var->has_min_value ? var->min_value : -INFINITY;
+        check->max_value = var->has_max_value ? var->max_value : INFINITY;
+        if (hasRegex)
+        {
+            // Remember which pattern; compiled below.
+            patterns[validator->num_regexes++] = var->regex;
+        }
+        validator->num_checks++;
+    }
+
+    // Compile each distinct pattern once.
+    validator->regexes = _sddl_calloc(validator->num_regexes + 1, sizeof(regex_t));
+    validator->regex_compiled = _sddl_calloc(validator->num_regexes + 1, sizeof(bool));
+    if (!validator->regexes || !validator->regex_compiled
+            || !_sddl_name_index_build(&patternIndex, NULL, _sddl_pattern_key, patterns, validator->num_regexes))
+    {
+        goto fail;
+    }
+    for (i = 0; i < validator->num_checks; i++)
+    {
+        _SDDLCheck *check = &validator->checks[i];
+        const char *pattern;
+        int first;
+        if (!check->var->regex || !check->var->regex[0])
+        {
+            continue;
+        }
+        pattern = patterns[regexNum];
+        first = _sddl_name_index_lookup(&patternIndex, _sddl_pattern_key, patterns, validator->num_regexes,
+                pattern, strlen(pattern), sddl_name_hash(pattern, strlen(pattern)));
+        if (first == (int)regexNum)
+        {
+            if (regcomp(&validator->regexes[first], pattern, REG_EXTENDED | REG_NOSUB) != 0)
+            {
+                if (outBadVar)
+                {
+                    *outBadVar = check->var;
+                }
+                goto fail;
+            }
+            validator->regex_compiled[first] = true;
+        }
+        check->regex = &validator->regexes[first];
+        regexNum++;
+    }
+    _sddl_name_index_free(&patternIndex);
+    _sddl_free(patterns);
+    patterns = NULL;
+
+    if (!_sddl_ptr_index_init(&validator->check_index, validator->num_checks))
+    {
+        goto fail;
+    }
+    for (i = 0; i < validator->num_checks; i++)
+    {
+        _sddl_ptr_index_insert(&validator->check_index, validator->checks[i].var, i);
+    }
+    return validator;
+
+fail:
+    _sddl_name_index_free(&patternIndex);
+    _sddl_free(patterns);
+    sddl_validator_free(validator);
+    return NULL;
+}
+
+void sddl_validator_free(SDDLValidator validator)
+{
+    unsigned i;
+    if (!validator)
+    {
+        return;
+    }
+    for (i = 0; i < validator->num_regexes; i++)
+    {
+        if (validator->regex_compiled && validator->regex_compiled[i])
+        {
+            regfree(&validator->regexes[i]);
+        }
+    }
+    _sddl_free(validator->regexes);
+    _sddl_free(validator->regex_compiled);
+    _sddl_ptr_index_free(&validator->check_index);
+    _sddl_free(validator->checks);
+    _sddl_free(validator);
+}
+
+static bool _sddl_check_number(const _SDDLCheck *check, double value)
+{
+    if (!check->has_range)
+    {
+        return true;
+    }
+    return value >= check->min_value && value <= check->max_value;
+}
+
+static bool _sddl_check_string(const _SDDLCheck *check, const char *value)
+{
+    if (!check->regex)
+    {
+        return true;
+    }
+    return regexec(check->regex, value, 0, NULL, 0) == 0;
+}
+
+bool sddl_validator_check_number(SDDLValidator validator, SDDLVarDecl var, double value)
+{
+    const _SDDLCheck *check = _sddl_validator_find(validator, var);
+    return !check || _sddl_check_number(check, value);
+}
+
+bool sddl_validator_check_string(SDDLValidator validator, SDDLVarDecl var, const char *value)
+{
+    const _SDDLCheck *check = _sddl_validator_find(validator, var);
+    return !check || _sddl_check_string(check, value);
+}
+
+size_t sddl_validator_check_numbers(SDDLValidator validator, SDDLVarDecl var, const double *values, size_t count)
+{
+    const _SDDLCheck *check = _sddl_validator_find(validator, var);
+    size_t i;
+    if (!check || !check->has_range)
+    {
+        return count;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (!(values[i] >= check->min_value && values[i] <= check->max_value))
+        {
+            return i;
+        }
+    }
+    return count;
+}
+
+size_t sddl_validator_check_strings(SDDLValidator validator, SDDLVarDecl var, const char * const *values, size_t count)
+{
+    const _SDDLCheck *check = _sddl_validator_find(validator, var);
+    size_t i;
+    if (!check || !check->regex)
+    {
+        return count;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (!_sddl_check_string(check, values[i]))
+        {
+            return i;
+        }
+    }
+    return count;
+}
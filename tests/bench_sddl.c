@@ -0,0 +1,583 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Benchmark suite.
+ *
+ * Generates a synthetic schema and measures:
+ *
+ *  - parse time and throughput, with the heap and arena allocations made
+ *    by one parse
+ *  - name lookup and dotted-path lookup latency
+ *  - serialization time and throughput
+ *  - peak RSS of the whole run
+ *  - optionally, parsing through the RedJson-based pipeline sddl_parse
+ *    replaced (a generic JSON tree, then a walk over it), for comparison
+ *  - optionally, parsing into a bump pool through SDDLParseOptions, to
+ *    compare against the C library allocator
+ *
+ * Results are printed, and with -o appended to a file as one JSON object
+ * per line, so runs can be compared over time.
+ *
+ * Usage: bench_sddl [-n NUM_VARS] [-i ITERATIONS] [-d STRUCT_DEPTH]
+ *                   [-f STRUCT_FANOUT] [-l DESCRIPTION_LEN] [-a ARRAY_SIZE]
+ *                   [-j] [-P] [-o RESULTS_FILE]
+ */
+#include <sddl.h>
+#include <red_json.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Allocation counting.  Defining malloc and friends in the executable
+ * interposes them for libsddl as well; they forward to glibc's allocator.
+ * The benchmark is single-threaded, so a plain counter will do.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static size_t _num_allocations;
+
+void *malloc(size_t size)
+{
+    _num_allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    _num_allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    _num_allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+typedef struct
+{
+    unsigned num_vars;          // top-level vars
+    unsigned iterations;
+    unsigned struct_depth;      // levels of nesting in generated structs
+    unsigned struct_fanout;     // members per struct
+    unsigned description_len;
+    unsigned array_size;
+    bool json_tree;
+    bool pool;
+    const char *results_file;
+} BenchParams;
+
+/*
+ * Bump pool for -P: allocations are carved out of one region, each behind
+ * a header holding its size, and the whole pool is released at once after
+ * each parse, as a per-tenant pool would be.
+ */
+#define POOL_HEADER_SIZE 16
+
+typedef struct
+{
+    char *base;
+    size_t cap;
+    size_t used;
+    size_t peak;
+} Pool;
+
+static void * pool_malloc(size_t size, void *userdata)
+{
+    Pool *pool = userdata;
+    size_t need = (POOL_HEADER_SIZE + size + 15) & ~(size_t)15;
+    char *block;
+    if (pool->used + need > pool->cap)
+    {
+        return NULL;
+    }
+    block = &pool->base[pool->used];
+    *(size_t *)block = size;
+    pool->used += need;
+    if (pool->used > pool->peak)
+    {
+        pool->peak = pool->used;
+    }
+    return block + POOL_HEADER_SIZE;
+}
+
+static void * pool_realloc(void *ptr, size_t size, void *userdata)
+{
+    size_t oldSize;
+    void *out;
+    if (!ptr)
+    {
+        return pool_malloc(size, userdata);
+    }
+    oldSize = *(size_t *)((char *)ptr - POOL_HEADER_SIZE);
+    if (size <= oldSize)
+    {
+        return ptr;
+    }
+    out = pool_malloc(size, userdata);
+    if (out)
+    {
+        memcpy(out, ptr, oldSize);
+    }
+    return out;
+}
+
+static void pool_free(void *ptr, void *userdata)
+{
+    (void)ptr;
+    (void)userdata;
+}
+
+typedef struct
+{
+    char *chars;
+    size_t len;
+    size_t cap;
+} TextBuf;
+
+static void text_appendf(TextBuf *buf, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (buf->len + n + 1 > buf->cap)
+    {
+        buf->cap = 2*(buf->len + n + 1);
+        buf->chars = realloc(buf->chars, buf->cap);
+    }
+    va_start(ap, fmt);
+    vsnprintf(&buf->chars[buf->len], n + 1, fmt, ap);
+    va_end(ap);
+    buf->len += n;
+}
+
+static const char *_datatypes[] = {
+    "bool", "int8", "uint8", "int16", "uint16", "int32", "uint32",
+    "float32", "float64", "string", "datetime"
+};
+#define NUM_DATATYPES (sizeof(_datatypes)/sizeof(_datatypes[0]))
+
+static void generate_description(TextBuf *buf, unsigned len, unsigned seed)
+{
+    static const char words[] = "lorem ipsum dolor sit amet consectetur adipiscing elit ";
+    unsigned i;
+    text_appendf(buf, "\"description\" : \"Variable %u\\t", seed);
+    for (i = 0; i < len; i++)
+    {
+        text_appendf(buf, "%c", words[(seed + i) % (sizeof(words) - 1)]);
+    }
+    text_appendf(buf, "\"");
+}
+
+static void indent(TextBuf *buf, unsigned depth)
+{
+    text_appendf(buf, "%*s", depth*4, "");
+}
+
+// Struct members are nested declarations, as sddl_var_json produces them.
+static void generate_struct_members(TextBuf *buf, const BenchParams *params, unsigned level, unsigned depth)
+{
+    unsigned j;
+    for (j = 0; j < params->struct_fanout; j++)
+    {
+        text_appendf(buf, ",\n");
+        indent(buf, depth);
+        if (level + 1 < params->struct_depth)
+        {
+            text_appendf(buf, "\"struct m%u\" : {\n", j);
+            indent(buf, depth + 1);
+            text_appendf(buf, "\"description\" : \"level %u\"", level + 1);
+            generate_struct_members(buf, params, level + 1, depth + 1);
+        }
+        else
+        {
+            text_appendf(buf, "\"%s m%u\" : {\n", _datatypes[j % NUM_DATATYPES], j);
+            indent(buf, depth + 1);
+            text_appendf(buf, "\"units\" : \"m/s\"");
+        }
+        text_appendf(buf, "\n");
+        indent(buf, depth);
+        text_appendf(buf, "}");
+    }
+}
+
+// Every 16th var is a struct nested <struct_depth> levels deep, every 16th
+// (offset by 8) a large array, the rest are basic vars with metadata.
+static char * generate_sddl(const BenchParams *params, size_t *outLen)
+{
+    TextBuf buf = {NULL, 0, 0};
+    unsigned i;
+
+    text_appendf(&buf,
+            "/* generated by bench_sddl */\n"
+            "{\n"
+            "    \"description\" : \"synthetic benchmark schema\",\n"
+            "    \"authors\" : [\"bench\"]");
+    for (i = 0; i < params->num_vars; i++)
+    {
+        text_appendf(&buf, ",\n    /* variable %u */\n", i);
+        if (i % 16 == 15 && params->struct_depth > 0)
+        {
+            text_appendf(&buf, "    \"out struct s%u\" : {\n        ", i);
+            generate_description(&buf, params->description_len, i);
+            generate_struct_members(&buf, params, 0, 2);
+        }
+        else if (i % 16 == 7)
+        {
+            text_appendf(&buf, "    \"in float32[%u] a%u\" : {\n        ", params->array_size, i);
+            generate_description(&buf, params->description_len, i);
+            text_appendf(&buf, ",\n        \"min-value\" : -1.5,\n        \"max-value\" : 1.5");
+        }
+        else
+        {
+            text_appendf(&buf, "    \"%s %s v%u\" : {\n        ",
+                    (i % 3 == 0) ? "out" : "in", _datatypes[i % NUM_DATATYPES], i);
+            generate_description(&buf, params->description_len, i);
+            text_appendf(&buf,
+                    ",\n        \"min-value\" : -%u.5,\n"
+                    "        \"max-value\" : %u,\n"
+                    "        \"units\" : \"m/s\"", i, i*10);
+        }
+        text_appendf(&buf, "\n    }");
+    }
+    text_appendf(&buf, "\n}\n");
+    *outLen = buf.len;
+    return buf.chars;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// The previous pipeline: a full JSON tree, then a second pass over it.
+static unsigned parse_via_json_tree(const char *text)
+{
+    RedJsonObject root;
+    char **keys;
+    unsigned numKeys;
+    unsigned numVars = 0;
+    unsigned i;
+
+    root = RedJson_Parse(text);
+    if (!root)
+    {
+        return 0;
+    }
+    numKeys = RedJsonObject_NumItems(root);
+    keys = RedJsonObject_NewKeysArray(root);
+    for (i = 0; i < numKeys; i++)
+    {
+        RedJsonValue val = RedJsonObject_Get(root, keys[i]);
+        SDDLDirectionEnum direction;
+        SDDLDatatypeEnum datatype;
+        SDDLDatatypeEnum arrayDatatype;
+        size_t arraySize;
+        char *name;
+        RedJsonObject def;
+        char **fields;
+        unsigned numFields;
+        unsigned j;
+
+        if (!RedJsonValue_IsObject(val))
+        {
+            continue;
+        }
+        if (sddl_parse_decl(keys[i], &direction, &datatype, &name, &arrayDatatype, &arraySize) != SDDL_SUCCESS)
+        {
+            continue;
+        }
+        free(name);
+
+        def = RedJsonValue_GetObject(val);
+        numFields = RedJsonObject_NumItems(def);
+        fields = RedJsonObject_NewKeysArray(def);
+        for (j = 0; j < numFields; j++)
+        {
+            RedJsonValue field = RedJsonObject_Get(def, fields[j]);
+            if (RedJsonValue_IsString(field))
+            {
+                (void)RedJsonValue_GetString(field);
+            }
+            else if (RedJsonValue_IsNumber(field))
+            {
+                (void)RedJsonValue_GetNumber(field);
+            }
+        }
+        numVars++;
+    }
+    RedJsonObject_Free(root);
+    return numVars;
+}
+
+typedef struct
+{
+    char **paths;
+    unsigned num_paths;
+    unsigned cap;
+} PathList;
+
+// Collects the dotted path of every var and struct member in <doc>.
+static void collect_paths(PathList *list, const char *prefix, SDDLVarDecl var)
+{
+    char *path;
+    unsigned i;
+
+    path = malloc((prefix ? strlen(prefix) + 1 : 0) + strlen(sddl_var_name(var)) + 1);
+    sprintf(path, "%s%s%s", prefix ? prefix : "", prefix ? "." : "", sddl_var_name(var));
+    if (list->num_paths == list->cap)
+    {
+        list->cap = list->cap ? 2*list->cap : 1024;
+        list->paths = realloc(list->paths, list->cap*sizeof(char *));
+    }
+    list->paths[list->num_paths++] = path;
+    for (i = 0; i < sddl_var_struct_num_members(var); i++)
+    {
+        collect_paths(list, path, sddl_var_struct_member_by_idx(var, i));
+    }
+}
+
+// Average latency, in ns, of looking up <count> <keys> in a scattered
+// order, <rounds> times over.
+static double time_lookups(SDDLDocument doc, char **keys, unsigned count, bool byPath, unsigned *outMisses)
+{
+    unsigned rounds = 1 + 1000000/count;
+    unsigned misses = 0;
+    double start = now_seconds();
+    unsigned r, i;
+
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            const char *key = keys[(size_t)i*7919 % count];
+            SDDLVarDecl var = byPath ? sddl_document_var_by_path(doc, key) : sddl_document_var_by_name(doc, key);
+            misses += (var == NULL);
+        }
+    }
+    *outMisses = misses;
+    return (now_seconds() - start)/((double)rounds*count)*1e9;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: bench_sddl [-n NUM_VARS] [-i ITERATIONS] [-d STRUCT_DEPTH]\n"
+            "                  [-f STRUCT_FANOUT] [-l DESCRIPTION_LEN] [-a ARRAY_SIZE]\n"
+            "                  [-j] [-P] [-o RESULTS_FILE]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchParams params = {10000, 10, 3, 4, 64, 4096, false, NULL};
+    SDDLParseResult result;
+    SDDLDocument doc;
+    SDDLArenaStats arena;
+    PathList paths = {NULL, 0, 0};
+    char **names;
+    char *text;
+    char *out;
+    size_t textLen, outLen;
+    size_t parseAllocations;
+    unsigned numVars, nameMisses, pathMisses;
+    double start, parse, tree = 0, pooled = 0, serialize, nameLookup, pathLookup;
+    Pool pool = {NULL, 0, 0, 0};
+    struct rusage usage_;
+    unsigned i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:i:d:f:l:a:jPo:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': params.num_vars = atoi(optarg); break;
+            case 'i': params.iterations = atoi(optarg); break;
+            case 'd': params.struct_depth = atoi(optarg); break;
+            case 'f': params.struct_fanout = atoi(optarg); break;
+            case 'l': params.description_len = atoi(optarg); break;
+            case 'a': params.array_size = atoi(optarg); break;
+            case 'j': params.json_tree = true; break;
+            case 'P': params.pool = true; break;
+            case 'o': params.results_file = optarg; break;
+            default: usage();
+        }
+    }
+    if (params.num_vars == 0 || params.iterations == 0)
+    {
+        usage();
+    }
+    text = generate_sddl(&params, &textLen);
+
+    // Parsing
+    start = now_seconds();
+    for (i = 0; i < params.iterations; i++)
+    {
+        result = sddl_parse(text);
+        if (!sddl_parse_result_ok(result) || sddl_document_num_vars(sddl_parse_result_document(result)) != params.num_vars)
+        {
+            fprintf(stderr, "parse failed\n");
+            return 1;
+        }
+        sddl_free_parse_result(result);
+    }
+    parse = (now_seconds() - start)/params.iterations;
+
+    // One more parse, counted, whose document the remaining measurements use.
+    parseAllocations = _num_allocations;
+    result = sddl_parse(text);
+    parseAllocations = _num_allocations - parseAllocations;
+    doc = sddl_parse_result_ref_document(result);
+    sddl_free_parse_result(result);
+    sddl_document_arena_stats(doc, &arena);
+
+    if (params.pool)
+    {
+        SDDLAllocator allocator = {pool_malloc, pool_realloc, pool_free, &pool};
+        SDDLParseOptions options = {0};
+
+        options.allocator = &allocator;
+        pool.cap = 8*textLen + (1 << 20);
+        pool.base = malloc(pool.cap);
+        start = now_seconds();
+        for (i = 0; i < params.iterations; i++)
+        {
+            result = sddl_parse_with_options(text, &options);
+            if (!sddl_parse_result_ok(result))
+            {
+                fprintf(stderr, "pool parse failed\n");
+                return 1;
+            }
+            sddl_free_parse_result(result);
+            pool.used = 0;
+        }
+        pooled = (now_seconds() - start)/params.iterations;
+        free(pool.base);
+    }
+
+    if (params.json_tree)
+    {
+        start = now_seconds();
+        for (i = 0; i < params.iterations; i++)
+        {
+            if (parse_via_json_tree(text) != params.num_vars)
+            {
+                fprintf(stderr, "JSON tree parse failed\n");
+                return 1;
+            }
+        }
+        tree = (now_seconds() - start)/params.iterations;
+    }
+
+    // Lookups
+    numVars = sddl_document_num_vars(doc);
+    names = malloc(numVars*sizeof(char *));
+    for (i = 0; i < numVars; i++)
+    {
+        names[i] = (char *)sddl_var_name(sddl_document_var_by_idx(doc, i));
+        collect_paths(&paths, NULL, sddl_document_var_by_idx(doc, i));
+    }
+    nameLookup = time_lookups(doc, names, numVars, false, &nameMisses);
+    pathLookup = time_lookups(doc, paths.paths, paths.num_paths, true, &pathMisses);
+    if (nameMisses || pathMisses)
+    {
+        fprintf(stderr, "lookups failed\n");
+        return 1;
+    }
+
+    // Serialization
+    outLen = sddl_document_serialize(doc, NULL, 0);
+    out = malloc(outLen + 1);
+    start = now_seconds();
+    for (i = 0; i < params.iterations; i++)
+    {
+        sddl_document_serialize(doc, out, outLen + 1);
+    }
+    serialize = (now_seconds() - start)/params.iterations;
+
+    getrusage(RUSAGE_SELF, &usage_);
+
+    printf("%u vars (%u paths), %zu bytes, %u iterations\n", params.num_vars, paths.num_paths, textLen, params.iterations);
+    printf("  parse:          %10.3f ms  %8.1f MB/s\n", parse*1e3, textLen/parse/1e6);
+    printf("    heap allocs:  %10zu\n", parseAllocations);
+    printf("    arena allocs: %10zu in %zu blocks, %zu bytes\n", arena.num_allocations, arena.num_blocks, arena.bytes_reserved);
+    if (params.pool)
+    {
+        printf("  parse (pool):   %10.3f ms  %8.1f MB/s  (%zu bytes peak)\n", pooled*1e3, textLen/pooled/1e6, pool.peak);
+    }
+    if (params.json_tree)
+    {
+        printf("  JSON tree:      %10.3f ms  %8.1f MB/s  (%.2fx slower)\n", tree*1e3, textLen/tree/1e6, tree/parse);
+    }
+    printf("  name lookup:    %10.1f ns\n", nameLookup);
+    printf("  path lookup:    %10.1f ns\n", pathLookup);
+    printf("  serialize:      %10.3f ms  %8.1f MB/s  (%zu bytes)\n", serialize*1e3, outLen/serialize/1e6, outLen);
+    printf("  peak RSS:       %10ld KiB\n", usage_.ru_maxrss);
+
+    if (params.results_file)
+    {
+        FILE *fp = fopen(params.results_file, "a");
+        if (!fp)
+        {
+            perror(params.results_file);
+            return 1;
+        }
+        fprintf(fp,
+                "{\"timestamp\": %ld, \"num_vars\": %u, \"num_paths\": %u, \"struct_depth\": %u, "
+                "\"struct_fanout\": %u, \"description_len\": %u, \"array_size\": %u, \"iterations\": %u, "
+                "\"text_bytes\": %zu, \"parse_ms\": %.4f, \"parse_mb_per_s\": %.2f, "
+                "\"parse_heap_allocations\": %zu, \"arena_allocations\": %zu, \"arena_bytes\": %zu, ",
+                (long)time(NULL), params.num_vars, paths.num_paths, params.struct_depth,
+                params.struct_fanout, params.description_len, params.array_size, params.iterations,
+                textLen, parse*1e3, textLen/parse/1e6,
+                parseAllocations, arena.num_allocations, arena.bytes_reserved);
+        if (params.pool)
+        {
+            fprintf(fp, "\"parse_pool_ms\": %.4f, \"pool_peak_bytes\": %zu, ", pooled*1e3, pool.peak);
+        }
+        if (params.json_tree)
+        {
+            fprintf(fp, "\"json_tree_ms\": %.4f, ", tree*1e3);
+        }
+        fprintf(fp,
+                "\"name_lookup_ns\": %.2f, \"path_lookup_ns\": %.2f, "
+                "\"serialize_ms\": %.4f, \"serialize_mb_per_s\": %.2f, \"peak_rss_kib\": %ld}\n",
+                nameLookup, pathLookup, serialize*1e3, outLen/serialize/1e6, usage_.ru_maxrss);
+        fclose(fp);
+    }
+
+    for (i = 0; i < paths.num_paths; i++)
+    {
+        free(paths.paths[i]);
+    }
+    free(paths.paths);
+    free(names);
+    free(out);
+    free(text);
+    sddl_unref_document(doc);
+    return 0;
+}
@@ -0,0 +1,214 @@
+// Copyright 2014 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Multithreaded stress test for frozen documents and live schemas.
+ *
+ * A frozen document is shared by a pool of threads that each take their
+ * own reference, hammer every lookup and accessor, and drop the reference.
+ * The main thread drops its reference as soon as the workers are started,
+ * so whichever thread finishes last frees the document.  A second phase
+ * has the workers read through a live schema while the main thread keeps
+ * replacing its document.  Build it with -fsanitize=thread to check for
+ * races.
+ *
+ * Usage: stress_sddl [NUM_THREADS [ITERATIONS]]
+ */
+#include <sddl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_VARS 256
+
+typedef struct
+{
+    SDDLDocument doc;       // shared frozen document, or
+    SDDLLiveSchema live;    // live schema swapped under the workers
+    unsigned id;
+    unsigned iterations;
+    unsigned failures;
+} Worker;
+
+static char * generate_sddl(void)
+{
+    size_t cap = 256 + NUM_VARS*256;
+    char *out = malloc(cap);
+    size_t len = 0;
+    unsigned i;
+
+    len += snprintf(&out[len], cap - len, "{\n    \"description\" : \"stress\",\n");
+    for (i = 0; i < NUM_VARS; i++)
+    {
+        len += snprintf(&out[len], cap - len,
+                "    \"%s float32 v%u\" : {\n"
+                "        \"min-value\" : -%u,\n"
+                "        \"units\" : \"m/s\"\n"
+                "    }%s\n",
+                (i % 2) ? "in" : "out", i, i, (i + 1 < NUM_VARS) ? "," : "");
+    }
+    snprintf(&out[len], cap - len, "}\n");
+    return out;
+}
+
+static unsigned check_document(SDDLDocument doc, unsigned seed)
+{
+    unsigned failures = 0;
+    unsigned i = seed % NUM_VARS;
+    char name[32];
+    SDDLVarDecl var;
+
+    snprintf(name, sizeof(name), "v%u", i);
+    var = sddl_document_var_by_name(doc, name);
+    if (!var)
+    {
+        return 1;
+    }
+    failures += (var != sddl_document_var_by_idx(doc, i));
+    failures += (var != sddl_document_var_by_path(doc, name));
+    failures += (strcmp(sddl_var_name(var), name) != 0);
+    failures += (strcmp(sddl_var_units(var), "m/s") != 0);
+    failures += (strcmp(sddl_document_description(doc), "stress") != 0);
+    failures += (sddl_var_datatype(var) != SDDL_DATATYPE_FLOAT32);
+    failures += (sddl_var_concrete_direction(var) != ((i % 2) ? SDDL_DIRECTION_IN : SDDL_DIRECTION_OUT));
+    failures += (!sddl_var_min_value(var) || *sddl_var_min_value(var) != -(double)i);
+    failures += (sddl_var_max_value(var) != NULL);
+    failures += (sddl_var_struct_member_by_name(var, "x") != NULL);
+    failures += (sddl_var_extra(var) != NULL);
+    failures += (sddl_document_var_by_name(doc, "missing") != NULL);
+    failures += (sddl_document_var_by_path(doc, "v0.missing") != NULL);
+    return failures;
+}
+
+static void * worker_main(void *arg)
+{
+    Worker *w = arg;
+    unsigned i;
+    for (i = 0; i < w->iterations; i++)
+    {
+        if (w->live)
+        {
+            SDDLDocument doc = sddl_live_schema_acquire(w->live);
+            w->failures += check_document(doc, i*7 + w->id);
+            sddl_unref_document(doc);
+        }
+        else
+        {
+            w->failures += check_document(w->doc, i*7 + w->id);
+        }
+    }
+    if (w->doc)
+    {
+        sddl_unref_document(w->doc);
+    }
+    return NULL;
+}
+
+static SDDLDocument parse_document(void)
+{
+    char *text = generate_sddl();
+    SDDLParseResult result = sddl_parse(text);
+    SDDLDocument doc = NULL;
+    free(text);
+    if (sddl_parse_result_ok(result))
+    {
+        doc = sddl_parse_result_ref_document(result);
+    }
+    sddl_free_parse_result(result);
+    return doc;
+}
+
+static unsigned join_workers(pthread_t *threads, Worker *workers, unsigned numThreads)
+{
+    unsigned failures = 0;
+    unsigned i;
+    for (i = 0; i < numThreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        failures += workers[i].failures;
+    }
+    return failures;
+}
+
+int main(int argc, const char *argv[])
+{
+    unsigned numThreads = (argc > 1) ? (unsigned)atoi(argv[1]) : 8;
+    unsigned iterations = (argc > 2) ? (unsigned)atoi(argv[2]) : 100000;
+    pthread_t *threads;
+    Worker *workers;
+    SDDLDocument doc;
+    SDDLDocument docs[2];
+    SDDLLiveSchema live;
+    unsigned failures = 0;
+    unsigned swaps;
+    unsigned i;
+
+    doc = parse_document();
+    if (!doc)
+    {
+        fprintf(stderr, "parse failed\n");
+        return 1;
+    }
+
+    sddl_document_freeze(doc);
+    sddl_var_set_extra(sddl_document_var_by_idx(doc, 0), &failures);
+    if (!sddl_document_is_frozen(doc) || sddl_var_extra(sddl_document_var_by_idx(doc, 0)) != NULL)
+    {
+        fprintf(stderr, "document not frozen\n");
+        return 1;
+    }
+
+    // Phase 1: one frozen document shared by every worker.
+    threads = calloc(numThreads, sizeof(pthread_t));
+    workers = calloc(numThreads, sizeof(Worker));
+    for (i = 0; i < numThreads; i++)
+    {
+        workers[i].doc = sddl_ref_document(doc);
+        workers[i].id = i;
+        workers[i].iterations = iterations;
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+    // The workers' references keep the document alive from here on.
+    sddl_unref_document(doc);
+    failures += join_workers(threads, workers, numThreads);
+    printf("shared: %u threads x %u iterations: %u failures\n", numThreads, iterations, failures);
+
+    // Phase 2: workers read a live schema while this thread keeps swapping
+    // in fresh documents.
+    docs[0] = parse_document();
+    docs[1] = parse_document();
+    live = sddl_live_schema_new(docs[0]);
+    memset(workers, 0, numThreads*sizeof(Worker));
+    for (i = 0; i < numThreads; i++)
+    {
+        workers[i].live = live;
+        workers[i].id = i;
+        workers[i].iterations = iterations;
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+    for (swaps = 0; swaps < 1000; swaps++)
+    {
+        sddl_live_schema_replace(live, docs[swaps % 2]);
+    }
+    failures += join_workers(threads, workers, numThreads);
+    sddl_live_schema_free(live);
+    sddl_unref_document(docs[0]);
+    sddl_unref_document(docs[1]);
+    printf("live: %u threads x %u iterations, %u swaps: %u failures\n", numThreads, iterations, swaps, failures);
+
+    free(threads);
+    free(workers);
+    return failures ? 1 : 0;
+}
@@ -14,6 +14,11 @@
 
 #include <sddl.h>
 #include <red_test.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 static void run_test1(RedTest test)
 {
     SDDLParseResult result = sddl_load_and_parse("test1.sddl");
@@ -36,6 +41,1046 @@ static void run_test2(RedTest test)
     sddl_free_parse_result(result);
 }
 
+static void write_file(const char *filename, const char *text)
+{
+    FILE *fp = fopen(filename, "w");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+static void run_test_native_parser(RedTest test)
+{
+    const char *badNumbers[] = { "0x10", "-inf", "1.", ".5", "01", "1e", "+1", "1e999" };
+    unsigned numRejected = 0;
+    size_t i;
+    SDDLParseResult result;
+    SDDLDocument doc;
+    SDDLVarDecl var;
+
+    result = sddl_parse(
+        "// header\n"
+        "{\n"
+        "    \"description\" : \"tab\\there \\u00e9\",\n"
+        "    \"authors\" : [\"a\", \"b\",],\n"
+        "    \"out float32 temp\" : { \"min-value\" : -40, \"units\" : \"C\", /* c */ },\n"
+        "}\n");
+    RedTest_Verify(test, "parser - comments and trailing commas", sddl_parse_result_ok(result));
+    doc = sddl_parse_result_document(result);
+    RedTest_Verify(test, "parser - escapes", !strcmp(sddl_document_description(doc), "tab\there \xc3\xa9"));
+    RedTest_Verify(test, "parser - authors", sddl_document_num_authors(doc) == 2);
+    var = sddl_document_var_by_name(doc, "temp");
+    RedTest_Verify(test, "parser - var fields", var
+            && sddl_var_datatype(var) == SDDL_DATATYPE_FLOAT32
+            && sddl_var_direction(var) == SDDL_DIRECTION_OUT
+            && *sddl_var_min_value(var) == -40.0
+            && !strcmp(sddl_var_units(var), "C"));
+    sddl_free_parse_result(result);
+
+    result = sddl_parse("{\n  \"int8 x\" : { \"units\" : 5 }\n}");
+    RedTest_Verify(test, "parser - error reported with position", !sddl_parse_result_ok(result)
+            && sddl_parse_result_num_errors(result) == 1
+            && strstr(sddl_parse_result_error(result, 0), "line 2, col 26"));
+    sddl_free_parse_result(result);
+
+    for (i = 0; i < sizeof(badNumbers)/sizeof(badNumbers[0]); i++)
+    {
+        char text[128];
+        snprintf(text, sizeof(text), "{ \"int8 x\" : { \"min-value\" : %s } }", badNumbers[i]);
+        result = sddl_parse(text);
+        numRejected += !sddl_parse_result_ok(result);
+        sddl_free_parse_result(result);
+    }
+    RedTest_Verify(test, "parser - non-JSON numbers rejected", numRejected == sizeof(badNumbers)/sizeof(badNumbers[0]));
+    result = sddl_parse("{ \"int8 x\" : { \"min-value\" : -0.25e+2 } }");
+    RedTest_Verify(test, "parser - JSON number", sddl_parse_result_ok(result)
+            && *sddl_var_min_value(sddl_document_var_by_name(sddl_parse_result_document(result), "x")) == -25.0);
+    sddl_free_parse_result(result);
+
+    // Longer than any fixed scalar buffer, and split across chunks.
+    {
+        const char *head = "{ \"int8 x\" : { \"min-value\" : 0.00000000000000000000000000000000";
+        const char *tail = "00000000000000000000000000000001e64, \"max-value\" : 10000000000000000000000000000000"
+                "0000000000000000000000000000000000000000000e-74 } }";
+        SDDLParser parser = sddl_parser_new(NULL, NULL);
+        sddl_parser_feed(parser, head, strlen(head));
+        sddl_parser_feed(parser, tail, strlen(tail));
+        result = sddl_parser_finish(parser);
+        var = sddl_document_var_by_name(sddl_parse_result_document(result), "x");
+        RedTest_Verify(test, "parser - long number", sddl_parse_result_ok(result)
+                && *sddl_var_min_value(var) == 1.0 && *sddl_var_max_value(var) == 1.0);
+        sddl_free_parse_result(result);
+    }
+}
+
+static void count_var(SDDLVarDecl var, void *userdata)
+{
+    (*(unsigned *)userdata)++;
+}
+
+static void run_test_streaming(RedTest test)
+{
+    const char *text =
+        "/* comment */ {\n"
+        "    \"out uint32 esc\\u0061ped\" : { \"description\" : \"a\\\"b\" },\n"
+        "    \"in float64 level\" : { \"max-value\" : 12.5e1 },\n"
+        "}";
+    unsigned numEmitted = 0;
+    SDDLParser parser = sddl_parser_new(count_var, &numEmitted);
+    SDDLParseResult result;
+    SDDLDocument doc;
+    size_t i;
+
+    // one byte at a time splits every token
+    for (i = 0; text[i]; i++)
+    {
+        sddl_parser_feed(parser, &text[i], 1);
+    }
+    result = sddl_parser_finish(parser);
+    doc = sddl_parse_result_document(result);
+    RedTest_Verify(test, "streaming - parsing OK", sddl_parse_result_ok(result));
+    RedTest_Verify(test, "streaming - vars emitted", numEmitted == 2);
+    RedTest_Verify(test, "streaming - split tokens", sddl_document_var_by_name(doc, "escaped")
+            && !strcmp(sddl_var_description(sddl_document_var_by_name(doc, "escaped")), "a\"b")
+            && *sddl_var_max_value(sddl_document_var_by_name(doc, "level")) == 125.0);
+    sddl_free_parse_result(result);
+}
+
+// Builds an SDDL text with a <descriptionLen>-byte description of 'x's.
+static char * make_long_sddl(size_t descriptionLen, const char *varName)
+{
+    char *text = malloc(descriptionLen + 128);
+    size_t len = sprintf(text, "{ \"description\" : \"");
+    memset(&text[len], 'x', descriptionLen);
+    len += descriptionLen;
+    sprintf(&text[len], "\", \"int8 %s\" : {} }", varName);
+    return text;
+}
+
+static void run_test_source_rewrite(RedTest test)
+{
+    char *text = make_long_sddl(20000, "a");
+    SDDLParseResult result;
+    SDDLDocument doc;
+
+    write_file("build/rewrite.sddl", text);
+    result = sddl_load_and_parse("build/rewrite.sddl");
+    doc = sddl_parse_result_ref_document(result);
+    sddl_free_parse_result(result);
+
+    // truncate the source while the document is alive
+    write_file("build/rewrite.sddl", "");
+    RedTest_Verify(test, "source rewrite - document unaffected", doc
+            && strlen(sddl_document_description(doc)) == 20000
+            && sddl_document_var_by_name(doc, "a"));
+    sddl_unref_document(doc);
+    free(text);
+}
+
+static void run_test_parse_decls(RedTest test)
+{
+    const char *decls[] = {"out float32[16] samples", "inout  optional int8 level", "float32", "int8[4 x",
+            "int8[4294967297] wrapped", "int8[4294967295] largest"};
+    SDDLDeclInfo info[6];
+
+    RedTest_Verify(test, "decls - count OK", sddl_parse_decls(decls, 6, info) == 3);
+    RedTest_Verify(test, "decls - array", info[0].result == SDDL_SUCCESS
+            && info[0].direction == SDDL_DIRECTION_OUT
+            && info[0].datatype == SDDL_DATATYPE_ARRAY
+            && info[0].array_datatype == SDDL_DATATYPE_FLOAT32
+            && info[0].array_num_elements == 16
+            && info[0].name_len == 7 && !strncmp(info[0].name, "samples", 7));
+    RedTest_Verify(test, "decls - qualifiers", info[1].result == SDDL_SUCCESS
+            && info[1].direction == SDDL_DIRECTION_INOUT
+            && info[1].datatype == SDDL_DATATYPE_INT8);
+    RedTest_Verify(test, "decls - errors", info[2].result == SDDL_ERROR_PARSING
+            && info[3].result == SDDL_ERROR_PARSING);
+    RedTest_Verify(test, "decls - array size limit", info[4].result == SDDL_ERROR_PARSING
+            && info[5].result == SDDL_SUCCESS && info[5].array_num_elements == 4294967295u);
+}
+
+static void run_test_image(RedTest test)
+{
+    SDDLParseResult result = sddl_parse(
+        "{ \"description\" : \"imaged\", \"authors\" : [\"me\"],"
+        "  \"out float32 temp\" : { \"max-value\" : 99, \"units\" : \"C\" },"
+        "  \"in int8[4] levels\" : {} }");
+    SDDLDocument doc;
+    SDDLVarDecl var;
+    FILE *fp;
+
+    RedTest_Verify(test, "image - compile", sddl_document_compile(sddl_parse_result_document(result), "build/test.sddlimg"));
+    sddl_free_parse_result(result);
+
+    doc = sddl_document_load_image("build/test.sddlimg");
+    RedTest_Verify(test, "image - load", doc && sddl_document_num_vars(doc) == 2);
+    var = sddl_document_var_by_name(doc, "temp");
+    RedTest_Verify(test, "image - var fields", var
+            && *sddl_var_max_value(var) == 99.0
+            && !sddl_var_min_value(var)
+            && !strcmp(sddl_var_units(var), "C")
+            && sddl_var_direction(var) == SDDL_DIRECTION_OUT);
+    RedTest_Verify(test, "image - path lookup", sddl_document_var_by_path(doc, "levels") == sddl_document_var_by_idx(doc, 1));
+    RedTest_Verify(test, "image - document fields", !strcmp(sddl_document_description(doc), "imaged")
+            && !strcmp(sddl_document_author(doc, 0), "me"));
+
+    // recompiling over a loaded image leaves the loaded one intact
+    result = sddl_parse("{ \"int8 x\" : {} }");
+    RedTest_Verify(test, "image - recompile", sddl_document_compile(sddl_parse_result_document(result), "build/test.sddlimg"));
+    sddl_free_parse_result(result);
+    RedTest_Verify(test, "image - loaded image unaffected", !strcmp(sddl_document_description(doc), "imaged")
+            && sddl_document_var_by_name(doc, "temp"));
+    sddl_unref_document(doc);
+
+    // flip one byte past the header
+    fp = fopen("build/test.sddlimg", "r+b");
+    fseek(fp, -2, SEEK_END);
+    fputc('X', fp);
+    fclose(fp);
+    RedTest_Verify(test, "image - corrupt image rejected", !sddl_document_load_image("build/test.sddlimg"));
+}
+
+// Mirrors the image layout in src/sddl_image.c, for corrupting images.
+typedef struct
+{
+    char magic[8];
+    uint32_t version, byte_order, header_size, checksum;
+    uint64_t total_size;
+    uint32_t num_records, num_vars, num_paths, num_slots, num_authors, description;
+    uint32_t var_index_capacity, var_index_slot, path_index_capacity, path_index_slot;
+    uint32_t strings_size, reserved;
+    uint64_t records_offset, paths_offset, slots_offset, authors_offset, strings_offset;
+} TestImageHeader;
+
+typedef struct
+{
+    double max_value, min_value;
+    uint32_t name, name_len, name_hash, decl_string, description, regex, units, flags;
+    uint32_t datatype, direction, numeric_display_hint, array_datatype, array_num_elements;
+    uint32_t parent, first_member, num_members, member_index_capacity, member_index_slot;
+} TestImageRecord;
+
+typedef struct
+{
+    uint32_t record, path, path_len, path_hash;
+} TestImagePath;
+
+// Applies corruption <which> to build/layout.sddlimg, with a valid
+// checksum, and reports whether the result still loads.
+static bool corrupt_image_loads(int which)
+{
+    char image[8192];
+    TestImageHeader *header = (TestImageHeader *)image;
+    TestImageRecord *records;
+    TestImagePath *paths;
+    SDDLDocument doc;
+    size_t len;
+    FILE *fp;
+
+    fp = fopen("build/layout.sddlimg", "rb");
+    len = fread(image, 1, sizeof(image), fp);
+    fclose(fp);
+    records = (TestImageRecord *)&image[header->records_offset];
+    paths = (TestImagePath *)&image[header->paths_offset];
+    switch (which)
+    {
+    case 1: // struct that is its own member
+        records[0].first_member = 0;
+        break;
+    case 2: // member range covering a top-level var
+        records[0].first_member = 1;
+        break;
+    case 3: // members on a non-struct
+        records[1].first_member = 3;
+        records[1].num_members = 1;
+        break;
+    case 4:
+        records[2].name_len = 100;
+        break;
+    case 5:
+        paths[0].path_len = 100;
+        break;
+    }
+    header->checksum = sddl_name_hash(&image[sizeof(*header)], len - sizeof(*header));
+
+    fp = fopen("build/corrupt.sddlimg", "wb");
+    fwrite(image, 1, len, fp);
+    fclose(fp);
+    doc = sddl_document_load_image("build/corrupt.sddlimg");
+    if (!doc)
+    {
+        return false;
+    }
+    sddl_unref_document(doc);
+    return true;
+}
+
+static void run_test_image_layout(RedTest test)
+{
+    // records: s, c, s.a, s.b
+    SDDLParseResult result = sddl_parse(
+        "{ \"struct s\" : { \"int8 a\" : {}, \"int8 b\" : {} }, \"int8 c\" : {} }");
+
+    sddl_document_compile(sddl_parse_result_document(result), "build/layout.sddlimg");
+    sddl_free_parse_result(result);
+    RedTest_Verify(test, "image layout - rewritten image loads", corrupt_image_loads(0));
+    RedTest_Verify(test, "image layout - struct containing itself", !corrupt_image_loads(1));
+    RedTest_Verify(test, "image layout - overlapping members", !corrupt_image_loads(2));
+    RedTest_Verify(test, "image layout - members on non-struct", !corrupt_image_loads(3));
+    RedTest_Verify(test, "image layout - bad name length", !corrupt_image_loads(4));
+    RedTest_Verify(test, "image layout - bad path length", !corrupt_image_loads(5));
+}
+
+static void run_test_codec(RedTest test)
+{
+    SDDLParseResult result = sddl_parse(
+        "{ \"out int16 a\" : {}, \"out float32[2] b\" : {}, \"out void c\" : {}, \"out string d\" : {} }");
+    SDDLCodec codec = sddl_codec_new_for_document(sddl_parse_result_document(result));
+    SDDLValue in[8], out[8];
+    uint8_t buf[64];
+    size_t len;
+
+    RedTest_Verify(test, "codec - values", codec && sddl_codec_num_values(codec) == 4 && !sddl_codec_is_fixed_size(codec));
+
+    in[0].i16 = -2;
+    in[1].f32 = 1.5f;
+    in[2].f32 = -0.25f;
+    in[3].string.chars = "hi";
+    in[3].string.len = 2;
+    memcpy(&in[4], in, 4*sizeof(SDDLValue));
+    in[7].string.chars = "";
+    in[7].string.len = 0;
+
+    len = sddl_codec_encode(codec, in, buf, sizeof(buf));
+    RedTest_Verify(test, "codec - packed little-endian", len == 14 && buf[0] == 0xfe && buf[1] == 0xff && buf[10] == 2 && buf[12] == 'h');
+    RedTest_Verify(test, "codec - buffer too small", sddl_codec_encode(codec, in, buf, 13) == 0);
+
+    len = sddl_codec_encode_records(codec, in, 2, buf, sizeof(buf));
+    RedTest_Verify(test, "codec - bulk round trip", len == 26
+            && sddl_codec_decode_records(codec, buf, len, 2, out) == len
+            && out[0].i16 == -2 && out[2].f32 == -0.25f
+            && out[3].string.len == 2 && !memcmp(out[3].string.chars, "hi", 2)
+            && out[7].string.len == 0);
+    RedTest_Verify(test, "codec - truncated input", sddl_codec_decode(codec, buf, 13, out) == 0);
+    RedTest_Verify(test, "codec - array value var",
+            sddl_codec_value_var(codec, 2) == sddl_codec_value_var(codec, 1)
+            && sddl_codec_value_datatype(codec, 2) == SDDL_DATATYPE_FLOAT32
+            && sddl_codec_value_datatype(codec, 3) == SDDL_DATATYPE_STRING);
+
+    sddl_codec_free(codec);
+    sddl_free_parse_result(result);
+
+    // The string fits, but the int32 after it doesn't.
+    result = sddl_parse("{ \"out string s\" : {}, \"out int32 n\" : {} }");
+    codec = sddl_codec_new_for_document(sddl_parse_result_document(result));
+    memcpy(buf, "\x04\x00" "abcd", 6);
+    RedTest_Verify(test, "codec - truncated after string", codec && sddl_codec_decode(codec, buf, 6, out) == 0);
+    memcpy(buf + 6, "\x01\x00\x00\x00", 4);
+    RedTest_Verify(test, "codec - string then int32",
+            sddl_codec_decode(codec, buf, 10, out) == 10 && out[0].string.len == 4 && out[1].i32 == 1);
+
+    sddl_codec_free(codec);
+    sddl_free_parse_result(result);
+}
+
+static void run_test_validator(RedTest test)
+{
+    SDDLParseResult result = sddl_parse(
+        "{ \"in float32 temp\" : { \"min-value\" : -40, \"max-value\" : 85 },"
+        "  \"in string serial\" : { \"regex\" : \"^[A-Z]{2}[0-9]+$\" },"
+        "  \"in string lot\" : { \"regex\" : \"^[A-Z]{2}[0-9]+$\" },"
+        "  \"in int8 free\" : {} }");
+    SDDLDocument doc = sddl_parse_result_document(result);
+    SDDLVarDecl temp = sddl_document_var_by_name(doc, "temp");
+    SDDLVarDecl serial = sddl_document_var_by_name(doc, "serial");
+    SDDLValidator validator = sddl_validator_new(doc, NULL);
+    double samples[] = {20.0, 85.0, 85.5, -3.0};
+    const char *serials[] = {"AB12", "X1"};
+
+    RedTest_Verify(test, "validator - compiled", validator != NULL);
+    RedTest_Verify(test, "validator - range", sddl_validator_check_number(validator, temp, -40.0)
+            && !sddl_validator_check_number(validator, temp, -40.5));
+    RedTest_Verify(test, "validator - batch reports first failure", sddl_validator_check_numbers(validator, temp, samples, 4) == 2);
+    RedTest_Verify(test, "validator - regex", sddl_validator_check_strings(validator, serial, serials, 2) == 1
+            && sddl_validator_check_string(validator, sddl_document_var_by_name(doc, "lot"), "ZZ9"));
+    RedTest_Verify(test, "validator - unconstrained", sddl_validator_check_number(validator, sddl_document_var_by_name(doc, "free"), 1e9));
+
+    sddl_validator_free(validator);
+    sddl_free_parse_result(result);
+}
+
+static void run_test_layout(RedTest test)
+{
+    SDDLVarDecl strct = sddl_var_new_struct(SDDL_DIRECTION_OUT, "sample");
+    SDDLVarDecl flag = sddl_var_new_basic(SDDL_DATATYPE_BOOL, SDDL_DIRECTION_INHERIT, "flag");
+    SDDLVarDecl values = sddl_var_new_array(SDDL_DATATYPE_INT32, 3, SDDL_DIRECTION_INHERIT, "values");
+    SDDLVarDecl when = sddl_var_new_basic(SDDL_DATATYPE_DATETIME, SDDL_DIRECTION_INHERIT, "when");
+    SDDLLayout layout;
+
+    sddl_var_struct_add_member(strct, flag);
+    sddl_var_struct_add_member(strct, values);
+    sddl_var_struct_add_member(strct, when);
+
+    layout = sddl_layout_new_for_var(strct, SDDL_LAYOUT_NATURAL);
+    RedTest_Verify(test, "layout - natural", layout
+            && sddl_layout_size(layout) == 24 && sddl_layout_alignment(layout) == 8
+            && sddl_layout_entry_for_var(layout, values)->offset == 4
+            && sddl_layout_entry_for_var(layout, values)->element_size == 4
+            && sddl_layout_entry_for_var(layout, when)->offset == 16);
+    sddl_layout_free(layout);
+
+    layout = sddl_layout_new_for_var(strct, SDDL_LAYOUT_PACKED);
+    RedTest_Verify(test, "layout - packed", layout
+            && sddl_layout_size(layout) == 21
+            && sddl_layout_entry_for_var(layout, when)->offset == 13);
+    sddl_layout_free(layout);
+
+    layout = sddl_layout_new_for_var(strct, SDDL_LAYOUT_CACHE_LINE);
+    RedTest_Verify(test, "layout - cache line", layout
+            && sddl_layout_size(layout) == 64 && sddl_layout_alignment(layout) == 64);
+    sddl_layout_free(layout);
+}
+
+static void run_test_column_store(RedTest test)
+{
+    SDDLParseResult result = sddl_parse(
+        "{ \"out float32 temp\" : {}, \"out string label\" : {}, \"out uint8 level\" : {} }");
+    SDDLDocument doc = sddl_parse_result_document(result);
+    SDDLColumnStore store = sddl_column_store_new(doc, 4);
+    int64_t timestamps[6] = {10, 20, 30, 40, 50, 60};
+    SDDLValue rows[12];
+    const float *temps;
+    size_t first, count;
+    int i;
+
+    RedTest_Verify(test, "columns - one per numeric var", store && sddl_column_store_num_columns(store) == 2
+            && sddl_column_store_column_index(store, sddl_document_var_by_name(doc, "level")) == 1
+            && sddl_column_store_column_index(store, sddl_document_var_by_name(doc, "label")) == -1);
+
+    for (i = 0; i < 6; i++)
+    {
+        rows[2*i].f32 = i*1.5f;
+        rows[2*i + 1].u8 = i;
+    }
+    RedTest_Verify(test, "columns - bulk append", sddl_column_store_append_rows(store, timestamps, rows, 6) == 6
+            && sddl_column_store_num_rows(store) == 4);
+    RedTest_Verify(test, "columns - out of order rejected", !sddl_column_store_append_row(store, 5, rows));
+
+    // rows 30..60 retained; ring has wrapped once
+    count = sddl_column_store_find_range(store, 35, 60, &first);
+    RedTest_Verify(test, "columns - range", first == 1 && count == 3);
+    temps = sddl_column_store_column_span(store, 0, first, &count);
+    RedTest_Verify(test, "columns - span stops at wrap", temps && count == 1 && temps[0] == 3*1.5f);
+    count = 2;
+    temps = sddl_column_store_column_span(store, 0, first + 1, &count);
+    RedTest_Verify(test, "columns - span after wrap", temps && count == 2 && temps[1] == 5*1.5f);
+
+    sddl_column_store_free(store);
+    sddl_free_parse_result(result);
+}
+
+static void run_test_arena(RedTest test)
+{
+    SDDLParseResult result = sddl_load_and_parse("test2.sddl");
+    SDDLDocument doc = sddl_parse_result_ref_document(result);
+    SDDLArenaStats stats;
+
+    sddl_free_parse_result(result);
+    RedTest_Verify(test, "arena - doc outlives result", sddl_document_var_by_name(doc, "bool_var") != NULL);
+
+    sddl_document_arena_stats(doc, &stats);
+    RedTest_Verify(test, "arena - few blocks", stats.num_blocks >= 1 && stats.num_blocks <= 2);
+    RedTest_Verify(test, "arena - usage within reservation", stats.bytes_used <= stats.bytes_reserved);
+    RedTest_Verify(test, "arena - allocations counted", stats.num_allocations > 12);
+
+    sddl_unref_document(doc);
+}
+
+static void run_test_parse_stats(RedTest test)
+{
+    SDDLParseOptions options = {0};
+    SDDLParseResult result;
+    const SDDLParseStats *stats;
+
+    result = sddl_load_and_parse("test2.sddl");
+    RedTest_Verify(test, "stats - off by default", sddl_parse_result_stats(result) == NULL);
+    sddl_free_parse_result(result);
+
+    options.collect_stats = true;
+    result = sddl_load_and_parse_with_options("test2.sddl", &options);
+    stats = sddl_parse_result_stats(result);
+    if (stats)
+    {
+        // Built with SDDL_PARSE_STATS
+        RedTest_Verify(test, "stats - vars", stats->num_vars == sddl_document_num_vars(sddl_parse_result_document(result)));
+        RedTest_Verify(test, "stats - depth", stats->max_depth == 1);
+        RedTest_Verify(test, "stats - input", stats->input_bytes > 0 && stats->num_tokens > stats->num_vars);
+        RedTest_Verify(test, "stats - phases add up", stats->total_ns == stats->lex_ns + stats->grammar_ns
+                + stats->decl_ns + stats->var_table_ns + stats->finish_ns);
+        RedTest_Verify(test, "stats - allocations", stats->heap_allocations > 0 && stats->arena_allocations > stats->num_vars);
+    }
+    sddl_free_parse_result(result);
+}
+
+// Counts calls and the bytes currently allocated, keeping each block's
+// size in a header.
+typedef struct
+{
+    unsigned allocs;
+    unsigned frees;
+    size_t live_bytes;
+    size_t peak_bytes;
+} AllocCounts;
+
+static void * counting_malloc(size_t size, void *userdata)
+{
+    AllocCounts *counts = userdata;
+    size_t *block = malloc(sizeof(max_align_t) + size);
+    if (!block)
+    {
+        return NULL;
+    }
+    *block = size;
+    counts->allocs++;
+    counts->live_bytes += size;
+    if (counts->live_bytes > counts->peak_bytes)
+    {
+        counts->peak_bytes = counts->live_bytes;
+    }
+    return (char *)block + sizeof(max_align_t);
+}
+
+static void counting_free(void *ptr, void *userdata)
+{
+    AllocCounts *counts = userdata;
+    size_t *block = (size_t *)((char *)ptr - sizeof(max_align_t));
+    counts->frees++;
+    counts->live_bytes -= *block;
+    free(block);
+}
+
+static void * counting_realloc(void *ptr, size_t size, void *userdata)
+{
+    size_t oldSize;
+    void *out;
+    if (!ptr)
+    {
+        return counting_malloc(size, userdata);
+    }
+    oldSize = *(size_t *)((char *)ptr - sizeof(max_align_t));
+    out = counting_malloc(size, userdata);
+    if (out)
+    {
+        memcpy(out, ptr, (oldSize < size) ? oldSize : size);
+        counting_free(ptr, userdata);
+    }
+    return out;
+}
+
+static void run_test_allocator(RedTest test)
+{
+    AllocCounts counts = {0};
+    AllocCounts globalCounts = {0};
+    SDDLAllocator allocator = {counting_malloc, counting_realloc, counting_free, &counts};
+    SDDLAllocator globalAllocator = {counting_malloc, counting_realloc, counting_free, &globalCounts};
+    SDDLParseOptions options = {0};
+    SDDLParseResult result;
+    SDDLDocument doc;
+    SDDLValidator validator;
+
+    options.allocator = &allocator;
+    result = sddl_load_and_parse_with_options("test2.sddl", &options);
+    RedTest_Verify(test, "allocator - parses", sddl_parse_result_ok(result));
+    RedTest_Verify(test, "allocator - used", counts.allocs > 0 && counts.live_bytes > 0);
+    doc = sddl_parse_result_ref_document(result);
+    sddl_free_parse_result(result);
+    RedTest_Verify(test, "allocator - doc outlives result", counts.live_bytes > 0
+            && sddl_document_var_by_name(doc, "bool_var") != NULL);
+
+    // Objects other than documents come from the global allocator.
+    sddl_set_allocator(&globalAllocator);
+    validator = sddl_validator_new(doc, NULL);
+    RedTest_Verify(test, "allocator - global used", globalCounts.allocs > 0);
+    sddl_validator_free(validator);
+    sddl_set_allocator(NULL);
+    RedTest_Verify(test, "allocator - global balanced", globalCounts.allocs == globalCounts.frees);
+
+    sddl_unref_document(doc);
+    RedTest_Verify(test, "allocator - balanced", counts.allocs == counts.frees && counts.live_bytes == 0);
+
+    // Streamed input goes through the parser, also allocated from it.
+    memset(&counts, 0, sizeof(counts));
+    result = sddl_parse_with_options("{\"in float32 x\" : {}}", &options);
+    RedTest_Verify(test, "allocator - small parse", sddl_parse_result_ok(result) && counts.allocs > 0);
+    sddl_free_parse_result(result);
+    RedTest_Verify(test, "allocator - small balanced", counts.live_bytes == 0);
+}
+
+static void run_test_diagnostics(RedTest test)
+{
+    const char *text = "{\"in float32 x\" : {\"bogus\" : 1, \"units\" : 5}}";
+    const char *warnings = "{\"in float32 x\" : {\"a\" : 1, \"b\" : 2, \"c\" : 3}}";
+    SDDLParseOptions options = {0};
+    SDDLParseResult result;
+    const SDDLDiagnostic *diag;
+
+    result = sddl_parse(text);
+    RedTest_Verify(test, "diagnostics - counts", !sddl_parse_result_ok(result)
+            && sddl_parse_result_num_diagnostics(result) == 2
+            && sddl_parse_result_num_errors(result) == 1
+            && sddl_parse_result_num_warnings(result) == 1);
+    diag = sddl_parse_result_diagnostic(result, 0);
+    RedTest_Verify(test, "diagnostics - warning", !diag->is_error
+            && diag->code == SDDL_DIAGNOSTIC_UNEXPECTED_FIELD
+            && !strcmp(diag->path, "x") && !strcmp(diag->detail, "bogus")
+            && diag->line == 1 && diag->col == 20 && diag->offset == 19);
+    diag = sddl_parse_result_diagnostic(result, 1);
+    RedTest_Verify(test, "diagnostics - error", diag->is_error
+            && diag->code == SDDL_DIAGNOSTIC_WRONG_TYPE && !strcmp(diag->path, "x"));
+    RedTest_Verify(test, "diagnostics - formatted", !strcmp(sddl_parse_result_warning(result, 0),
+            "line 1, col 20: Unexpected field: bogus"));
+    sddl_free_parse_result(result);
+
+    options.fail_fast = true;
+    result = sddl_parse_with_options(text, &options);
+    RedTest_Verify(test, "diagnostics - fail fast", !sddl_parse_result_ok(result)
+            && sddl_parse_result_num_diagnostics(result) == 1
+            && sddl_parse_result_num_errors(result) == 1);
+    sddl_free_parse_result(result);
+
+    options.fail_fast = false;
+    options.max_diagnostics = 2;
+    result = sddl_parse_with_options(warnings, &options);
+    RedTest_Verify(test, "diagnostics - capped", sddl_parse_result_ok(result)
+            && sddl_parse_result_num_diagnostics(result) == 2
+            && sddl_parse_result_num_dropped_diagnostics(result) == 1);
+    sddl_free_parse_result(result);
+
+    options.max_diagnostics = 1;
+    result = sddl_parse_with_options("{\"in float32 x\" : {\"a\" : 1, \"b\" : 2, \"units\" : 5}}", &options);
+    RedTest_Verify(test, "diagnostics - capped keeps error", !sddl_parse_result_ok(result)
+            && sddl_parse_result_num_warnings(result) == 1
+            && sddl_parse_result_num_errors(result) == 1
+            && sddl_parse_result_num_dropped_diagnostics(result) == 1
+            && strstr(sddl_parse_result_error(result, 0), "col 48"));
+    sddl_free_parse_result(result);
+}
+
+static void run_test_freeze(RedTest test)
+{
+    SDDLParseResult result = sddl_load_and_parse("test2.sddl");
+    SDDLDocument doc = sddl_parse_result_document(result);
+    SDDLVarDecl var = sddl_document_var_by_name(doc, "bool_var");
+    int extra;
+
+    sddl_var_set_extra(var, &extra);
+    RedTest_Verify(test, "freeze - starts unfrozen", !sddl_document_is_frozen(doc));
+    sddl_document_freeze(doc);
+    sddl_var_set_extra(var, NULL);
+    RedTest_Verify(test, "freeze - frozen", sddl_document_is_frozen(doc));
+    RedTest_Verify(test, "freeze - extra kept", sddl_var_extra(var) == &extra);
+
+    sddl_free_parse_result(result);
+}
+
+static void run_test_load_batch(RedTest test)
+{
+    const char *files[] = {"test2.sddl", "missing.sddl", "test1.sddl", "test2.sddl"};
+    SDDLLoadBatch batch;
+
+    batch = sddl_load_batch_files(files, 4, 3);
+    RedTest_Verify(test, "batch - all files", batch && sddl_load_batch_num_files(batch) == 4);
+    RedTest_Verify(test, "batch - results in input order",
+            sddl_document_num_vars(sddl_parse_result_document(sddl_load_batch_result(batch, 0))) == 12
+            && sddl_load_batch_result(batch, 1) == NULL
+            && sddl_document_num_vars(sddl_parse_result_document(sddl_load_batch_result(batch, 2))) == 0
+            && sddl_parse_result_ok(sddl_load_batch_result(batch, 3)));
+    sddl_load_batch_free(batch);
+
+    batch = sddl_load_batch_dir(".", 0);
+    RedTest_Verify(test, "batch - directory, sorted", batch && sddl_load_batch_num_files(batch) == 2
+            && !strcmp(sddl_load_batch_filename(batch, 0), "./test1.sddl")
+            && sddl_parse_result_ok(sddl_load_batch_result(batch, 1)));
+    sddl_load_batch_free(batch);
+}
+
+static void run_test_cache(RedTest test)
+{
+    const char *a = "{ \"out float32 temp\" : { \"units\" : \"C\" } }";
+    const char *b = "/* same schema */ {\n  \"out float32 temp\" : {\"units\":\"C\"}\n}";
+    const char *c = "{ \"in int8 x\" : { } }";
+    SDDLCache cache = sddl_cache_new(1024*1024);
+    SDDLParseResult failure;
+    SDDLDocument docA, docA2, docB, docC;
+    SDDLCacheStats stats;
+    unsigned i;
+
+    docA = sddl_cache_parse(cache, a, strlen(a), NULL);
+    docA2 = sddl_cache_parse(cache, a, strlen(a), NULL);
+    docB = sddl_cache_parse(cache, b, strlen(b), NULL);
+    docC = sddl_cache_parse(cache, c, strlen(c), NULL);
+    sddl_cache_stats(cache, &stats);
+    RedTest_Verify(test, "cache - identical text shared", docA && docA == docA2 && sddl_document_is_frozen(docA));
+    RedTest_Verify(test, "cache - equivalent schema shared", docB == docA && docC && docC != docA);
+    RedTest_Verify(test, "cache - stats", stats.text_hits == 1 && stats.canonical_hits == 1
+            && stats.misses == 2 && stats.num_documents == 2);
+
+    RedTest_Verify(test, "cache - parse failure reported", !sddl_cache_parse(cache, "{", 1, &failure)
+            && failure && sddl_parse_result_num_errors(failure) > 0);
+    sddl_free_parse_result(failure);
+    sddl_cache_free(cache);
+
+    // A bound smaller than any document keeps only the newest.
+    cache = sddl_cache_new(1);
+    sddl_unref_document(sddl_cache_parse(cache, c, strlen(c), NULL));
+    sddl_unref_document(sddl_cache_parse(cache, a, strlen(a), NULL));
+    sddl_cache_stats(cache, &stats);
+    RedTest_Verify(test, "cache - lru eviction", stats.num_documents == 1 && stats.evictions == 1
+            && sddl_document_var_by_name(docC, "x") != NULL);
+    sddl_cache_free(cache);
+
+    // Texts differing only in whitespace share one document, and their
+    // aliases stay within the bound.
+    cache = sddl_cache_new(64*1024);
+    for (i = 0; i < 2000; i++)
+    {
+        char text[2200];
+        size_t len = strlen(c);
+        memset(text, ' ', i);
+        memcpy(text + i, c, len);
+        sddl_unref_document(sddl_cache_parse(cache, text, i + len, NULL));
+    }
+    sddl_cache_stats(cache, &stats);
+    RedTest_Verify(test, "cache - aliases bounded", stats.num_documents == 1 && stats.canonical_hits == 1999
+            && stats.bytes <= 64*1024);
+    sddl_cache_free(cache);
+
+    sddl_unref_document(docA);
+    sddl_unref_document(docA2);
+    sddl_unref_document(docB);
+    sddl_unref_document(docC);
+}
+
+static bool append_text(const char *chars, size_t len, void *userdata)
+{
+    strncat((char *)userdata, chars, len);
+    return true;
+}
+
+static void run_test_serialize(RedTest test)
+{
+    const char *expected =
+        "{\n"
+        "    \"description\" : \"tab\\there\",\n"
+        "    \"authors\" : [\n"
+        "        \"a\"\n"
+        "    ],\n"
+        "    \"out float32 temp\" : {\n"
+        "        \"min-value\" : -40.5,\n"
+        "        \"max-value\" : 0.1,\n"
+        "        \"numeric-display-hint\" : \"hex\",\n"
+        "        \"units\" : \"C\"\n"
+        "    },\n"
+        "    \"int8[4] codes\" : {}\n"
+        "}\n";
+    SDDLParseResult result;
+    SDDLParseResult reparsed;
+    char buf[1024];
+    char streamed[1024] = "";
+    char small[8];
+    size_t len;
+
+    result = sddl_parse(
+        "{ \"authors\" : [\"a\"], \"description\" : \"tab\\there\",\n"
+        "  \"out float32 temp\" : { \"units\" : \"C\", \"max-value\" : 0.1, \"min-value\" : -40.5,\n"
+        "      \"numeric-display-hint\" : \"hex\" },\n"
+        "  \"int8[4] codes\" : { \"description\" : \"\" } }");
+    len = sddl_document_serialize(sddl_parse_result_document(result), buf, sizeof(buf));
+    RedTest_Verify(test, "serialize - canonical text", len == strlen(expected) && !strcmp(buf, expected));
+    RedTest_Verify(test, "serialize - truncation", sddl_document_serialize(sddl_parse_result_document(result), small, sizeof(small)) == len
+            && strlen(small) == sizeof(small) - 1);
+    RedTest_Verify(test, "serialize - streamed", sddl_document_serialize_to(sddl_parse_result_document(result), append_text, streamed)
+            && !strcmp(streamed, expected));
+
+    reparsed = sddl_parse(buf);
+    sddl_document_serialize(sddl_parse_result_document(reparsed), streamed, sizeof(streamed));
+    RedTest_Verify(test, "serialize - round trip", !strcmp(streamed, expected));
+    sddl_free_parse_result(reparsed);
+    sddl_free_parse_result(result);
+}
+
+static void run_test_diff(RedTest test)
+{
+    SDDLParseResult oldResult = sddl_parse(
+        "{ \"out float32 temp\" : { \"units\" : \"C\" },\n"
+        "  \"in int8 mode\" : {},\n"
+        "  \"string name\" : {} }");
+    SDDLParseResult newResult = sddl_parse(
+        "{ \"out float32 temp\" : { \"units\" : \"K\", \"max-value\" : 500 },\n"
+        "  \"string name\" : {},\n"
+        "  \"out int16 mode\" : {},\n"
+        "  \"bool on\" : {} }");
+    SDDLDiff diff;
+    const SDDLDiffEntry *e;
+
+    diff = sddl_document_diff(sddl_parse_result_document(oldResult), sddl_parse_result_document(newResult));
+    RedTest_Verify(test, "diff - entries", diff && sddl_diff_num_entries(diff) == 4);
+    e = sddl_diff_entry(diff, 0);
+    RedTest_Verify(test, "diff - changed metadata", e->kind == SDDL_DIFF_CHANGED && !strcmp(e->path, "temp")
+            && e->changes == (SDDL_CHANGE_RANGE | SDDL_CHANGE_UNITS));
+    e = sddl_diff_entry(diff, 1);
+    RedTest_Verify(test, "diff - changed declaration", e->kind == SDDL_DIFF_CHANGED && !strcmp(e->path, "mode")
+            && e->changes == (SDDL_CHANGE_DATATYPE | SDDL_CHANGE_DIRECTION | SDDL_CHANGE_POSITION));
+    e = sddl_diff_entry(diff, 2);
+    RedTest_Verify(test, "diff - moved", e->kind == SDDL_DIFF_CHANGED && e->changes == SDDL_CHANGE_POSITION);
+    e = sddl_diff_entry(diff, 3);
+    RedTest_Verify(test, "diff - added", e->kind == SDDL_DIFF_ADDED && !strcmp(e->path, "on") && !e->old_var);
+    sddl_diff_free(diff);
+
+    diff = sddl_document_diff(sddl_parse_result_document(newResult), sddl_parse_result_document(newResult));
+    RedTest_Verify(test, "diff - identical", diff && sddl_diff_num_entries(diff) == 0);
+    sddl_diff_free(diff);
+
+    diff = sddl_document_diff(sddl_parse_result_document(newResult), sddl_parse_result_document(oldResult));
+    e = sddl_diff_entry(diff, sddl_diff_num_entries(diff) - 1);
+    RedTest_Verify(test, "diff - removed", e->kind == SDDL_DIFF_REMOVED && !strcmp(e->path, "on") && !e->new_var);
+    sddl_diff_free(diff);
+
+    sddl_free_parse_result(oldResult);
+    sddl_free_parse_result(newResult);
+}
+
+static void count_reload(SDDLLiveSchema live, bool reloaded, void *userdata)
+{
+    __atomic_fetch_add((unsigned *)userdata, reloaded ? 1 : 0, __ATOMIC_SEQ_CST);
+}
+
+static void run_test_live_schema(RedTest test)
+{
+    SDDLLiveSchema live;
+    SDDLDocument before, after;
+    unsigned reloads = 0;
+    unsigned i;
+    char *text;
+
+    write_file("build/live.sddl", "{ \"int8 a\" : {} }");
+    live = sddl_live_schema_load("build/live.sddl", NULL);
+    before = sddl_live_schema_acquire(live);
+    RedTest_Verify(test, "live - loaded frozen", before && sddl_document_is_frozen(before)
+            && sddl_document_var_by_name(before, "a"));
+
+    write_file("build/live.sddl", "{ \"int8 b\" : {} }");
+    RedTest_Verify(test, "live - reload", sddl_live_schema_reload(live, NULL));
+    after = sddl_live_schema_acquire(live);
+    RedTest_Verify(test, "live - readers keep their snapshot", after != before
+            && sddl_document_var_by_name(before, "a") && sddl_document_var_by_name(after, "b"));
+    sddl_unref_document(before);
+    sddl_unref_document(after);
+
+    // a multi-page file rewritten in place while a snapshot is held
+    text = make_long_sddl(3*4096, "big");
+    write_file("build/live.sddl", text);
+    RedTest_Verify(test, "live - reload large", sddl_live_schema_reload(live, NULL));
+    before = sddl_live_schema_acquire(live);
+    write_file("build/live.sddl", "{ \"int8 d\" : {} }");
+    RedTest_Verify(test, "live - reload after rewrite in place", sddl_live_schema_reload(live, NULL));
+    RedTest_Verify(test, "live - snapshot survives rewrite", before
+            && strlen(sddl_document_description(before)) == 3*4096
+            && sddl_document_var_by_name(before, "big"));
+    sddl_unref_document(before);
+    free(text);
+
+    write_file("build/live.sddl", "{ \"int8 c\" ");
+    RedTest_Verify(test, "live - bad reload keeps document", !sddl_live_schema_reload(live, NULL));
+
+    RedTest_Verify(test, "live - watch", sddl_live_schema_watch(live, count_reload, &reloads));
+    write_file("build/live.sddl", "{ \"int8 c\" : {} }");
+    for (i = 0; i < 200 && !__atomic_load_n(&reloads, __ATOMIC_SEQ_CST); i++)
+    {
+        usleep(10000);
+    }
+    after = sddl_live_schema_acquire(live);
+    RedTest_Verify(test, "live - watched file reloaded", sddl_document_var_by_name(after, "c") != NULL);
+    sddl_unref_document(after);
+    sddl_live_schema_free(live);
+}
+
+static void run_test_lookup(RedTest test)
+{
+    SDDLParseResult result = sddl_load_and_parse("test2.sddl");
+    SDDLDocument doc = sddl_parse_result_document(result);
+    SDDLVarDecl var;
+    const char *buf = "uint16_var\", \"";
+
+    var = sddl_document_var_by_name(doc, "int8_var");
+    RedTest_Verify(test, "lookup - by name", var && !strcmp(sddl_var_name(var), "int8_var"));
+    RedTest_Verify(test, "lookup - missing name", !sddl_document_var_by_name(doc, "int8"));
+
+    var = sddl_document_var_by_name_hashed(doc, buf, 10, sddl_name_hash(buf, 10));
+    RedTest_Verify(test, "lookup - hashed, not NUL-terminated", var && !strcmp(sddl_var_name(var), "uint16_var"));
+
+    var = sddl_document_var_by_path(doc, "float64_var");
+    RedTest_Verify(test, "lookup - top-level path", var && !strcmp(sddl_var_name(var), "float64_var"));
+    RedTest_Verify(test, "lookup - missing path", !sddl_document_var_by_path(doc, "float64_var.x"));
+
+    sddl_free_parse_result(result);
+}
+
+static void run_test_nested_structs(RedTest test)
+{
+    SDDLParseResult result = sddl_parse(
+        "{ \"out struct motor\" : {\n"
+        "    \"description\" : \"drive\",\n"
+        "    \"float32 temp\" : { \"units\" : \"C\" },\n"
+        "    \"struct coil\" : { \"in uint8[3] phases\" : {} },\n"
+        "    \"bool on\" : {} },\n"
+        "  \"int16 speed\" : {} }");
+    SDDLDocument doc = sddl_parse_result_document(result);
+    SDDLVarDecl motor;
+    SDDLVarDecl phases;
+    const SDDLFlatVar *flat;
+    const SDDLFlatVar *leaves;
+    char text[1024];
+    SDDLParseResult reparsed;
+    SDDLDiff diff;
+
+    RedTest_Verify(test, "nested - parses cleanly", sddl_parse_result_ok(result)
+            && sddl_parse_result_num_warnings(result) == 0
+            && sddl_document_num_vars(doc) == 2);
+    motor = sddl_document_var_by_name(doc, "motor");
+    phases = sddl_document_var_by_path(doc, "motor.coil.phases");
+    RedTest_Verify(test, "nested - members", motor && sddl_var_struct_num_members(motor) == 3
+            && !strcmp(sddl_var_description(motor), "drive")
+            && !strcmp(sddl_var_units(sddl_var_struct_member_by_name(motor, "temp")), "C"));
+    RedTest_Verify(test, "nested - array member", phases
+            && sddl_var_datatype(phases) == SDDL_DATATYPE_ARRAY
+            && sddl_var_array_num_elements(phases) == 3
+            && sddl_var_parent(sddl_var_parent(phases)) == motor);
+
+    flat = sddl_document_flat_vars(doc);
+    RedTest_Verify(test, "nested - flat table", sddl_document_num_flat_vars(doc) == 6
+            && flat[0].var == motor && flat[0].parent == -1
+            && !strcmp(flat[3].path, "motor.coil.phases") && flat[3].parent == 2 && flat[3].depth == 2
+            && !strcmp(flat[5].path, "speed") && flat[5].parent == -1);
+    leaves = sddl_document_leaf_vars(doc);
+    RedTest_Verify(test, "nested - leaf table", sddl_document_num_leaf_vars(doc) == 4
+            && leaves[0].var == sddl_var_struct_member_by_idx(motor, 0)
+            && leaves[1].var == phases && leaves[1].parent == 2
+            && leaves[3].datatype == SDDL_DATATYPE_INT16);
+
+    sddl_document_serialize(doc, text, sizeof(text));
+    reparsed = sddl_parse(text);
+    diff = sddl_document_diff(doc, sddl_parse_result_document(reparsed));
+    RedTest_Verify(test, "nested - round trip", diff && sddl_diff_num_entries(diff) == 0);
+    sddl_diff_free(diff);
+    sddl_free_parse_result(reparsed);
+
+    RedTest_Verify(test, "nested - image", sddl_document_compile(doc, "build/nested.sddlimg"));
+    sddl_free_parse_result(result);
+    doc = sddl_document_load_image("build/nested.sddlimg");
+    RedTest_Verify(test, "nested - image flat table", doc
+            && sddl_document_num_leaf_vars(doc) == 4
+            && !strcmp(sddl_document_leaf_vars(doc)[1].path, "motor.coil.phases")
+            && sddl_document_leaf_vars(doc)[1].parent == 2);
+    sddl_unref_document(doc);
+
+    result = sddl_parse("{ \"struct s\" : { \"int8 a\" : {}, \"datatype\" : \"int8\" } }");
+    RedTest_Verify(test, "nested - datatype conflicts with members", !sddl_parse_result_ok(result)
+            && sddl_parse_result_num_errors(result) == 1
+            && sddl_parse_result_diagnostic(result, 0)->code == SDDL_DIAGNOSTIC_BAD_FIELD_VALUE
+            && !strcmp(sddl_parse_result_diagnostic(result, 0)->path, "s"));
+    sddl_free_parse_result(result);
+}
+
+static void run_test_query(RedTest test)
+{
+    SDDLParseResult result = sddl_parse(
+        "{ \"out struct motor\" : {\n"
+        "    \"float32 temp\" : {},\n"
+        "    \"in float32 setpoint\" : {},\n"
+        "    \"struct coil\" : { \"float32 current\" : {} } },\n"
+        "  \"float32 ambient\" : {},\n"
+        "  \"out int8 mode\" : {} }");
+    SDDLDocument doc = sddl_parse_result_document(result);
+    SDDLVarQuery query = {0};
+    SDDLVarSet set;
+    char text[4096];
+    size_t len;
+    unsigned i;
+
+    RedTest_Verify(test, "query - concrete direction", sddl_document_flat_vars(doc)[4].direction == SDDL_DIRECTION_OUT
+            && sddl_var_concrete_direction(sddl_document_var_by_path(doc, "motor.coil.current")) == SDDL_DIRECTION_OUT
+            && sddl_var_concrete_direction(sddl_document_var_by_name(doc, "ambient")) == SDDL_DIRECTION_INOUT);
+
+    query.directions = SDDL_QUERY_BIT(SDDL_DIRECTION_OUT);
+    query.datatypes = SDDL_QUERY_BIT(SDDL_DATATYPE_FLOAT32);
+    set = sddl_document_query_vars(doc, &query);
+    RedTest_Verify(test, "query - out float32", set && sddl_var_set_count(set) == 2
+            && sddl_var_set_indexes(set)[0] == 1 && sddl_var_set_indexes(set)[1] == 4
+            && sddl_var_set_contains(set, 4) && !sddl_var_set_contains(set, 2));
+    sddl_var_set_free(set);
+
+    query.datatypes = 0;
+    query.leaves_only = true;
+    set = sddl_document_query_vars(doc, &query);
+    RedTest_Verify(test, "query - out leaves", set && sddl_var_set_count(set) == 3
+            && sddl_var_set_indexes(set)[2] == 6);
+    sddl_var_set_free(set);
+    sddl_free_parse_result(result);
+
+    // more vars than fit in one bitset word
+    len = snprintf(text, sizeof(text), "{");
+    for (i = 0; i < 100; i++)
+    {
+        len += snprintf(&text[len], sizeof(text) - len, "\"%s int32 v%u\" : {},", (i % 3) ? "in" : "out", i);
+    }
+    snprintf(&text[len], sizeof(text) - len, "}");
+    result = sddl_parse(text);
+    query.directions = SDDL_QUERY_BIT(SDDL_DIRECTION_OUT);
+    query.leaves_only = false;
+    set = sddl_document_query_vars(sddl_parse_result_document(result), &query);
+    RedTest_Verify(test, "query - many vars", set && sddl_var_set_count(set) == 34
+            && sddl_var_set_indexes(set)[33] == 99 && !sddl_var_set_contains(set, 100));
+    sddl_var_set_free(set);
+    sddl_free_parse_result(result);
+}
+
+static void run_test_struct_members(RedTest test)
+{
+    SDDLVarDecl strct = sddl_var_new_struct(SDDL_DIRECTION_OUT, "motor");
+    SDDLVarDecl temp = sddl_var_new_basic(SDDL_DATATYPE_FLOAT32, SDDL_DIRECTION_INHERIT, "temp");
+    SDDLVarDecl rpm = sddl_var_new_basic(SDDL_DATATYPE_UINT32, SDDL_DIRECTION_INHERIT, "rpm");
+
+    sddl_var_struct_add_member(strct, temp);
+    RedTest_Verify(test, "members - lookup", sddl_var_struct_member_by_name(strct, "temp") == temp);
+    sddl_var_struct_add_member(strct, rpm);
+    RedTest_Verify(test, "members - lookup after add", sddl_var_struct_member_by_name(strct, "rpm") == rpm);
+    RedTest_Verify(test, "members - by idx", sddl_var_struct_member_by_idx(strct, 1) == rpm);
+    RedTest_Verify(test, "members - missing", !sddl_var_struct_member_by_name(strct, "motor"));
+}
+
+static void run_test_struct_add_members(RedTest test)
+{
+    SDDLVarDecl strct = sddl_var_new_struct(SDDL_DIRECTION_OUT, "pump");
+    SDDLVarDecl members[3];
+    RedJsonObject json;
+    unsigned numItems;
+
+    members[0] = sddl_var_new_basic(SDDL_DATATYPE_FLOAT32, SDDL_DIRECTION_INHERIT, "flow");
+    members[1] = sddl_var_new_basic(SDDL_DATATYPE_BOOL, SDDL_DIRECTION_IN, "on");
+    members[2] = sddl_var_new_array(SDDL_DATATYPE_INT8, 4, SDDL_DIRECTION_INHERIT, "codes");
+
+    RedTest_Verify(test, "add members - bulk", sddl_var_struct_add_members(strct, members, 2)
+            && sddl_var_struct_num_members(strct) == 2
+            && sddl_var_struct_member_by_name(strct, "on") == members[1]);
+    RedTest_Verify(test, "add members - inherits direction", sddl_var_concrete_direction(members[0]) == SDDL_DIRECTION_OUT);
+
+    json = sddl_var_json(strct);
+    RedTest_Verify(test, "add members - json cached", json && sddl_var_json(strct) == json);
+    numItems = RedJsonObject_NumItems(json);
+    sddl_var_struct_add_members(strct, &members[2], 1);
+    RedTest_Verify(test, "add members - json rebuilt", RedJsonObject_NumItems(sddl_var_json(strct)) == numItems + 1);
+}
+
 int main(int argc, const char *argv[])
 {
     RedTest test;
@@ -43,6 +1088,31 @@ int main(int argc, const char *argv[])
 
     run_test1(test);
     run_test2(test);
+    run_test_native_parser(test);
+    run_test_streaming(test);
+    run_test_source_rewrite(test);
+    run_test_parse_decls(test);
+    run_test_image(test);
+    run_test_image_layout(test);
+    run_test_codec(test);
+    run_test_validator(test);
+    run_test_layout(test);
+    run_test_column_store(test);
+    run_test_arena(test);
+    run_test_parse_stats(test);
+    run_test_allocator(test);
+    run_test_diagnostics(test);
+    run_test_freeze(test);
+    run_test_load_batch(test);
+    run_test_cache(test);
+    run_test_serialize(test);
+    run_test_diff(test);
+    run_test_live_schema(test);
+    run_test_lookup(test);
+    run_test_nested_structs(test);
+    run_test_query(test);
+    run_test_struct_members(test);
+    run_test_struct_add_members(test);
 
     return RedTest_End(test);
 }